@@ -0,0 +1,158 @@
+#include "aggregates.h"
+#include "geneticcode.h"
+
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+
+// Accumulators live until the end of process, because threads which
+// filled them might be finished before merge
+static QMutex accumulatorsMutex;
+static QList<Aggregates*> accumulators;
+
+Aggregates &Aggregates::local()
+{
+    static thread_local Aggregates * accumulator = nullptr;
+    if (!accumulator) {
+        accumulator = new Aggregates;
+        QMutexLocker lock(&accumulatorsMutex);
+        accumulators.append(accumulator);
+    }
+    return *accumulator;
+}
+
+Aggregates Aggregates::merged()
+{
+    QMutexLocker lock(&accumulatorsMutex);
+    Aggregates result;
+    Q_FOREACH(const Aggregates * accumulator, accumulators) {
+        result.merge(*accumulator);
+    }
+    return result;
+}
+
+void Aggregates::addCodons(qint32 organismId, const QVector<quint32> &counts)
+{
+    if (counts.isEmpty()) {
+        return;
+    }
+    QVector<qint64> & usage = codonUsage[organismId];
+    if (usage.isEmpty()) {
+        usage.fill(0, GeneticCode::CodonsCount);
+    }
+    for (int i = 0; i < GeneticCode::CodonsCount; ++i) {
+        usage[i] += counts[i];
+    }
+}
+
+int Aggregates::lengthBin(qint64 length)
+{
+    int bin = 0;
+    while (length > 1 && bin < LengthBinsCount - 1) {
+        length >>= 1;
+        ++bin;
+    }
+    return bin;
+}
+
+Aggregates::IntronCounts::IntronCounts()
+    : types(IntronTypesCount, 0)
+    , lengthBins(LengthBinsCount, 0)
+    , phases(3, 0)
+{
+}
+
+void Aggregates::IntronCounts::add(qint32 intronTypeId, qint64 length,
+                                   const QString &spliceClass, int phase)
+{
+    if (intronTypeId >= 1 && intronTypeId <= IntronTypesCount) {
+        types[intronTypeId - 1] ++;
+    }
+    lengthBins[lengthBin(length)] ++;
+    if (!spliceClass.isEmpty()) {
+        spliceClasses[spliceClass] ++;
+    }
+    if (phase >= 0 && phase < phases.size()) {
+        phases[phase] ++;
+    }
+}
+
+void Aggregates::IntronCounts::merge(const IntronCounts &other, int sign)
+{
+    for (int i = 0; i < IntronTypesCount; ++i) {
+        types[i] += sign * other.types[i];
+    }
+    for (int i = 0; i < LengthBinsCount; ++i) {
+        lengthBins[i] += sign * other.lengthBins[i];
+    }
+    Q_FOREACH(const QString & spliceClass, other.spliceClasses.keys()) {
+        spliceClasses[spliceClass] += sign * other.spliceClasses[spliceClass];
+    }
+    for (int i = 0; i < phases.size(); ++i) {
+        phases[i] += sign * other.phases[i];
+    }
+}
+
+void Aggregates::addIntrons(SequencePtr sequence)
+{
+    const OrganismPtr organism = sequence->organism.toStrongRef();
+    if (!organism) {
+        return;
+    }
+    qint32 chromosomeId = 0;
+    const ChromosomePtr chromosome = sequence->chromosome.toStrongRef();
+    if (chromosome) {
+        chromosome->mutex.lock();
+        chromosomeId = chromosome->id;
+        chromosome->mutex.unlock();
+    }
+
+    // Sequence is counted locally first, so organism and chromosome
+    // entries are looked up once per sequence but not per intron
+    // Introns shared by isoforms have the same id, and are counted once
+    // like their rows
+    IntronCounts counts;
+    QSet<qint32> intronIds;
+    Q_FOREACH(GenePtr gene, sequence->genes) {
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            Q_FOREACH(IntronPtr intron, isoform->introns) {
+                if (intron->id > 0 && intronIds.contains(intron->id)) {
+                    continue;
+                }
+                intronIds.insert(intron->id);
+                counts.add(intron->intronTypeId,
+                           qint64(intron->end) - qint64(intron->start) + 1,
+                           intron->spliceClass, intron->phase);
+            }
+        }
+    }
+    addIntrons(organism->id, chromosomeId, counts);
+}
+
+void Aggregates::addIntrons(qint32 organismId, qint32 chromosomeId,
+                            const IntronCounts &counts)
+{
+    intronCounts[qMakePair(organismId, 0)].merge(counts);
+    if (chromosomeId > 0) {
+        intronCounts[qMakePair(organismId, chromosomeId)].merge(counts);
+    }
+}
+
+void Aggregates::merge(const Aggregates &other, int sign)
+{
+    Q_FOREACH(const qint32 organismId, other.codonUsage.keys()) {
+        const QVector<qint64> & counts = other.codonUsage[organismId];
+        QVector<qint64> & usage = codonUsage[organismId];
+        if (usage.isEmpty()) {
+            usage.fill(0, GeneticCode::CodonsCount);
+        }
+        for (int i = 0; i < GeneticCode::CodonsCount; ++i) {
+            usage[i] += sign * counts[i];
+        }
+    }
+    typedef QPair<qint32,qint32> Key;
+    Q_FOREACH(const Key & key, other.intronCounts.keys()) {
+        intronCounts[key].merge(other.intronCounts[key], sign);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef AGGREGATES_H
+#define AGGREGATES_H
+
+#include "structures.h"
+
+#include <QMap>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+// Run-wide statistics which are summed while sequences are derived. Each
+// thread adds to its own accumulator without locks, and accumulators are
+// merged once at the end of run, when all workers are finished. Counts of
+// stored sequences replaced by the run are subtracted, so counts might be
+// negative.
+class Aggregates
+{
+public:
+    // Accumulator of calling thread
+    static Aggregates & local();
+
+    // Sum of all accumulators. Not thread-safe against local() users,
+    // so call it only after workers and derivation tasks are done.
+    static Aggregates merged();
+
+    static const int IntronTypesCount = 27;
+    static const int LengthBinsCount = 32;
+
+    // Bin of length L covers lengths from 2^L to 2^(L+1)-1
+    static int lengthBin(qint64 length);
+
+    // Counts of stored introns of organism or one of its chromosomes
+    struct IntronCounts {
+        QVector<qint64> types;  // by intron type id - 1
+        QVector<qint64> lengthBins;
+        QMap<QString,qint64> spliceClasses;  // empty for coordinates only
+        QVector<qint64> phases;  // by intron phase 0, 1 and 2
+
+        IntronCounts();
+        // Empty splice class is not counted
+        void add(qint32 intronTypeId, qint64 length,
+                 const QString & spliceClass, int phase);
+        // Sign -1 subtracts other
+        void merge(const IntronCounts & other, int sign = 1);
+    };
+
+    void addCodons(qint32 organismId, const QVector<quint32> & counts);
+    void addIntrons(SequencePtr sequence);
+    // Adds to counts of organism, and of its chromosome if it is not 0
+    void addIntrons(qint32 organismId, qint32 chromosomeId,
+                    const IntronCounts & counts);
+    // Sign -1 subtracts other
+    void merge(const Aggregates & other, int sign = 1);
+
+    // 64 codon counts in TCAG order by organism id
+    QMap< qint32, QVector<qint64> > codonUsage;
+
+    // Intron counts by organism id and chromosome id. Chromosome id 0 is
+    // for all sequences of organism.
+    QMap< QPair<qint32,qint32>, IntronCounts > intronCounts;
+};
+
+#endif // AGGREGATES_H
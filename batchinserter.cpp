@@ -0,0 +1,68 @@
+#include "batchinserter.h"
+
+#include <QDebug>
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QSqlField>
+#include <QSqlQuery>
+
+BatchInserter::BatchInserter(QSqlDatabase *db, const QString &tableName,
+                             const QStringList &columns)
+    : _db(db)
+    , _tableName(tableName)
+    , _columns(columns)
+{
+}
+
+void BatchInserter::setSuffix(const QString &suffix)
+{
+    _suffix = suffix;
+}
+
+bool BatchInserter::addRow(const QVariantList &values)
+{
+    Q_ASSERT(values.size() == _columns.size());
+    // Values are formatted by driver, which escapes strings, so the whole
+    // batch goes to server as one plain statement without prepare
+    const QSqlDriver * driver = _db->driver();
+    QStringList formatted;
+    Q_FOREACH(const QVariant & value, values) {
+        QSqlField field("", value.type());
+        field.setValue(value);
+        formatted.append(driver->formatValue(field));
+    }
+    const QString row = "(" + formatted.join(",") + ")";
+    _rows.append(row);
+    _bytes += row.size() + 1;
+    if (_rows.size() >= DefaultMaxRows || _bytes >= DefaultMaxBytes) {
+        return flush();
+    }
+    return true;
+}
+
+bool BatchInserter::flush()
+{
+    if (_rows.isEmpty()) {
+        return !_failed;
+    }
+    QSqlQuery query("", *_db);
+    // Not QString::arg, because values might contain '%' markers
+    const QString statement = "INSERT INTO " + _tableName +
+            "(" + _columns.join(", ") + ") VALUES " + _rows.join(",") +
+            " " + _suffix;
+    const bool ok = query.exec(statement);
+    if (!ok) {
+        _failed = true;
+        qWarning() << query.lastError();
+        qWarning() << query.lastError().text();
+        qWarning() << query.lastQuery().left(1024);
+    }
+    _rows.clear();
+    _bytes = 0;
+    return !_failed;
+}
+
+int BatchInserter::pendingRows() const
+{
+    return _rows.size();
+}
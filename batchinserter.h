@@ -0,0 +1,43 @@
+#ifndef BATCHINSERTER_H
+#define BATCHINSERTER_H
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+// Collects rows of one table and inserts them by multi-row INSERT
+// statements, so each statement is one round trip for many rows. Batch
+// is flushed when it has enough rows or its statement becomes too long,
+// and the rest of rows is flushed explicitly.
+class BatchInserter
+{
+public:
+    static const int DefaultMaxRows = 1000;
+    static const int DefaultMaxBytes = 512 * 1024;  // below max_allowed_packet
+
+    BatchInserter(QSqlDatabase * db, const QString & tableName,
+                  const QStringList & columns);
+
+    // Statement tail, like ON DUPLICATE KEY UPDATE clause
+    void setSuffix(const QString & suffix);
+
+    // Values are in order of columns
+    bool addRow(const QVariantList & values);
+
+    // Returns false if this or any earlier flush of inserter failed
+    bool flush();
+
+    int pendingRows() const;
+
+private:
+    QSqlDatabase *  _db;
+    QString         _tableName;
+    QStringList     _columns;
+    QString         _suffix;
+    QStringList     _rows;  // formatted '(...)' value lists
+    int             _bytes = 0;
+    bool            _failed = false;
+};
+
+#endif // BATCHINSERTER_H
@@ -0,0 +1,153 @@
+#include "bulkloader.h"
+
+#include <QDebug>
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QSqlField>
+#include <QSqlQuery>
+
+BulkLoader::BulkLoader(QSqlDatabase *db, const QString &spoolDir)
+    : _db(db)
+    , _spoolDir(QDir::root())
+{
+    const QString absPath = QDir(spoolDir).absolutePath();
+    if (QDir::root().mkpath(absPath)) {
+        _spoolDir = QDir(absPath);
+    }
+}
+
+bool BulkLoader::addRow(const QString &tableName, const QStringList &columns,
+                        const QVariantList &values)
+{
+    Q_ASSERT(values.size() == columns.size());
+    QSharedPointer<Spool> & spool = _spools[tableName];
+    if (!spool) {
+        spool = QSharedPointer<Spool>(new Spool);
+        spool->columns = columns;
+        spool->file.setFileTemplate(_spoolDir.absoluteFilePath(tableName + "_XXXXXX.tsv"));
+        if (!spool->file.open()) {
+            qWarning() << "Can't create spool file in " << _spoolDir.absolutePath();
+            _spools.remove(tableName);
+            return false;
+        }
+    }
+    QByteArray line;
+    for (int i = 0; i < values.size(); ++i) {
+        if (i > 0) {
+            line.append('\t');
+        }
+        appendValue(&line, values[i]);
+    }
+    line.append('\n');
+    if (spool->file.write(line) != line.size()) {
+        qWarning() << "Can't write spool file " << spool->file.fileName();
+        return false;
+    }
+    spool->bytes += line.size();
+    return true;
+}
+
+bool BulkLoader::isFull() const
+{
+    Q_FOREACH(QSharedPointer<Spool> spool, _spools) {
+        if (spool->bytes >= DefaultMaxSpoolBytes) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BulkLoader::mark()
+{
+    Q_FOREACH(QSharedPointer<Spool> spool, _spools) {
+        spool->markBytes = spool->bytes;
+    }
+}
+
+void BulkLoader::rollbackToMark()
+{
+    // Spools created after mark have zero mark
+    Q_FOREACH(QSharedPointer<Spool> spool, _spools) {
+        truncate(spool.data(), spool->markBytes);
+    }
+}
+
+bool BulkLoader::load()
+{
+    Q_FOREACH(const QString & tableName, _spools.keys()) {
+        if (!load(tableName, _spools[tableName].data())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BulkLoader::clear()
+{
+    Q_FOREACH(QSharedPointer<Spool> spool, _spools) {
+        truncate(spool.data(), 0);
+    }
+}
+
+void BulkLoader::truncate(Spool *spool, qint64 bytes)
+{
+    spool->file.flush();
+    spool->file.resize(bytes);
+    spool->file.seek(bytes);
+    spool->bytes = bytes;
+    spool->markBytes = qMin(spool->markBytes, bytes);
+}
+
+void BulkLoader::appendValue(QByteArray *line, const QVariant &value)
+{
+    // Escapes of LOAD DATA defaults: fields are separated by tab, lines by
+    // new line, and backslash escapes them, itself and NULL
+    if (value.isNull()) {
+        line->append("\\N");
+        return;
+    }
+    if (QVariant::Bool == value.type()) {
+        line->append(value.toBool() ? '1' : '0');
+        return;
+    }
+    if (QVariant::Double == value.type()) {
+        line->append(QByteArray::number(value.toDouble(), 'g', 17));
+        return;
+    }
+    const QByteArray text = value.toString().toUtf8();
+    for (int i = 0; i < text.size(); ++i) {
+        const char c = text.at(i);
+        switch (c) {
+        case '\\': line->append("\\\\"); break;
+        case '\t': line->append("\\t"); break;
+        case '\n': line->append("\\n"); break;
+        case '\r': line->append("\\r"); break;
+        case '\0': line->append("\\0"); break;
+        default: line->append(c);
+        }
+    }
+}
+
+bool BulkLoader::load(const QString &tableName, Spool *spool)
+{
+    if (0 == spool->bytes) {
+        return true;
+    }
+    spool->file.flush();
+    QSqlField path("", QVariant::String);
+    path.setValue(spool->file.fileName());
+    QSqlQuery query("", *_db);
+    const bool ok = query.exec(
+                "LOAD DATA LOCAL INFILE " + _db->driver()->formatValue(path) +
+                " INTO TABLE " + tableName +
+                " CHARACTER SET utf8"
+                " FIELDS TERMINATED BY '\\t' ESCAPED BY '\\\\'"
+                " LINES TERMINATED BY '\\n'"
+                " (" + spool->columns.join(", ") + ")");
+    if (!ok) {
+        qWarning() << query.lastError();
+        qWarning() << query.lastError().text();
+        qWarning() << query.lastQuery();
+    }
+    return ok;
+}
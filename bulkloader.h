@@ -0,0 +1,62 @@
+#ifndef BULKLOADER_H
+#define BULKLOADER_H
+
+#include <QByteArray>
+#include <QDir>
+#include <QMap>
+#include <QSharedPointer>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QVariant>
+
+// Writes rows into tab-separated spool file of each table and loads spool
+// by LOAD DATA LOCAL INFILE, which is much faster than inserts for large
+// loads. Nothing is returned by load, so rows referenced by other rows
+// must have their ids already. Spooled rows belong to the transaction of
+// their sequences: they are loaded by it before commit, and spools are
+// cleared once it is committed or rolled back.
+class BulkLoader
+{
+public:
+    static const qint64 DefaultMaxSpoolBytes = 64 * 1024 * 1024;
+
+    BulkLoader(QSqlDatabase * db, const QString & spoolDir);
+
+    // Values are in order of columns, which are the same for all rows of
+    // table
+    bool addRow(const QString & tableName, const QStringList & columns,
+                const QVariantList & values);
+
+    // Some spool reached size limit, so transaction should be committed
+    bool isFull() const;
+
+    // Rows added after mark are dropped by rollbackToMark, like rows of
+    // savepoint are
+    void mark();
+    void rollbackToMark();
+
+    // Loads all spools, stopping at the first failed one. Spools are kept
+    // either way, so failed load might be repeated.
+    bool load();
+    void clear();
+
+private:
+    struct Spool {
+        QStringList     columns;
+        QTemporaryFile  file;
+        qint64          bytes = 0;
+        qint64          markBytes = 0;
+    };
+
+    static void appendValue(QByteArray * line, const QVariant & value);
+    bool load(const QString & tableName, Spool * spool);
+    static void truncate(Spool * spool, qint64 bytes);
+
+    QSqlDatabase *  _db;
+    QDir            _spoolDir;
+    QMap< QString, QSharedPointer<Spool> > _spools;
+};
+
+#endif // BULKLOADER_H
@@ -0,0 +1,195 @@
+#include "catalog.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+static const char * CATALOG_SIGNATURE = "#introns_db_fill catalog 2";
+// Catalogs of first version have no definitions
+static const char * CATALOG_SIGNATURE_1 = "#introns_db_fill catalog 1";
+
+QString Catalog::fileNameFor(const QString &sourceFileName)
+{
+    return sourceFileName + ".catalog";
+}
+
+static QString qualifierValue(const QByteArray &qualifier)
+{
+    const int start = qualifier.indexOf('"') + 1;
+    const int end = qualifier.lastIndexOf('"');
+    if (0 == start || end < start) {
+        return QString();
+    }
+    return QString::fromLatin1(qualifier.mid(start, end - start));
+}
+
+bool Catalog::scan(QIODevice *source)
+{
+    _entries.clear();
+    quint64 offset = 0;
+    CatalogEntry entry;
+    bool inRecord = false;
+    bool inFeatures = false;
+    bool inSource = false;
+    bool inOrigin = false;
+    bool inDefinition = false;
+    bool mitochondrion = false;
+
+    while (!source->atEnd()) {
+        const QByteArray line = source->readLine();
+        if (line.isEmpty()) {
+            break;
+        }
+        const quint64 lineOffset = offset;
+        offset += line.size();
+
+        // Definition continues by indented lines
+        if (inDefinition && line.startsWith("            ")) {
+            entry.definition += " " + QString::fromUtf8(line.trimmed());
+            continue;
+        }
+        inDefinition = false;
+
+        if ("//" == line.trimmed()) {
+            if (inRecord) {
+                if (entry.chromosome.isEmpty() && mitochondrion) {
+                    entry.chromosome = "mitochondrion";
+                }
+                _entries.append(entry);
+            }
+            inRecord = inFeatures = inSource = inOrigin = mitochondrion = false;
+        }
+        else if (inOrigin) {
+            continue;
+        }
+        else if (line.startsWith("LOCUS")) {
+            entry = CatalogEntry();
+            entry.offset = lineOffset;
+            const QList<QByteArray> words = line.simplified().split(' ');
+            if (words.size() > 2) {
+                entry.accession = QString::fromLatin1(words[1]);
+                entry.length = words[2].toUInt();
+            }
+            inRecord = true;
+        }
+        else if (!inRecord) {
+            continue;
+        }
+        else if (line.startsWith("ORIGIN")) {
+            inOrigin = true;
+        }
+        else if (inFeatures) {
+            const bool featureKey =
+                    line.size() > 5 && line.startsWith("     ") && ' ' != line[5];
+            if (featureKey) {
+                entry.featuresCount ++;
+                inSource = "source" == line.mid(5, 16).trimmed();
+            }
+            else if (inSource) {
+                const QByteArray qualifier = line.trimmed();
+                if (qualifier.startsWith("/chromosome=")) {
+                    entry.chromosome = qualifierValue(qualifier);
+                }
+                else if (qualifier.startsWith("/organelle=")) {
+                    mitochondrion = "mitochondrion" == qualifierValue(qualifier);
+                }
+            }
+        }
+        else if (line.startsWith("DEFINITION")) {
+            entry.definition = QString::fromUtf8(line.mid(12).trimmed());
+            inDefinition = true;
+        }
+        else if (line.startsWith("VERSION")) {
+            entry.version = QString::fromLatin1(line.mid(12).simplified().split(' ').first());
+        }
+        else if (line.startsWith("  ORGANISM")) {
+            entry.organism = QString::fromUtf8(line.mid(12).trimmed());
+        }
+        else if (line.startsWith("FEATURES")) {
+            inFeatures = true;
+        }
+    }
+    return !_entries.isEmpty();
+}
+
+bool Catalog::load(const QString &fileName)
+{
+    _entries.clear();
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly|QIODevice::Text)) {
+        return false;
+    }
+    QTextStream ts(&file);
+    ts.setCodec("UTF-8");
+    const QString signature = ts.readLine();
+    const bool firstVersion = CATALOG_SIGNATURE_1 == signature;
+    if (signature != CATALOG_SIGNATURE && !firstVersion) {
+        qWarning() << "File '" << fileName << "' is not a catalog. Ignored!";
+        return false;
+    }
+    const int fieldsCount = firstVersion ? 7 : 8;
+    while (!ts.atEnd()) {
+        const QString line = ts.readLine();
+        if (line.startsWith('#') || line.isEmpty()) {
+            continue;
+        }
+        const QStringList fields = line.split('\t');
+        if (fields.size() != fieldsCount) {
+            qWarning() << "Malformed line in catalog '" << fileName << "': " << line;
+            continue;
+        }
+        CatalogEntry entry;
+        entry.offset = fields[0].toULongLong();
+        entry.accession = fields[1];
+        entry.version = fields[2];
+        entry.organism = fields[3];
+        entry.chromosome = fields[4];
+        entry.length = fields[5].toUInt();
+        entry.featuresCount = fields[6].toUInt();
+        if (!firstVersion) {
+            entry.definition = fields[7];
+        }
+        _entries.append(entry);
+    }
+    return true;
+}
+
+bool Catalog::save(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly|QIODevice::Text)) {
+        qWarning() << "Can't open '" << fileName << "'. Catalog will not be stored!";
+        return false;
+    }
+    QTextStream ts(&file);
+    ts.setCodec("UTF-8");
+    ts << CATALOG_SIGNATURE << "\n";
+    ts << "#offset\taccession\tversion\torganism\tchromosome\tlength\tfeatures\tdefinition\n";
+    Q_FOREACH(const CatalogEntry & entry, _entries) {
+        ts << entry.offset << "\t"
+           << entry.accession << "\t"
+           << entry.version << "\t"
+           << QString(entry.organism).replace('\t', ' ') << "\t"
+           << QString(entry.chromosome).replace('\t', ' ') << "\t"
+           << entry.length << "\t"
+           << entry.featuresCount << "\t"
+           << QString(entry.definition).replace('\t', ' ') << "\n";
+    }
+    ts.flush();
+    return QTextStream::Ok == ts.status();
+}
+
+const QList<CatalogEntry> &Catalog::entries() const
+{
+    return _entries;
+}
+
+quint64 Catalog::totalLength() const
+{
+    quint64 result = 0;
+    Q_FOREACH(const CatalogEntry & entry, _entries) {
+        result += entry.length;
+    }
+    return result;
+}
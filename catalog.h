@@ -0,0 +1,39 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <QIODevice>
+#include <QList>
+#include <QString>
+
+struct CatalogEntry {
+    quint64         offset = 0;  // of LOCUS line in uncompressed stream
+    QString         accession;
+    QString         version;
+    QString         definition;
+    QString         organism;
+    QString         chromosome;
+    quint32         length = 0;
+    quint32         featuresCount = 0;
+};
+
+// Header-only index of GBK records. Scanning reads LOCUS, DEFINITION,
+// VERSION, ORGANISM and the source feature of each record, counts other
+// features by their keys and skips everything else up to the '//'
+// terminator.
+class Catalog
+{
+public:
+    static QString fileNameFor(const QString & sourceFileName);
+
+    bool scan(QIODevice * source);
+    bool load(const QString & fileName);
+    bool save(const QString & fileName) const;
+
+    const QList<CatalogEntry> & entries() const;
+    quint64 totalLength() const;
+
+private:
+    QList<CatalogEntry> _entries;
+};
+
+#endif // CATALOG_H
@@ -0,0 +1,54 @@
+#include "composition.h"
+
+// Block is small enough to stay in L1 cache between counting and runs loops
+static const int BLOCK_SIZE = 1024;
+
+Composition countComposition(const QByteArray &bases)
+{
+    Composition result;
+    const int size = bases.size();
+    // QByteArray data is always terminated by '\0', so the next base
+    // might be read for the last one too
+    const uchar * data = reinterpret_cast<const uchar*>(bases.constData());
+
+    quint32 gc = 0;
+    quint32 n = 0;
+    quint32 cpg = 0;
+    quint32 run = 0;  // count of bases equal to the previous one
+    quint32 longestRun = 0;
+    quint32 runs = 0;
+    uchar same[BLOCK_SIZE];
+
+    for (int blockStart = 0; blockStart < size; blockStart += BLOCK_SIZE) {
+        const int blockSize = qMin(BLOCK_SIZE, size - blockStart);
+        const uchar * block = data + blockStart;
+
+        // No dependencies between iterations and no branches, so compiler
+        // turns this loop into SIMD compares and additions
+        for (int i = 0; i < blockSize; ++i) {
+            const uchar base = block[i];
+            const uchar next = block[i + 1];
+            gc += ('G' == base) | ('C' == base);
+            n += 'N' == base;
+            cpg += ('C' == base) & ('G' == next);
+            // Gaps of N are not homopolymers
+            same[i] = (base == next) & ('N' != base);
+        }
+
+        // Runs depend on previous base, so they are scanned separately
+        // over flags of the block
+        for (int i = 0; i < blockSize; ++i) {
+            const quint32 length = run + 1;
+            runs += !same[i] & (length >= HOMOPOLYMER_MIN_LENGTH);
+            longestRun = qMax(longestRun, length);
+            run = same[i] ? length : 0;
+        }
+    }
+
+    result.gcCount = gc;
+    result.nCount = n;
+    result.cpgCount = cpg;
+    result.homopolymerRuns = runs;
+    result.longestHomopolymer = 0 == size ? 0 : longestRun;
+    return result;
+}
@@ -0,0 +1,14 @@
+#ifndef COMPOSITION_H
+#define COMPOSITION_H
+
+#include "structures.h"
+
+#include <QByteArray>
+
+// Runs of at least this number of identical bases are counted
+static const quint32 HOMOPOLYMER_MIN_LENGTH = 5;
+
+// Counts composition of upper-case bases in one pass
+Composition countComposition(const QByteArray & bases);
+
+#endif // COMPOSITION_H
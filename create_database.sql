@@ -1,9 +1,16 @@
+DROP TABLE IF EXISTS isoform_introns;
+DROP TABLE IF EXISTS isoform_exons;
 DROP TABLE IF EXISTS introns;
 DROP TABLE IF EXISTS exons;
 DROP TABLE IF EXISTS isoforms;
 DROP TABLE IF EXISTS orphaned_cdses;
 DROP TABLE IF EXISTS genes;
 DROP TABLE IF EXISTS sequences;
+DROP TABLE IF EXISTS codon_usage;
+DROP TABLE IF EXISTS intron_type_counts;
+DROP TABLE IF EXISTS intron_length_bins;
+DROP TABLE IF EXISTS intron_class_counts;
+DROP TABLE IF EXISTS intron_phase_counts;
 DROP TABLE IF EXISTS organisms;
 DROP TABLE IF EXISTS chromosomes;
 DROP TABLE IF EXISTS intron_types;
@@ -11,6 +18,7 @@ DROP TABLE IF EXISTS tax_groups2;
 DROP TABLE IF EXISTS tax_groups1;
 DROP TABLE IF EXISTS tax_kingdoms;
 DROP TABLE IF EXISTS orthologous_groups;
+DROP TABLE IF EXISTS id_allocators;
 
 
 /* STATIC TABLE intron_types */
@@ -117,6 +125,56 @@ CREATE TABLE organisms(
     introns_count INT DEFAULT 0
 );
 
+/* Codons of all CDS isoforms, summed during ingest */
+CREATE TABLE codon_usage(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_organisms INT NOT NULL,
+    codon VARCHAR(3) NOT NULL,
+    codons_count BIGINT NOT NULL DEFAULT 0,
+    CONSTRAINT unique_codon_usage UNIQUE(id_organisms, codon)
+);
+
+/* Intron summaries, summed during ingest. Rows with id_chromosomes = 0
+   are for all sequences of organism. */
+CREATE TABLE intron_type_counts(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_organisms INT NOT NULL,
+    id_chromosomes INT NOT NULL DEFAULT 0,
+    id_intron_types INT NOT NULL,
+    introns_count BIGINT NOT NULL DEFAULT 0,
+    CONSTRAINT unique_intron_type_counts UNIQUE(id_organisms, id_chromosomes, id_intron_types)
+);
+
+/* Lengths from min_length to max_length, which are powers of 2 */
+CREATE TABLE intron_length_bins(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_organisms INT NOT NULL,
+    id_chromosomes INT NOT NULL DEFAULT 0,
+    bin SMALLINT NOT NULL,
+    min_length BIGINT NOT NULL,
+    max_length BIGINT NOT NULL,
+    introns_count BIGINT NOT NULL DEFAULT 0,
+    CONSTRAINT unique_intron_length_bins UNIQUE(id_organisms, id_chromosomes, bin)
+);
+
+CREATE TABLE intron_class_counts(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_organisms INT NOT NULL,
+    id_chromosomes INT NOT NULL DEFAULT 0,
+    splice_class VARCHAR(5) NOT NULL,
+    introns_count BIGINT NOT NULL DEFAULT 0,
+    CONSTRAINT unique_intron_class_counts UNIQUE(id_organisms, id_chromosomes, splice_class)
+);
+
+CREATE TABLE intron_phase_counts(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_organisms INT NOT NULL,
+    id_chromosomes INT NOT NULL DEFAULT 0,
+    phase SMALLINT NOT NULL,
+    introns_count BIGINT NOT NULL DEFAULT 0,
+    CONSTRAINT unique_intron_phase_counts UNIQUE(id_organisms, id_chromosomes, phase)
+);
+
 CREATE TABLE chromosomes(
     id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
     id_organisms INT NOT NULL,
@@ -135,7 +193,9 @@ CREATE TABLE sequences(
     lengthh INT NOT NULL DEFAULT 0,
     id_organisms INT NOT NULL,
     id_chromosomes INT,
-    origin_file_name VARCHAR(50)
+    origin_file_name VARCHAR(50),
+    coordinates_only BOOLEAN NOT NULL DEFAULT 0,
+    codon_counts TEXT /* of CDS isoforms, 64 comma separated in TCAG order */
 );
 
 
@@ -189,10 +249,10 @@ create TABLE isoforms(
     maximum_by_introns BOOLEAN,
 
     error_in_length BOOLEAN NOT NULL DEFAULT 0,
-    error_in_start_codon BOOLEAN NOT NULL DEFAULT 0,
-    error_in_end_codon BOOLEAN NOT NULL DEFAULT 0,
-    error_in_intron BOOLEAN NOT NULL DEFAULT 0,
-    error_in_coding_exon BOOLEAN NOT NULL DEFAULT 0,
+    error_in_start_codon BOOLEAN DEFAULT 0,
+    error_in_end_codon BOOLEAN DEFAULT 0,
+    error_in_intron BOOLEAN DEFAULT 0,
+    error_in_coding_exon BOOLEAN DEFAULT 0,
     error_main BOOLEAN NOT NULL DEFAULT 0,
     error_comment TEXT
 );
@@ -219,7 +279,13 @@ create TABLE exons(
     next_intron INT DEFAULT 0,
 
     error_in_pseudo_flag BOOLEAN NOT NULL DEFAULT 0,
-    error_n_in_sequence BOOLEAN NOT NULL DEFAULT 0
+    error_n_in_sequence BOOLEAN DEFAULT 0,
+
+    gc_content FLOAT,
+    cpg_count INT,
+    n_count INT,
+    homopolymer_runs INT,
+    longest_homopolymer INT
 );
 
 create TABLE introns(
@@ -243,19 +309,106 @@ create TABLE introns(
     length_phase SMALLINT,
     phase SMALLINT,
 
-    error_start_dinucleotide BOOLEAN NOT NULL DEFAULT 0,
-    error_end_dinucleotide BOOLEAN NOT NULL DEFAULT 0,
+    error_start_dinucleotide BOOLEAN DEFAULT 0,
+    error_end_dinucleotide BOOLEAN DEFAULT 0,
     error_main BOOLEAN NOT NULL DEFAULT 0,
 
-    warning_n_in_sequence BOOLEAN NOT NULL DEFAULT 0
+    warning_n_in_sequence BOOLEAN DEFAULT 0,
+
+    donor_score FLOAT,
+    acceptor_score FLOAT,
+    u12_donor_score FLOAT,
+    spliceosome VARCHAR(3),
+    splice_class VARCHAR(5),
+
+    gc_content FLOAT,
+    cpg_count INT,
+    n_count INT,
+    homopolymer_runs INT,
+    longest_homopolymer INT
 );
 
+/* Links of isoforms to exons and introns in --deduplicate-features mode */
+create TABLE isoform_exons(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_isoforms INT NOT NULL,
+    id_exons INT NOT NULL,
+    id_sequences INT NOT NULL,
+
+    typee SMALLINT NOT NULL DEFAULT 4 /* = Unknown */,
+    start_phase SMALLINT,
+    end_phase SMALLINT,
+    indexx INT,
+    rev_index INT,
+
+    prev_intron INT DEFAULT 0,
+    next_intron INT DEFAULT 0
+);
+
+create TABLE isoform_introns(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_isoforms INT NOT NULL,
+    id_introns INT NOT NULL,
+    id_sequences INT NOT NULL,
+
+    id_intron_types INT,
+    phase SMALLINT,
+    indexx INT,
+    rev_index INT,
+
+    prev_exon INT NOT NULL,
+    next_exon INT NOT NULL
+);
+
+/* Next free ids of tables, reserved by loaders in blocks. Row of table is
+   seeded once from its MAX(id), and loaders give ids of genes, isoforms,
+   exons and introns from reserved blocks, not by AUTO_INCREMENT. So any
+   other writer of these tables must reserve its ids here too; rows added
+   by AUTO_INCREMENT or with explicit ids collide with reserved blocks.
+   Delete row of table when no loader runs to seed it again. Loader
+   creates this table itself if database has none. */
+create TABLE id_allocators(
+    table_name VARCHAR(64) NOT NULL PRIMARY KEY,
+    next_id INT NOT NULL
+);
+
+/* Secondary indexes. Loader with --staging-tables builds the same indexes
+   on its staging tables, as it reads them from these tables. */
+CREATE INDEX organisms_name ON organisms(name);
+CREATE INDEX chromosomes_organism_name ON chromosomes(id_organisms, name);
+CREATE INDEX sequences_organism_refseq ON sequences(id_organisms, refseq_id);
+CREATE INDEX orphaned_cdses_refseq ON orphaned_cdses(refseq_id);
+CREATE INDEX genes_sequence ON genes(id_sequences);
+CREATE INDEX genes_organism ON genes(id_organisms);
+CREATE INDEX isoforms_sequence ON isoforms(id_sequences);
+CREATE INDEX isoforms_gene ON isoforms(id_genes);
+CREATE INDEX exons_sequence ON exons(id_sequences);
+CREATE INDEX exons_gene ON exons(id_genes);
+CREATE INDEX exons_isoform ON exons(id_isoforms);
+CREATE INDEX introns_sequence ON introns(id_sequences);
+CREATE INDEX introns_gene ON introns(id_genes);
+CREATE INDEX introns_isoform ON introns(id_isoforms);
+CREATE INDEX introns_type ON introns(id_intron_types);
+CREATE INDEX isoform_exons_sequence ON isoform_exons(id_sequences);
+CREATE INDEX isoform_exons_isoform ON isoform_exons(id_isoforms);
+CREATE INDEX isoform_exons_exon ON isoform_exons(id_exons);
+CREATE INDEX isoform_introns_sequence ON isoform_introns(id_sequences);
+CREATE INDEX isoform_introns_isoform ON isoform_introns(id_isoforms);
+CREATE INDEX isoform_introns_intron ON isoform_introns(id_introns);
+
 ALTER TABLE  introns AUTO_INCREMENT = 1;
+ALTER TABLE  isoform_exons AUTO_INCREMENT = 1;
+ALTER TABLE  isoform_introns AUTO_INCREMENT = 1;
 ALTER TABLE  exons AUTO_INCREMENT = 1;
 ALTER TABLE  isoforms AUTO_INCREMENT = 1;
 ALTER TABLE  genes AUTO_INCREMENT = 1;
 ALTER TABLE  sequences AUTO_INCREMENT = 1;
 ALTER TABLE  organisms AUTO_INCREMENT = 1;
+ALTER TABLE  codon_usage AUTO_INCREMENT = 1;
+ALTER TABLE  intron_type_counts AUTO_INCREMENT = 1;
+ALTER TABLE  intron_length_bins AUTO_INCREMENT = 1;
+ALTER TABLE  intron_class_counts AUTO_INCREMENT = 1;
+ALTER TABLE  intron_phase_counts AUTO_INCREMENT = 1;
 ALTER TABLE  chromosomes AUTO_INCREMENT = 1;
 ALTER TABLE  intron_types AUTO_INCREMENT = 1;
 ALTER TABLE  tax_groups2 AUTO_INCREMENT = 1;
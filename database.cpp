@@ -1,15 +1,26 @@
 #include "database.h"
 
+#include "aggregates.h"
+#include "batchinserter.h"
+#include "bulkloader.h"
+#include "geneticcode.h"
+#include "idallocator.h"
+
+#include <QAtomicInt>
 #include <QByteArray>
 #include <QCoreApplication>
 #include <QDebug>
 #include <QFile>
+#include <QRunnable>
+#include <QSet>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlField>
 #include <QSqlQuery>
 #include <QSqlRecord>
+#include <QStringList>
 #include <QThread>
+#include <QThreadPool>
 
 QMap<QString, OrganismPtr> Database::_organisms;
 QMutex Database::_organismsMutex;
@@ -22,21 +33,108 @@ QMap<QString, TaxKingdomPtr> Database::_kingdoms;
 QMap<QPair<QString,QString>, TaxGroup1Ptr> Database::_taxGroups1;
 QMap<QPair<QString,QString>, TaxGroup2Ptr> Database::_taxGroups2;
 
+QMap<Organism*, QString> Database::_organismKeys;
+
+QMutex Database::_statisticsMutex;
+QMap<Organism*, OrganismPtr> Database::_changedOrganisms;
+QMap<Chromosome*, ChromosomePtr> Database::_changedChromosomes;
+qint32 Database::_statisticsCheckpointSec = 0;
+QMap<QString, qint32> Database::_scheduledInputs;
+qint32 Database::_unknownInputs = 0;
+QElapsedTimer Database::_statisticsTimer;
+
 QMutex Database::_connectionsMutex;
 QMap<Qt::HANDLE,QSqlDatabase> Database::_connections;
+QMap< Qt::HANDLE, QSharedPointer<IdAllocator> > Database::_idAllocators;
+QMap< Qt::HANDLE, QHash< QString, QSharedPointer<QSqlQuery> > > Database::_statements;
+bool Database::_stagingTables = false;
+
+// Sequence-derived values are unknown when origin was not decoded
+static QVariant originDerived(const QVariant &value, SequenceWPtr sequence)
+{
+    if (sequence.toStrongRef()->coordinatesOnly) {
+        return QVariant(QVariant::String);
+    }
+    return value;
+}
+
+static const char * COMPOSITION_COLUMNS =
+        "gc_content,cpg_count,n_count,homopolymer_runs,longest_homopolymer";
+
+static QStringList columnsList(const QString & columns)
+{
+    return columns.split(',');
+}
+
+static QVariantList compositionValues(const Composition & composition,
+                                      quint32 length, SequenceWPtr sequence)
+{
+    return QVariantList()
+            << originDerived(composition.gcContent(length), sequence)
+            << originDerived(composition.cpgCount, sequence)
+            << originDerived(composition.nCount, sequence)
+            << originDerived(composition.homopolymerRuns, sequence)
+            << originDerived(composition.longestHomopolymer, sequence);
+}
+
+// Codons of sequence as added to codon usage by its isoforms, so they
+// are subtracted when sequence is replaced
+static QVariant codonCountsValue(SequencePtr sequence)
+{
+    QVector<quint64> sum;
+    Q_FOREACH(GenePtr gene, sequence->genes) {
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            if (isoform->codonCounts.isEmpty()) {
+                continue;
+            }
+            if (sum.isEmpty()) {
+                sum.fill(0u, GeneticCode::CodonsCount);
+            }
+            for (int i = 0; i < GeneticCode::CodonsCount; ++i) {
+                sum[i] += isoform->codonCounts[i];
+            }
+        }
+    }
+    if (sum.isEmpty()) {
+        return QVariant(QVariant::String);
+    }
+    QStringList values;
+    Q_FOREACH(const quint64 count, sum) {
+        values.append(QString::number(count));
+    }
+    return values.join(",");
+}
+
+static bool isAlive(const QSqlDatabase & db)
+{
+    QSqlQuery query("", db);
+    return query.exec("DO 1");
+}
 
 QSharedPointer<Database> Database::open(const QString &host,
                          const QString &userName, const QString &password,
                          const QString &dbName, const QString &sequencesStoreDir,
-                                        const QString &translationsStoreDir)
+                                        const QString &translationsStoreDir,
+                                        bool localInfile)
 {
     QSharedPointer<Database> result(new Database);
 
     QMutexLocker lock(&_connectionsMutex);
     const Qt::HANDLE threadId = QThread::currentThreadId();
 
+    // Connection of thread is kept open between files, so it is only
+    // checked to be still alive
+    bool connected = false;
     if (_connections.contains(threadId)) {
         result->_db = &_connections[threadId];
+        connected = result->_db->isOpen() && isAlive(*result->_db);
+        if (result->_db->isOpen() && !connected) {
+            qWarning() << "Connection of thread " << threadId
+                       << " is broken, reconnecting";
+            // Prepared statements are not valid after connection is closed
+            _statements.remove(threadId);
+            result->_db->close();
+        }
     }
     else {
         _connections[threadId] = QSqlDatabase::addDatabase(
@@ -51,7 +149,10 @@ QSharedPointer<Database> Database::open(const QString &host,
         _connections[threadId].setUserName(userName);
         _connections[threadId].setPassword(password);
         _connections[threadId].setDatabaseName(dbName);
-        _connections[threadId].setConnectOptions("CLIENT_COMPRESS=1");
+        _connections[threadId].setConnectOptions(
+                    localInfile
+                    ? "CLIENT_COMPRESS=1;MYSQL_OPT_LOCAL_INFILE=1"
+                    : "CLIENT_COMPRESS=1");
         result->_db = &_connections[threadId];
     }
     result->_sequencesStoreDir = QDir::root();
@@ -70,13 +171,40 @@ QSharedPointer<Database> Database::open(const QString &host,
         }
     }
 
+    if (connected) {
+        return result;
+    }
     if (!result->_db->open()) {
         result.clear();
     }
+    else if (_stagingTables) {
+        // Staging tables have no unique indexes to check, and ids are
+        // unique as given by allocator. Set once for session.
+        result->exec("SET SESSION unique_checks=0, foreign_key_checks=0");
+    }
 
     return result;
 }
 
+void Database::closeConnection()
+{
+    QMutexLocker lock(&_connectionsMutex);
+    const Qt::HANDLE threadId = QThread::currentThreadId();
+    _statements.remove(threadId);
+    _idAllocators.remove(threadId);
+    if (_connections.contains(threadId)) {
+        const QString connectionName = _connections[threadId].connectionName();
+        _connections[threadId].close();
+        _connections.remove(threadId);
+        QSqlDatabase::removeDatabase(connectionName);
+    }
+}
+
+void Database::setDeduplicateFeatures(bool deduplicate)
+{
+    _deduplicateFeatures = deduplicate;
+}
+
 OrganismPtr Database::findOrCreateOrganism(const QString &name)
 {
     OrganismPtr organism;
@@ -90,8 +218,7 @@ OrganismPtr Database::findOrCreateOrganism(const QString &name)
         return organism;
     }
 
-    QSqlQuery selectQuery("", *_db);
-    selectQuery.prepare("SELECT * FROM organisms WHERE name=:name");
+    QSqlQuery & selectQuery = prepared("SELECT * FROM organisms WHERE name=:name");
     selectQuery.bindValue(":name", name);
 
     if (!selectQuery.exec()) {
@@ -132,8 +259,7 @@ OrganismPtr Database::findOrCreateOrganism(const QString &name)
             // Insert into table new one
             organism = OrganismPtr(new Organism);
             organism->name = name;
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO organisms(name) VALUES(:name)");
+            QSqlQuery insertQuery = autocommitQuery("INSERT INTO organisms(name) VALUES(:name)");
             insertQuery.bindValue(":name", name);
             if (!insertQuery.exec()) {
                 qWarning() << insertQuery.lastError();
@@ -143,11 +269,13 @@ OrganismPtr Database::findOrCreateOrganism(const QString &name)
             else {
                 organism->id = insertQuery.lastInsertId().toInt();
             }
-            _db->commit();
         }
     }
 
     _organisms[name] = organism;
+    if (organism) {
+        _organismKeys[organism.data()] = name;
+    }
 
     return organism;
 }
@@ -168,8 +296,7 @@ ChromosomePtr Database::findOrCreateChromosome(const QString &name, OrganismPtr
         return chromosome;
     }
 
-    QSqlQuery selectQuery("", *_db);
-    selectQuery.prepare("SELECT * FROM chromosomes WHERE name=:name AND id_organisms=:org_id");
+    QSqlQuery & selectQuery = prepared("SELECT * FROM chromosomes WHERE name=:name AND id_organisms=:org_id");
     selectQuery.bindValue(":name", name);
     selectQuery.bindValue(":org_id", organism->id);
 
@@ -193,8 +320,7 @@ ChromosomePtr Database::findOrCreateChromosome(const QString &name, OrganismPtr
             chromosome = ChromosomePtr(new Chromosome);
             chromosome->name = name;
 
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO chromosomes(name, id_organisms) VALUES(:name,:org_id)");
+            QSqlQuery insertQuery = autocommitQuery("INSERT INTO chromosomes(name, id_organisms) VALUES(:name,:org_id)");
             insertQuery.bindValue(":name", name);
             insertQuery.bindValue(":org_id", organism->id);
             if (!insertQuery.exec()) {
@@ -205,7 +331,6 @@ ChromosomePtr Database::findOrCreateChromosome(const QString &name, OrganismPtr
             else {
                 chromosome->id = insertQuery.lastInsertId().toInt();
             }
-            _db->commit();
             if (!name.toLower().startsWith("unk") && !name.toLower().startsWith("mit")) {
                 organism->dbChromosomeCount ++;
             }
@@ -223,43 +348,30 @@ void Database::updateOrganism(OrganismPtr organism)
         return;
     }
 
-    // Name might be changed, so update search key
-    _organismsMutex.lock();
-    Q_FOREACH(const QString &key, _organisms.keys()) {
-        OrganismPtr oldCandidate = _organisms[key];
-        if (oldCandidate == organism && key != organism->name) {
-            _organisms[organism->name] = organism;
-            _organisms.remove(key);
-            break;
-        }
-    }
-    _organismsMutex.unlock();
-
-    QSqlQuery query("", *_db);
     // TODO tax groups id
-    query.prepare("UPDATE organisms SET "
-                        "name=:name, "
-                        "ref_seq_assembly_id=:ref_seq_assembly_id, "
-                        "annotation_release=:annotation_release, "
-                        "annotation_date=:annotation_date, "
-                        "taxonomy_xref=:taxonomy_xref, "
-                        "taxonomy_list=:taxonomy_list, "
-                        "real_chromosome_count=:real_chromosome_count, "
-                        "db_chromosome_count=:db_chromosome_count, "
-                        "real_mitochondria=:real_mitochondria, "
-                        "db_mitochondria=:db_mitochondria, "
-                        "unknown_sequences_count=:unknown_sequences_count, "
-                        "total_sequences_length=:total_sequences_length, "
-                        "b_genes_count=:b_genes_count, "
-                        "r_genes_count=:r_genes_count, "
-                        "cds_count=:cds_count, "
-                        "rna_count=:rna_count, "
-                        "unknown_prot_genes_count=:unknown_prot_genes_count, "
-                        "unknown_prot_cds_count=:unknown_prot_cds_count, "
-                        "exons_count=:exons_count, "
-                        "introns_count=:introns_count "
-                        "WHERE id=:id"
-                        );
+    QSqlQuery & query = prepared("UPDATE organisms SET "
+                                 "name=:name, "
+                                 "ref_seq_assembly_id=:ref_seq_assembly_id, "
+                                 "annotation_release=:annotation_release, "
+                                 "annotation_date=:annotation_date, "
+                                 "taxonomy_xref=:taxonomy_xref, "
+                                 "taxonomy_list=:taxonomy_list, "
+                                 "real_chromosome_count=:real_chromosome_count, "
+                                 "db_chromosome_count=:db_chromosome_count, "
+                                 "real_mitochondria=:real_mitochondria, "
+                                 "db_mitochondria=:db_mitochondria, "
+                                 "unknown_sequences_count=:unknown_sequences_count, "
+                                 "total_sequences_length=:total_sequences_length, "
+                                 "b_genes_count=:b_genes_count, "
+                                 "r_genes_count=:r_genes_count, "
+                                 "cds_count=:cds_count, "
+                                 "rna_count=:rna_count, "
+                                 "unknown_prot_genes_count=:unknown_prot_genes_count, "
+                                 "unknown_prot_cds_count=:unknown_prot_cds_count, "
+                                 "exons_count=:exons_count, "
+                                 "introns_count=:introns_count "
+                                 "WHERE id=:id"
+                                 );
     query.bindValue(":id", organism->id);
     query.bindValue(":name", organism->name);
     query.bindValue(":ref_seq_assembly_id", organism->refSeqAssemblyId);
@@ -289,14 +401,13 @@ void Database::updateOrganism(OrganismPtr organism)
     }
 
     if (organism->taxGroup2) {
-        query.clear();
-        query.prepare("UPDATE organisms SET id_tax_groups2=:tid WHERE id=:id");
-        query.bindValue(":tid", organism->taxGroup2.toStrongRef()->id);
-        query.bindValue(":id", organism->id);
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+        QSqlQuery & taxQuery = prepared("UPDATE organisms SET id_tax_groups2=:tid WHERE id=:id");
+        taxQuery.bindValue(":tid", organism->taxGroup2.toStrongRef()->id);
+        taxQuery.bindValue(":id", organism->id);
+        if (!taxQuery.exec()) {
+            qWarning() << taxQuery.lastError();
+            qWarning() << taxQuery.lastError().text();
+            qWarning() << taxQuery.lastQuery();
         }
     }
 }
@@ -310,8 +421,7 @@ void Database::updateChromosome(ChromosomePtr chromosome)
     if (0==chromosome->id) {
         return;
     }
-    QSqlQuery query("", *_db);
-    query.prepare("UPDATE chromosomes SET lengthh=:l WHERE id=:id");
+    QSqlQuery & query = prepared("UPDATE chromosomes SET lengthh=:l WHERE id=:id");
     query.bindValue(":l", chromosome->length);
     query.bindValue(":id", chromosome->id);
     if (!query.exec()) {
@@ -333,8 +443,7 @@ TaxKingdomPtr Database::findOrCreateTaxKingdom(const QString &name)
         return kingdom;
     }
 
-    QSqlQuery selectQuery("", *_db);
-    selectQuery.prepare("SELECT * FROM tax_kingdoms WHERE name=:name");
+    QSqlQuery & selectQuery = prepared("SELECT * FROM tax_kingdoms WHERE name=:name");
     selectQuery.bindValue(":name", name);
     if (!selectQuery.exec()) {
         qWarning() << selectQuery.lastError();
@@ -353,8 +462,7 @@ TaxKingdomPtr Database::findOrCreateTaxKingdom(const QString &name)
         else if (0 == selectQuery.size()) {
             kingdom = TaxKingdomPtr(new TaxKingdom);
             kingdom->name = name;
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO tax_kingdoms(name) VALUES(:name)");
+            QSqlQuery insertQuery = autocommitQuery("INSERT INTO tax_kingdoms(name) VALUES(:name)");
             insertQuery.bindValue(":name", name);
             if (!insertQuery.exec()) {
                 qWarning() << insertQuery.lastError();
@@ -387,8 +495,7 @@ TaxGroup1Ptr Database::findOrCreateTaxGroup1(const QString &name, const QString
         return group;
     }
 
-    QSqlQuery selectQuery("", *_db);
-    selectQuery.prepare("SELECT * FROM tax_groups1 WHERE name=:name AND typee=:typee");
+    QSqlQuery & selectQuery = prepared("SELECT * FROM tax_groups1 WHERE name=:name AND typee=:typee");
     selectQuery.bindValue(":name", name);
     selectQuery.bindValue(":typee", type);
     if (!selectQuery.exec()) {
@@ -412,8 +519,7 @@ TaxGroup1Ptr Database::findOrCreateTaxGroup1(const QString &name, const QString
             group->name = name;
             group->type = type;
             group->kingdomPtr = kingdom;
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO tax_groups1(name,typee,id_tax_kingdoms) VALUES(:name,:typee,:id_tax_kingdoms)");
+            QSqlQuery insertQuery = autocommitQuery("INSERT INTO tax_groups1(name,typee,id_tax_kingdoms) VALUES(:name,:typee,:id_tax_kingdoms)");
             insertQuery.bindValue(":name", name);
             insertQuery.bindValue(":typee", type);
             insertQuery.bindValue(":id_tax_kingdoms", kingdom->id);
@@ -448,8 +554,7 @@ TaxGroup2Ptr Database::findOrCreateTaxGroup2(const QString &name, const QString
         return group;
     }
 
-    QSqlQuery selectQuery("", *_db);
-    selectQuery.prepare("SELECT * FROM tax_groups1 WHERE name=:name AND typee=:typee");
+    QSqlQuery & selectQuery = prepared("SELECT * FROM tax_groups1 WHERE name=:name AND typee=:typee");
     selectQuery.bindValue(":name", name);
     selectQuery.bindValue(":typee", type);
     if (!selectQuery.exec()) {
@@ -475,8 +580,7 @@ TaxGroup2Ptr Database::findOrCreateTaxGroup2(const QString &name, const QString
             group->type = type;
             group->kingdomPtr = group1->kingdomPtr;
             group->taxGroup1Ptr = group1;
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO tax_groups2(name,typee,id_tax_groups1,id_tax_kingdoms) VALUES(:name,:typee,:id_tax_groups1,:id_tax_kingdoms)");
+            QSqlQuery insertQuery = autocommitQuery("INSERT INTO tax_groups2(name,typee,id_tax_groups1,id_tax_kingdoms) VALUES(:name,:typee,:id_tax_groups1,:id_tax_kingdoms)");
             insertQuery.bindValue(":name", name);
             insertQuery.bindValue(":typee", type);
             insertQuery.bindValue(":id_tax_groups1", group1->id);
@@ -500,17 +604,18 @@ TaxGroup2Ptr Database::findOrCreateTaxGroup2(const QString &name, const QString
     return group;
 }
 
-void Database::dropSequenceIfExists(SequencePtr sequence)
+void Database::dropSequenceIfExists(SequencePtr sequence, Aggregates *dropped)
 {
     OrganismPtr organism = sequence->organism.toStrongRef();
     organism->mutex.lock();
     qint32 organismId = organism->id;
     organism->mutex.unlock();
+    // Organism might be changed by its sequence header even if sequence
+    // itself is not written
+    markChanged(organism);
     const QString refSeqId = sequence->refSeqId;
 
-    QSqlQuery query("", *_db);
-
-    query.prepare("SELECT id FROM sequences WHERE id_organisms=:id_organisms AND refseq_id=:refseq_id");
+    QSqlQuery & query = prepared("SELECT id, id_chromosomes, codon_counts FROM " + tableName("sequences") + " WHERE id_organisms=:id_organisms AND refseq_id=:refseq_id");
     query.bindValue(":id_organisms", organismId);
     query.bindValue(":refseq_id", refSeqId);
 
@@ -521,53 +626,71 @@ void Database::dropSequenceIfExists(SequencePtr sequence)
         return;
     }
 
-    for (int i=0; i<query.size(); ++i) {
-        query.seek(i);
-        const qint32 seqId = query.record().field("id").value().toInt();
-
-        query.prepare("DELETE FROM introns WHERE id_sequences=:seq_id");
-        query.bindValue(":seq_id", seqId);
-
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+    QList<qint32> seqIds;
+    QMap<qint32, qint32> chromosomeIds;
+    while (query.next()) {
+        const qint32 seqId = query.value(0).toInt();
+        seqIds.append(seqId);
+        chromosomeIds[seqId] = query.value(1).toInt();
+        const QStringList codonCounts =
+                query.value(2).toString().split(',', QString::SkipEmptyParts);
+        if (GeneticCode::CodonsCount == codonCounts.size()) {
+            QVector<quint32> counts(GeneticCode::CodonsCount);
+            for (int i = 0; i < GeneticCode::CodonsCount; ++i) {
+                counts[i] = codonCounts[i].toUInt();
+            }
+            dropped->addCodons(organismId, counts);
         }
-
-        query.prepare("DELETE FROM exons WHERE id_sequences=:seq_id");
-        query.bindValue(":seq_id", seqId);
-
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+    }
+    query.finish();
+
+    // Summary tables counted introns of dropped rows, so they are
+    // counted again to be subtracted
+    Q_FOREACH(const qint32 seqId, seqIds) {
+        QSqlQuery & intronsQuery = prepared("SELECT id_intron_types, startt, endd, splice_class, phase FROM " + tableName("introns") + " WHERE id_sequences=:seq_id");
+        intronsQuery.bindValue(":seq_id", seqId);
+        if (!intronsQuery.exec()) {
+            qWarning() << intronsQuery.lastError();
+            qWarning() << intronsQuery.lastError().text();
+            qWarning() << intronsQuery.lastQuery();
+            continue;
         }
-
-        query.prepare("DELETE FROM isoforms WHERE id_sequences=:seq_id");
-        query.bindValue(":seq_id", seqId);
-
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+        Aggregates::IntronCounts counts;
+        while (intronsQuery.next()) {
+            counts.add(intronsQuery.value(0).toInt(),
+                       intronsQuery.value(2).toLongLong() -
+                       intronsQuery.value(1).toLongLong() + 1,
+                       intronsQuery.value(3).toString(),
+                       intronsQuery.value(4).isNull() ? -1 : intronsQuery.value(4).toInt());
         }
+        intronsQuery.finish();
+        dropped->addIntrons(organismId, chromosomeIds[seqId], counts);
+    }
 
-        query.prepare("DELETE FROM genes WHERE id_sequences=:seq_id");
-        query.bindValue(":seq_id", seqId);
+    static const char * const FEATURE_TABLES[] = {
+        "isoform_introns", "isoform_exons", "introns", "exons", "isoforms", "genes"
+    };
 
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+    Q_FOREACH(const qint32 seqId, seqIds) {
+        for (size_t i = 0; i < sizeof(FEATURE_TABLES) / sizeof(FEATURE_TABLES[0]); ++i) {
+            QSqlQuery & deleteQuery = prepared("DELETE FROM " + tableName(FEATURE_TABLES[i]) +
+                                               " WHERE id_sequences=:seq_id");
+            deleteQuery.bindValue(":seq_id", seqId);
+
+            if (!deleteQuery.exec()) {
+                qWarning() << deleteQuery.lastError();
+                qWarning() << deleteQuery.lastError().text();
+                qWarning() << deleteQuery.lastQuery();
+            }
         }
 
-        query.prepare("DELETE FROM sequences WHERE id=:seq_id");
-        query.bindValue(":seq_id", seqId);
+        QSqlQuery & deleteQuery = prepared("DELETE FROM " + tableName("sequences") + " WHERE id=:seq_id");
+        deleteQuery.bindValue(":seq_id", seqId);
 
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+        if (!deleteQuery.exec()) {
+            qWarning() << deleteQuery.lastError();
+            qWarning() << deleteQuery.lastError().text();
+            qWarning() << deleteQuery.lastQuery();
         }
     }
 }
@@ -578,29 +701,49 @@ void Database::addSequence(SequencePtr sequence)
     organism->mutex.lock();
     qint32 organismId = organism->id;
     organism->mutex.unlock();
+    // Organism might be changed by its sequence header even if sequence
+    // itself is not written
+    markChanged(organism);
 
-    dropSequenceIfExists(sequence);
-
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO sequences("
-                          "source_file_name"
-                          ", refseq_id"
-                          ", version"
-                          ", description"
-                          ", lengthh"
-                          ", id_organisms"
-                          ", id_chromosomes"
-                          ", origin_file_name"
-                          ") VALUES("
-                          ":file_name"
-                          ", :refseq_id"
-                          ", :version"
-                          ", :description"
-                          ", :lengthh"
-                          ", :id_organisms"
-                          ", :id_chromosomes"
-                          ", :origin_file_name"
-                          ")");
+    // Savepoint makes sequence atomic inside transaction shared by
+    // several sequences
+    if (!beginTransaction()) {
+        return;
+    }
+    if (!exec("SAVEPOINT sequence_write")) {
+        rollback();
+        return;
+    }
+    if (_bulkLoader) {
+        _bulkLoader->mark();
+    }
+
+    Aggregates dropped;
+    dropSequenceIfExists(sequence, &dropped);
+
+    QSqlQuery & query = prepared("INSERT INTO " + tableName("sequences") + "("
+                                 "source_file_name"
+                                 ", refseq_id"
+                                 ", version"
+                                 ", description"
+                                 ", lengthh"
+                                 ", id_organisms"
+                                 ", id_chromosomes"
+                                 ", origin_file_name"
+                                 ", coordinates_only"
+                                 ", codon_counts"
+                                 ") VALUES("
+                                 ":source_file_name"
+                                 ", :refseq_id"
+                                 ", :version"
+                                 ", :description"
+                                 ", :lengthh"
+                                 ", :id_organisms"
+                                 ", :id_chromosomes"
+                                 ", :origin_file_name"
+                                 ", :coordinates_only"
+                                 ", :codon_counts"
+                                 ")");
     query.bindValue(":source_file_name", sequence->sourceFileName);
     query.bindValue(":refseq_id", sequence->refSeqId);
     query.bindValue(":version", sequence->version);
@@ -616,28 +759,84 @@ void Database::addSequence(SequencePtr sequence)
     }
     query.bindValue(":id_chromosomes", chromosomeId);
     query.bindValue(":origin_file_name", sequence->originFileName);
+    query.bindValue(":coordinates_only", sequence->coordinatesOnly);
+    query.bindValue(":codon_counts", codonCountsValue(sequence));
 
     if (!query.exec()) {
         qWarning() << query.lastError();
         qWarning() << query.lastError().text();
         qWarning() << query.lastQuery();
+        rollbackSequence();
         return;
     }
     else {
         sequence->id = query.lastInsertId().toInt();
     }
 
+    BatchInserter orphanedCdses(_db, tableName("orphaned_cdses"),
+                                columnsList("source_file_name,source_line_start"
+                                            ",source_line_end,refseq_id"
+                                            ",protein_xref,product"));
+    Q_FOREACH(const OrphanedCds & cds, sequence->orphanedCdses) {
+        orphanedCdses.addRow(QVariantList()
+                             << sequence->sourceFileName
+                             << cds.lineStart
+                             << cds.lineEnd
+                             << sequence->refSeqId
+                             << cds.dbXref
+                             << cds.product);
+    }
+    if (!orphanedCdses.flush() || !addFeatures(sequence)) {
+        rollbackSequence();
+        sequence->id = 0;
+        return;
+    }
+    if (!exec("RELEASE SAVEPOINT sequence_write")) {
+        sequence->id = 0;
+        rollback();
+        return;
+    }
+    _uncommitted.append(sequence);
+    _droppedCounts.merge(dropped);
+
+    _pendingRows += 1 + sequence->orphanedCdses.size();
     Q_FOREACH(GenePtr gene, sequence->genes) {
-        addGene(gene);
+        _pendingRows += 1 + gene->isoforms.size();
+        Q_FOREACH(IsoformPtr iso, gene->isoforms) {
+            _pendingRows += iso->exons.size() + iso->introns.size();
+        }
+    }
+    if (_pendingRows >= _commitRows ||
+            _transactionTimer.elapsed() >= _commitLatencyMs ||
+            (_bulkLoader && _bulkLoader->isFull())) {
+        commit();
+    }
+}
+
+void Database::rollbackSequence()
+{
+    // Savepoint is lost when server has already rolled back the whole
+    // transaction, e.g. on deadlock, so its other sequences are gone too
+    // and next sequence starts a new transaction
+    if (!exec("ROLLBACK TO SAVEPOINT sequence_write")) {
+        rollback();
+        return;
+    }
+    if (_bulkLoader) {
+        _bulkLoader->rollbackToMark();
     }
+}
 
+void Database::addStatistics(SequencePtr sequence)
+{
+    OrganismPtr organism = sequence->organism.toStrongRef();
     if (sequence->chromosome) {
         ChromosomePtr chromosome = sequence->chromosome;
         chromosome->mutex.lock();
         chromosome->length += sequence->length;
         const QString chromosomeName = chromosome->name;
         chromosome->mutex.unlock();
-        updateChromosome(chromosome);
+        markChanged(chromosome);
         if (chromosomeName.toLower().startsWith("unk")) {
             organism->mutex.lock();
             organism->unknownSequencesCount ++;
@@ -645,8 +844,27 @@ void Database::addSequence(SequencePtr sequence)
         }
     }
 
+    // Exons and introns shared by isoforms have the same id, and are
+    // counted once like their rows
+    QSet<qint32> exonIds;
+    QSet<qint32> intronIds;
+    Q_FOREACH(GenePtr gene, sequence->genes) {
+        Q_FOREACH(IsoformPtr iso, gene->isoforms) {
+            Q_FOREACH(ExonPtr exon, iso->exons) {
+                exonIds.insert(exon->id);
+            }
+            Q_FOREACH(IntronPtr intron, iso->introns) {
+                intronIds.insert(intron->id);
+            }
+        }
+    }
+
     organism->mutex.lock();
     organism->totalSequencesLength += sequence->length;
+    organism->cdsCount += sequence->cdsCount;
+    organism->rnaCount += sequence->rnaCount;
+    organism->unknownProtGenesCount += sequence->unknownProtGenesCount;
+    organism->unknownProtCdsCount += sequence->unknownProtCdsCount;
     Q_FOREACH(GenePtr gene, sequence->genes) {
         if (gene->hasCDS) {
             organism->bGenesCount ++;
@@ -654,53 +872,279 @@ void Database::addSequence(SequencePtr sequence)
         if (gene->hasRNA && !gene->hasCDS) {
             organism->rGenesCount ++;
         }
-        Q_FOREACH(IsoformPtr iso, gene->isoforms) {
-            organism->exonsCount += iso->exons.size();
-            organism->intronsCount += iso->introns.size();
-        }
     }
+    organism->exonsCount += exonIds.size();
+    organism->intronsCount += intronIds.size();
+    organism->mutex.unlock();
+}
+
+void Database::markChanged(OrganismPtr organism)
+{
+    organism->mutex.lock();
+    const QString name = organism->name;
     organism->mutex.unlock();
+
+    // Name might be changed, so update search key. Usually it is not.
+    _organismsMutex.lock();
+    const QString oldKey = _organismKeys.value(organism.data(), name);
+    if (oldKey != name) {
+        if (_organisms.value(oldKey) == organism) {
+            _organisms.remove(oldKey);
+        }
+        _organisms[name] = organism;
+        _organismKeys[organism.data()] = name;
+    }
+    _organismsMutex.unlock();
+
+    QMutexLocker lock(&_statisticsMutex);
+    if (oldKey != name && _scheduledInputs.contains(oldKey)) {
+        // Inputs left are counted by key of organism
+        _scheduledInputs[name] += _scheduledInputs.take(oldKey);
+    }
+    _changedOrganisms[organism.data()] = organism;
+}
+
+void Database::markChanged(ChromosomePtr chromosome)
+{
+    QMutexLocker lock(&_statisticsMutex);
+    _changedChromosomes[chromosome.data()] = chromosome;
+}
+
+void Database::setStatisticsCheckpoint(qint32 seconds)
+{
+    QMutexLocker lock(&_statisticsMutex);
+    _statisticsCheckpointSec = seconds;
+    _statisticsTimer.start();
+}
+
+void Database::flushStatisticsIfDue()
+{
+    _statisticsMutex.lock();
+    const bool due = _statisticsCheckpointSec > 0 &&
+            _statisticsTimer.elapsed() >= qint64(_statisticsCheckpointSec) * 1000;
+    if (due) {
+        _statisticsTimer.restart();
+    }
+    _statisticsMutex.unlock();
+    if (due) {
+        flushStatistics();
+    }
 }
 
-void Database::addOrphanedCDS(const QString &fileName,
-                              const quint32 lineStart,
-                              const quint32 lineEnd,
-                              const QString &refSeqId,
-                              const QString &dbXref,
-                              const QString &product)
+void Database::flushStatistics()
+{
+    // Counters of sequences waiting for commit are added by it
+    commit();
+
+    _statisticsMutex.lock();
+    const QList<OrganismPtr> organisms = _changedOrganisms.values();
+    const QList<ChromosomePtr> chromosomes = _changedChromosomes.values();
+    _changedOrganisms.clear();
+    _changedChromosomes.clear();
+    _statisticsMutex.unlock();
+
+    writeStatistics(organisms, chromosomes);
+}
+
+void Database::scheduleInputs(const QList<QStringList> &inputs)
+{
+    QMutexLocker lock(&_statisticsMutex);
+    Q_FOREACH(const QStringList & organismNames, inputs) {
+        if (organismNames.isEmpty()) {
+            _unknownInputs ++;
+        }
+        Q_FOREACH(const QString & name, organismNames) {
+            _scheduledInputs[name] ++;
+        }
+    }
+}
+
+void Database::inputDone(const QStringList &organismNames)
+{
+    commit();
+
+    _organismsMutex.lock();
+    const QMap<Organism*, QString> keys = _organismKeys;
+    _organismsMutex.unlock();
+
+    _statisticsMutex.lock();
+    if (organismNames.isEmpty()) {
+        _unknownInputs --;
+    }
+    Q_FOREACH(const QString & name, organismNames) {
+        _scheduledInputs[name] --;
+    }
+    // Input of unknown organisms might have sequences of any one
+    QList<OrganismPtr> organisms;
+    QSet<Organism*> done;
+    if (_unknownInputs <= 0) {
+        Q_FOREACH(OrganismPtr organism, _changedOrganisms) {
+            if (_scheduledInputs.value(keys.value(organism.data())) <= 0) {
+                organisms.append(organism);
+                done.insert(organism.data());
+                _changedOrganisms.remove(organism.data());
+            }
+        }
+    }
+    QList<ChromosomePtr> chromosomes;
+    Q_FOREACH(ChromosomePtr chromosome, _changedChromosomes) {
+        if (done.contains(chromosome->organism.toStrongRef().data())) {
+            chromosomes.append(chromosome);
+            _changedChromosomes.remove(chromosome.data());
+        }
+    }
+    _statisticsMutex.unlock();
+
+    writeStatistics(organisms, chromosomes);
+}
+
+void Database::writeStatistics(const QList<OrganismPtr> &organisms,
+                               const QList<ChromosomePtr> &chromosomes)
+{
+    if (organisms.isEmpty() && chromosomes.isEmpty()) {
+        return;
+    }
+    Q_FOREACH(ChromosomePtr chromosome, chromosomes) {
+        updateChromosome(chromosome);
+    }
+    Q_FOREACH(OrganismPtr organism, organisms) {
+        updateOrganism(organism);
+    }
+    commit();
+}
+
+void Database::setBulkLoad(const QString &spoolDir)
+{
+    _bulkLoader = QSharedPointer<BulkLoader>(new BulkLoader(_db, spoolDir));
+}
+
+void Database::setGroupCommit(quint32 maxRows, qint32 maxLatencyMs)
+{
+    _commitRows = qMax(1u, maxRows);
+    _commitLatencyMs = qMax(0, maxLatencyMs);
+}
+
+bool Database::beginTransaction()
+{
+    if (_inTransaction) {
+        return true;
+    }
+    if (!_db->transaction()) {
+        qWarning() << _db->lastError();
+        qWarning() << _db->lastError().text();
+        return false;
+    }
+    _inTransaction = true;
+    _pendingRows = 0;
+    _transactionTimer.start();
+    return true;
+}
+
+bool Database::commit()
+{
+    if (!_inTransaction) {
+        return true;
+    }
+    _inTransaction = false;
+    _pendingRows = 0;
+    if (!loadSpools()) {
+        _db->rollback();
+        dropUncommitted();
+        return false;
+    }
+    if (!_db->commit()) {
+        qWarning() << _db->lastError();
+        qWarning() << _db->lastError().text();
+        _db->rollback();
+        dropUncommitted();
+        return false;
+    }
+
+    if (_bulkLoader) {
+        _bulkLoader->clear();
+    }
+
+    // Sequences are counted and indexed only when their rows are stored
+    const QList<SequencePtr> committed = _uncommitted;
+    _uncommitted.clear();
+    Aggregates::local().merge(_droppedCounts, -1);
+    _droppedCounts = Aggregates();
+    Q_FOREACH(SequencePtr sequence, committed) {
+        addStatistics(sequence);
+        if (_commitHandler) {
+            _commitHandler(sequence);
+        }
+    }
+    return true;
+}
+
+void Database::rollback()
+{
+    if (_inTransaction) {
+        _inTransaction = false;
+        _pendingRows = 0;
+        _db->rollback();
+        dropUncommitted();
+    }
+}
+
+bool Database::loadSpools()
+{
+    if (!_bulkLoader) {
+        return true;
+    }
+    // Spooled rows belong to sequences of transaction, so they are loaded
+    // by it. Failed load is repeated once if transaction survived it, as
+    // savepoint tells, so lock wait timeout does not lose the whole group.
+    if (!exec("SAVEPOINT spool_load")) {
+        return false;
+    }
+    if (_bulkLoader->load()) {
+        return true;
+    }
+    return exec("ROLLBACK TO SAVEPOINT spool_load") && _bulkLoader->load();
+}
+
+void Database::dropUncommitted()
+{
+    if (!_uncommitted.isEmpty()) {
+        qWarning() << "Transaction is rolled back, " << _uncommitted.size()
+                   << " sequences are not stored!";
+    }
+    Q_FOREACH(SequencePtr sequence, _uncommitted) {
+        sequence->id = 0;
+    }
+    _uncommitted.clear();
+    _droppedCounts = Aggregates();
+    if (_bulkLoader) {
+        _bulkLoader->clear();
+    }
+}
+
+void Database::setCommitHandler(const CommitHandler &handler)
+{
+    _commitHandler = handler;
+}
+
+bool Database::exec(const QString &statement)
 {
     QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO orphaned_cdses("
-                  "source_file_name"
-                  ", source_line_start"
-                  ", source_line_end"
-                  ", refseq_id"
-                  ", protein_xref"
-                  ", product"
-                  ") VALUES("
-                  ":source_file_name"
-                  ", :source_line_start"
-                  ", :source_line_end"
-                  ", :refseq_id"
-                  ", :protein_xref"
-                  ", :product"
-                   ")");
-    query.bindValue(":source_file_name", fileName);
-    query.bindValue(":source_line_start", lineStart);
-    query.bindValue(":source_line_end", lineEnd);
-    query.bindValue(":refseq_id", refSeqId);
-    query.bindValue(":protein_xref", dbXref);
-    query.bindValue(":product", product);
-    if (!query.exec()) {
+    if (!query.exec(statement)) {
         qWarning() << query.lastError();
         qWarning() << query.lastError().text();
         qWarning() << query.lastQuery();
+        return false;
     }
+    return true;
 }
 
 void Database::storeOrigin(SequencePtr sequence)
 {
-    if (QDir::root() == _sequencesStoreDir) {
+    if (QDir::root() == _sequencesStoreDir || sequence->coordinatesOnly) {
+        return;
+    }
+    if (sequence->origin.isEmpty()) {
+        // Sequence read by windows from indexed FASTA
         return;
     }
     OrganismPtr organism = sequence->organism.toStrongRef();
@@ -841,71 +1285,28 @@ QString Database::format60(const QString &s)
 }
 
 
-void Database::addGene(GenePtr gene)
-{
-    const qint32 sequenceId = gene->sequence.toStrongRef()->id;
-    OrganismPtr organism = gene->sequence.toStrongRef()->organism.toStrongRef();
-    organism->mutex.lock();
-    const qint32 organismId = organism->id;
-    organism->mutex.unlock();
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO genes("
-                  "id_sequences"
-                  ", id_organisms"
-                  ", name"
-                  ", backward_chain"
-                  ", protein_but_not_rna"
-                  ", pseudo_gene"
-                  ", startt"
-                  ", endd"
-                  ", start_code"
-                  ", end_code"
-                  ", max_introns_count"
-                  ") VALUES("
-                  ":id_sequences"
-                  ", :id_organisms"
-                  ", :name"
-                  ", :backward_chain"
-                  ", :protein_but_not_rna"
-                  ", :pseudo_gene"
-                  ", :startt"
-                  ", :endd"
-                  ", :start_code"
-                  ", :end_code"
-                  ", :max_introns_count"
-                  ")");
-    query.bindValue(":id_sequences", sequenceId);
-    query.bindValue(":id_organisms", organismId);
-    query.bindValue(":name", gene->name);
-    query.bindValue(":backward_chain", gene->backwardChain);
-    query.bindValue(":protein_but_not_rna", gene->isProteinButNotRna);
-    query.bindValue(":pseudo_gene", gene->isPseudoGene);
-    query.bindValue(":startt", UINT32_MAX == gene->start ? 0 : gene->start);
-    query.bindValue(":endd", gene->end);
-    query.bindValue(":start_code", UINT32_MAX == gene->startCode ? 0 : gene->startCode);
-    query.bindValue(":end_code", gene->endCode);
-    query.bindValue(":max_introns_count", gene->maxIntronsCount);
-
-
-    if (!query.exec()) {
-        qWarning() << query.lastError();
-        qWarning() << query.lastError().text();
-        qWarning() << query.lastQuery();
-        return;
-    }
-    else {
-        gene->id = query.lastInsertId().toInt();
-    }
-
-    Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
-        addIsoform(isoform);
-    }
+static const char * GENE_COLUMNS =
+        "id_sequences,id_organisms,name,backward_chain,protein_but_not_rna"
+        ",pseudo_gene,startt,endd,start_code,end_code,max_introns_count";
 
+static QVariantList geneRow(GenePtr gene, qint32 organismId)
+{
+    return QVariantList()
+            << gene->sequence.toStrongRef()->id
+            << organismId
+            << gene->name
+            << gene->backwardChain
+            << gene->isProteinButNotRna
+            << gene->isPseudoGene
+            << (UINT32_MAX == gene->start ? 0 : gene->start)
+            << gene->end
+            << (UINT32_MAX == gene->startCode ? 0 : gene->startCode)
+            << gene->endCode
+            << gene->maxIntronsCount;
 }
 
-void Database::addIsoform(IsoformPtr isoform)
+static void updateExonsLength(IsoformPtr isoform)
 {
-    const qint32 geneId = isoform->gene.toStrongRef()->id;
     isoform->exonsLength = 0;
     Q_FOREACH(ExonPtr exon, isoform->exons) {
         // coordinates include both borders in GBK
@@ -919,293 +1320,674 @@ void Database::addIsoform(IsoformPtr isoform)
     }
     isoform->errorInLength = 0 != (isoform->exonsLength % 3);
     isoform->errorMain = isoform->errorMain || isoform->errorInLength;
+}
 
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO isoforms("
-                  "id_genes"
-                  ", id_sequences"
-                  ", protein_xref"
-                  ", protein_id"
-                  ", product"
-                  ", note"
-                  ", cds_start"
-                  ", cds_end"
-                  ", mrna_start"
-                  ", mrna_end"
-                  ", mrna_length"
-                  ", exons_cds_count"
-                  ", exons_mrna_count"
-                  ", exons_length"
-                  ", start_codon"
-                  ", end_codon"
-                  ", maximum_by_introns"
-                  ", error_in_length"
-                  ", error_in_start_codon"
-                  ", error_in_end_codon"
-                  ", error_in_intron"
-                  ", error_in_coding_exon"
-                  ", error_main"
-                  ") VALUES("
-                  ":id_genes"
-                  ", :id_sequences"
-                  ", :protein_xref"
-                  ", :protein_id"
-                  ", :product"
-                  ", :note"
-                  ", :cds_start"
-                  ", :cds_end"
-                  ", :mrna_start"
-                  ", :mrna_end"
-                  ", :mrna_length"
-                  ", :exons_cds_count"
-                  ", :exons_mrna_count"
-                  ", :exons_length"
-                  ", :start_codon"
-                  ", :end_codon"
-                  ", :maximum_by_introns"
-                  ", :error_in_length"
-                  ", :error_in_start_codon"
-                  ", :error_in_end_codon"
-                  ", :error_in_intron"
-                  ", :error_in_coding_exon"
-                  ", :error_main"
-                  ")");
-    query.bindValue(":id_genes", geneId);
-    query.bindValue(":id_sequences", isoform->sequence.toStrongRef()->id);
-    query.bindValue(":protein_xref", isoform->proteinXref);
-    query.bindValue(":protein_id", isoform->proteinId);
-    query.bindValue(":product", isoform->product);
-    query.bindValue(":note", isoform->errorMain ? isoform->note : "");
-    query.bindValue(":cds_start", UINT32_MAX == isoform->cdsStart ? 0 : isoform->cdsStart);
-    query.bindValue(":cds_end", isoform->cdsEnd);
-    query.bindValue(":mrna_start", UINT32_MAX == isoform->mrnaStart ? 0 : isoform->mrnaStart);
-    query.bindValue(":mrna_end", isoform->mrnaEnd);
-    query.bindValue(":mrna_length",
-                    isoform->mrnaEnd == 0 || UINT32_MAX == isoform->mrnaStart
-                    ? 0 : qint32(isoform->mrnaEnd) - qint32(isoform->mrnaStart) + 1);
-    query.bindValue(":exons_cds_count", isoform->exonsCdsCount);
-    query.bindValue(":exons_mrna_count", isoform->exonsMrnaCount);
-    query.bindValue(":exons_length", isoform->exonsLength);
-    query.bindValue(":start_codon", isoform->startCodon);
-    query.bindValue(":end_codon", isoform->endCodon);
-    query.bindValue(":maximum_by_introns", isoform->isMaximumByIntrons);
-
-    query.bindValue(":error_in_length", isoform->errorInLength);
-    query.bindValue(":error_in_start_codon", isoform->errorInStartCodon);
-    query.bindValue(":error_in_end_codon", isoform->errorInEndCodon);
-    query.bindValue(":error_in_intron", isoform->errorInIntron);
-    query.bindValue(":error_in_coding_exon", isoform->errorInCodingExon);
-    query.bindValue(":error_main", isoform->errorMain);
+static const char * ISOFORM_COLUMNS =
+        "id_genes,id_sequences,protein_xref,protein_id,product,note"
+        ",cds_start,cds_end,mrna_start,mrna_end,mrna_length"
+        ",exons_cds_count,exons_mrna_count,exons_length,start_codon,end_codon"
+        ",maximum_by_introns,error_in_length,error_in_start_codon"
+        ",error_in_end_codon,error_in_intron,error_in_coding_exon"
+        ",error_main,error_comment";
+
+static QVariantList isoformRow(IsoformPtr isoform)
+{
+    return QVariantList()
+            << isoform->gene.toStrongRef()->id
+            << isoform->sequence.toStrongRef()->id
+            << isoform->proteinXref
+            << isoform->proteinId
+            << isoform->product
+            << (isoform->errorMain ? isoform->note : QString(""))
+            << (UINT32_MAX == isoform->cdsStart ? 0 : isoform->cdsStart)
+            << isoform->cdsEnd
+            << (UINT32_MAX == isoform->mrnaStart ? 0 : isoform->mrnaStart)
+            << isoform->mrnaEnd
+            << (isoform->mrnaEnd == 0 || UINT32_MAX == isoform->mrnaStart
+                ? 0 : qint32(isoform->mrnaEnd) - qint32(isoform->mrnaStart) + 1)
+            << isoform->exonsCdsCount
+            << isoform->exonsMrnaCount
+            << isoform->exonsLength
+            << originDerived(isoform->startCodon, isoform->sequence)
+            << originDerived(isoform->endCodon, isoform->sequence)
+            << isoform->isMaximumByIntrons
+            << isoform->errorInLength
+            << originDerived(isoform->errorInStartCodon, isoform->sequence)
+            << originDerived(isoform->errorInEndCodon, isoform->sequence)
+            << originDerived(isoform->errorInIntron, isoform->sequence)
+            << originDerived(isoform->errorInCodingExon, isoform->sequence)
+            << isoform->errorMain
+            << (isoform->errorComment.isEmpty()
+                ? QVariant(QVariant::String) : QVariant(isoform->errorComment));
+}
+
+static const char * EXON_COLUMNS =
+        "id_isoforms,id_genes,id_sequences,startt,endd,lengthh,typee"
+        ",start_phase,end_phase,length_phase,indexx,rev_index"
+        ",start_codon,end_codon,error_in_pseudo_flag,error_n_in_sequence";
+
+static QVariantList exonRow(ExonPtr exon)
+{
+    const IsoformPtr isoform = exon->isoform.toStrongRef();
+    return QVariantList()
+            << isoform->id
+            << isoform->gene.toStrongRef()->id
+            << exon->sequence.toStrongRef()->id
+            << exon->start
+            << exon->end
+            << exon->end - exon->start + 1
+            << qint16(exon->type)
+            << exon->startPhase
+            << exon->endPhase
+            << exon->lengthPhase
+            << exon->index
+            << exon->revIndex
+            << originDerived(exon->startCodon, exon->sequence)
+            << originDerived(exon->endCodon, exon->sequence)
+            << exon->errorInPseudoFlag
+            << originDerived(exon->errorNInSequence, exon->sequence)
+            << compositionValues(exon->composition,
+                                 exon->end - exon->start + 1, exon->sequence);
+}
+
+static const char * INTRON_COLUMNS =
+        "id_isoforms,id_genes,id_sequences,prev_exon,next_exon,startt,endd"
+        ",id_intron_types,start_dinucleotide,end_dinucleotide,lengthh"
+        ",indexx,rev_index,length_phase,phase,error_start_dinucleotide"
+        ",error_end_dinucleotide,error_main,warning_n_in_sequence"
+        ",donor_score,acceptor_score,u12_donor_score,spliceosome,splice_class";
+
+static QVariantList intronRow(IntronPtr intron)
+{
+    const IsoformPtr isoform = intron->isoform.toStrongRef();
+    return QVariantList()
+            << isoform->id
+            << isoform->gene.toStrongRef()->id
+            << intron->sequence.toStrongRef()->id
+            << intron->prevExon.toStrongRef()->id
+            << intron->nextExon.toStrongRef()->id
+            << intron->start
+            << intron->end
+            << intron->intronTypeId
+            << originDerived(intron->startDinucleotide, intron->sequence)
+            << originDerived(intron->endDinucleotide, intron->sequence)
+            << qint32(intron->end) - qint32(intron->start) + 1
+            << intron->index
+            << (UINT32_MAX == intron->revIndex ? 0 : intron->revIndex)
+            << intron->lengthPhase
+            << intron->phase
+            << originDerived(intron->errorInStartDinucleotide, intron->sequence)
+            << originDerived(intron->errorInEndDinucleotide, intron->sequence)
+            << intron->errorMain
+            << originDerived(intron->warningNInSequence, intron->sequence)
+            << originDerived(intron->donorScore, intron->sequence)
+            << originDerived(intron->acceptorScore, intron->sequence)
+            << originDerived(intron->u12DonorScore, intron->sequence)
+            << originDerived(intron->spliceosome, intron->sequence)
+            << originDerived(intron->spliceClass, intron->sequence)
+            << compositionValues(intron->composition,
+                                 intron->end - intron->start + 1, intron->sequence);
+}
+
+static const char * ISOFORM_EXON_COLUMNS =
+        "id_isoforms,id_exons,id_sequences,typee,start_phase,end_phase"
+        ",indexx,rev_index,prev_intron,next_intron";
+
+static QVariantList isoformExonRow(ExonPtr exon)
+{
+    return QVariantList()
+            << exon->isoform.toStrongRef()->id
+            << exon->id
+            << exon->sequence.toStrongRef()->id
+            << qint16(exon->type)
+            << exon->startPhase
+            << exon->endPhase
+            << exon->index
+            << exon->revIndex
+            << (exon->prevIntron ? exon->prevIntron.toStrongRef()->id : 0)
+            << (exon->nextIntron ? exon->nextIntron.toStrongRef()->id : 0);
+}
+
+static const char * ISOFORM_INTRON_COLUMNS =
+        "id_isoforms,id_introns,id_sequences,id_intron_types,phase"
+        ",indexx,rev_index,prev_exon,next_exon";
+
+static QVariantList isoformIntronRow(IntronPtr intron)
+{
+    return QVariantList()
+            << intron->isoform.toStrongRef()->id
+            << intron->id
+            << intron->sequence.toStrongRef()->id
+            << intron->intronTypeId
+            << intron->phase
+            << intron->index
+            << (UINT32_MAX == intron->revIndex ? 0 : intron->revIndex)
+            << intron->prevExon.toStrongRef()->id
+            << intron->nextExon.toStrongRef()->id;
+}
+
+bool Database::addFeatures(SequencePtr sequence)
+{
+    OrganismPtr organism = sequence->organism.toStrongRef();
+    organism->mutex.lock();
+    const qint32 organismId = organism->id;
+    organism->mutex.unlock();
+
+    // Ids are reserved before rows are built, so rows of all tables are
+    // written in one pass with references and neighbours already set
+    if (!assignIds(sequence)) {
+        return false;
+    }
+
+    if (_bulkLoader) {
+        BulkLoader * loader = _bulkLoader.data();
+        return writeFeatures(sequence, organismId,
+                             [loader](const QString & tableName,
+                                      const QStringList & columns,
+                                      const QVariantList & values) {
+            return loader->addRow(tableName, columns, values);
+        });
+    }
+
+    QSqlDatabase * db = _db;
+    QMap< QString, QSharedPointer<BatchInserter> > batches;
+    bool ok = writeFeatures(sequence, organismId,
+                            [db, &batches](const QString & tableName,
+                                           const QStringList & columns,
+                                           const QVariantList & values) {
+        QSharedPointer<BatchInserter> & batch = batches[tableName];
+        if (!batch) {
+            batch = QSharedPointer<BatchInserter>(
+                        new BatchInserter(db, tableName, columns));
+        }
+        return batch->addRow(values);
+    });
+    Q_FOREACH(QSharedPointer<BatchInserter> batch, batches) {
+        ok = batch->flush() && ok;
+    }
+    return ok;
+}
+
+IdAllocator * Database::idAllocator()
+{
+    // Allocator lives as long as connection of thread, so its blocks are
+    // used by all files of thread
+    QMutexLocker lock(&_connectionsMutex);
+    QSharedPointer<IdAllocator> & allocator =
+            _idAllocators[QThread::currentThreadId()];
+    if (!allocator) {
+        allocator = QSharedPointer<IdAllocator>(new IdAllocator(*_db));
+    }
+    return allocator.data();
+}
+
+bool Database::assignIds(SequencePtr sequence)
+{
+    IdAllocator * allocator = idAllocator();
+    typedef QPair<quint32,quint32> Key;
+    bool ok = true;
+    Q_FOREACH(GenePtr gene, sequence->genes) {
+        gene->id = allocator->next("genes");
+        ok = ok && gene->id > 0;
+        QMap<Key, qint32> geneExonIds;
+        QMap<Key, qint32> geneIntronIds;
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            isoform->id = allocator->next("isoforms");
+            ok = ok && isoform->id > 0;
+            Q_FOREACH(ExonPtr exon, isoform->exons) {
+                const Key key(exon->start, exon->end);
+                if (_deduplicateFeatures && geneExonIds.contains(key)) {
+                    exon->id = geneExonIds[key];
+                    continue;
+                }
+                exon->id = geneExonIds[key] = allocator->next("exons");
+                ok = ok && exon->id > 0;
+            }
+            Q_FOREACH(IntronPtr intron, isoform->introns) {
+                const Key key(intron->start, intron->end);
+                if (_deduplicateFeatures && geneIntronIds.contains(key)) {
+                    intron->id = geneIntronIds[key];
+                    continue;
+                }
+                intron->id = geneIntronIds[key] = allocator->next("introns");
+                ok = ok && intron->id > 0;
+            }
+        }
+    }
+    return ok;
+}
+
+bool Database::writeFeatures(SequencePtr sequence, qint32 organismId,
+                             const RowWriter & addRow)
+{
+    static const QStringList geneColumns =
+            QStringList("id") + columnsList(GENE_COLUMNS);
+    static const QStringList isoformColumns =
+            QStringList("id") + columnsList(ISOFORM_COLUMNS);
+    static const QStringList exonColumns =
+            QStringList("id") + columnsList(EXON_COLUMNS) +
+            columnsList(COMPOSITION_COLUMNS) +
+            columnsList("prev_intron,next_intron");
+    static const QStringList intronColumns =
+            QStringList("id") + columnsList(INTRON_COLUMNS) +
+            columnsList(COMPOSITION_COLUMNS);
+    static const QStringList isoformExonColumns =
+            columnsList(ISOFORM_EXON_COLUMNS);
+    static const QStringList isoformIntronColumns =
+            columnsList(ISOFORM_INTRON_COLUMNS);
+
+    // Shared exons and introns have ids of their first copies, and are
+    // written once with neighbours of the first isoform
+    QSet<qint32> exonIds;
+    QSet<qint32> intronIds;
+    bool ok = true;
+    Q_FOREACH(GenePtr gene, sequence->genes) {
+        ok = addRow(tableName("genes"), geneColumns, QVariantList()
+                    << gene->id
+                    << geneRow(gene, organismId)) && ok;
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            updateExonsLength(isoform);
+            ok = addRow(tableName("isoforms"), isoformColumns, QVariantList()
+                        << isoform->id
+                        << isoformRow(isoform)) && ok;
+            Q_FOREACH(ExonPtr exon, isoform->exons) {
+                if (_deduplicateFeatures) {
+                    ok = addRow(tableName("isoform_exons"), isoformExonColumns,
+                                isoformExonRow(exon)) && ok;
+                }
+                if (exonIds.contains(exon->id)) {
+                    continue;
+                }
+                exonIds.insert(exon->id);
+                ok = addRow(tableName("exons"), exonColumns, QVariantList()
+                            << exon->id
+                            << exonRow(exon)
+                            << (exon->prevIntron ? exon->prevIntron.toStrongRef()->id : 0)
+                            << (exon->nextIntron ? exon->nextIntron.toStrongRef()->id : 0)) && ok;
+            }
+            Q_FOREACH(IntronPtr intron, isoform->introns) {
+                if (_deduplicateFeatures) {
+                    ok = addRow(tableName("isoform_introns"), isoformIntronColumns,
+                                isoformIntronRow(intron)) && ok;
+                }
+                if (intronIds.contains(intron->id)) {
+                    continue;
+                }
+                intronIds.insert(intron->id);
+                ok = addRow(tableName("introns"), intronColumns, QVariantList()
+                            << intron->id
+                            << intronRow(intron)) && ok;
+            }
+        }
+    }
+    return ok;
+}
+
+// Tables of features, which are written to staging tables in staging mode
+static const char * const STAGED_TABLES[] = {
+    "sequences", "orphaned_cdses", "genes", "isoforms", "exons", "introns",
+    "isoform_exons", "isoform_introns"
+};
+static const int STAGED_TABLES_COUNT =
+        sizeof(STAGED_TABLES) / sizeof(STAGED_TABLES[0]);
+
+void Database::setStagingTables(bool staging)
+{
+    _stagingTables = staging;
+}
 
+QString Database::tableName(const QString &name)
+{
+    if (_stagingTables) {
+        for (int i = 0; i < STAGED_TABLES_COUNT; ++i) {
+            if (name == STAGED_TABLES[i]) {
+                return name + "_staging";
+            }
+        }
+    }
+    return name;
+}
 
+QStringList Database::secondaryIndexes(const QString &table)
+{
+    QStringList result;
+    QSqlQuery & query = prepared("SELECT index_name, non_unique, column_name "
+                                 "FROM information_schema.statistics "
+                                 "WHERE table_schema=DATABASE() AND table_name=:table_name "
+                                 "AND index_name<>'PRIMARY' "
+                                 "ORDER BY index_name, seq_in_index");
+    query.bindValue(":table_name", table);
     if (!query.exec()) {
         qWarning() << query.lastError();
         qWarning() << query.lastError().text();
         qWarning() << query.lastQuery();
-        return;
+        return result;
+    }
+    // Columns of each index come one after another
+    QString indexName;
+    QStringList columns;
+    bool unique = false;
+    while (true) {
+        const bool hasNext = query.next();
+        if (!indexName.isEmpty() &&
+                (!hasNext || query.value(0).toString() != indexName)) {
+            result.append(QString(unique ? "UNIQUE INDEX " : "INDEX ") +
+                          indexName + "(" + columns.join(", ") + ")");
+            columns.clear();
+        }
+        if (!hasNext) {
+            break;
+        }
+        indexName = query.value(0).toString();
+        unique = 0 == query.value(1).toInt();
+        columns.append(query.value(2).toString());
     }
-    else {
-        isoform->id = query.lastInsertId().toInt();
+    query.finish();
+    return result;
+}
+
+// Indexes by which loader finds rows of re-stored sequence are kept on
+// staging tables, so their deletes do not scan whole tables
+static bool isLookupIndex(const QString & table, const QString & index)
+{
+    const QString columns = index.section('(', 1);
+    return columns.startsWith("id_sequences") ||
+            ("sequences" == table && columns.startsWith("id_organisms"));
+}
+
+bool Database::createStagingTables()
+{
+    // Staging tables replace original ones, so rows stored before the run
+    // would be lost. Incremental loads are written into tables directly.
+    for (int i = 0; i < STAGED_TABLES_COUNT; ++i) {
+        const QString table = STAGED_TABLES[i];
+        QSqlQuery & query = prepared("SELECT 1 FROM " + table + " LIMIT 1");
+        if (!query.exec()) {
+            qWarning() << query.lastError();
+            qWarning() << query.lastError().text();
+            qWarning() << query.lastQuery();
+            return false;
+        }
+        const bool hasRows = query.next();
+        query.finish();
+        if (hasRows) {
+            qWarning() << "Table " << table << " is not empty, staging tables "
+                       << "are only used to load into empty database";
+            return false;
+        }
     }
 
-    Q_FOREACH(ExonPtr exon, isoform->exons) {
-        addCodingExon(exon);
+    for (int i = 0; i < STAGED_TABLES_COUNT; ++i) {
+        const QString table = STAGED_TABLES[i];
+        const QString staging = tableName(table);
+        if (!exec("DROP TABLE IF EXISTS " + staging) ||
+                !exec("CREATE TABLE " + staging + " LIKE " + table)) {
+            return false;
+        }
+        QStringList drops;
+        Q_FOREACH(const QString & index, secondaryIndexes(staging)) {
+            if (!isLookupIndex(table, index)) {
+                drops.append("DROP INDEX " +
+                             index.section('(', 0, 0).section(' ', -1));
+            }
+        }
+        if (!drops.isEmpty() &&
+                !exec("ALTER TABLE " + staging + " " + drops.join(", "))) {
+            return false;
+        }
     }
+    return true;
+}
+
+namespace {
 
-    Q_FOREACH(IntronPtr intron, isoform->introns) {
-        addIntron(intron);
+// Builds indexes of one table by its own connection
+class IndexBuilder
+        : public QRunnable
+{
+public:
+    IndexBuilder(const QSqlDatabase & source, const QString & statement,
+                 QAtomicInt * failures)
+        : _source(source)
+        , _statement(statement)
+        , _failures(failures)
+    {
+    }
+
+    void run() override
+    {
+        const QString name = QString("introns_db_fill_pid%1_index%2")
+                .arg(qApp->applicationPid())
+                .arg(qint64(QThread::currentThreadId()));
+        {
+            QSqlDatabase db = QSqlDatabase::cloneDatabase(_source, name);
+            QSqlQuery query("", db);
+            if (!db.open() || !query.exec(_statement)) {
+                qWarning() << query.lastError();
+                qWarning() << query.lastError().text();
+                qWarning() << _statement;
+                _failures->ref();
+            }
+            db.close();
+        }
+        QSqlDatabase::removeDatabase(name);
     }
 
-    Q_FOREACH(ExonPtr exon, isoform->exons) {
-        updateNeigbourIntronsIds(exon);
+private:
+    QSqlDatabase _source;
+    QString _statement;
+    QAtomicInt * _failures;
+};
+
+}
+
+bool Database::swapStagingTables(int threads)
+{
+    // Indexes of table are built by one statement in one pass over it,
+    // and tables are indexed in parallel
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, threads));
+    QAtomicInt failures(0);
+    for (int i = 0; i < STAGED_TABLES_COUNT; ++i) {
+        const QString table = STAGED_TABLES[i];
+        QStringList adds;
+        Q_FOREACH(const QString & index, secondaryIndexes(table)) {
+            if (!isLookupIndex(table, index)) {
+                adds.append("ADD " + index);
+            }
+        }
+        if (!adds.isEmpty()) {
+            pool.start(new IndexBuilder(*_db, "ALTER TABLE " + tableName(table) +
+                                        " " + adds.join(", "),
+                                        &failures));
+        }
+    }
+    pool.waitForDone();
+    if (failures.fetchAndAddOrdered(0) > 0) {
+        qWarning() << "Staging tables are not swapped, as indexes are not built";
+        return false;
     }
 
+    QStringList renames;
+    QStringList olds;
+    for (int i = 0; i < STAGED_TABLES_COUNT; ++i) {
+        const QString table = STAGED_TABLES[i];
+        renames.append(table + " TO " + table + "_old");
+        renames.append(tableName(table) + " TO " + table);
+        olds.append(table + "_old");
+    }
+    // All tables are replaced by one statement, so readers see either old
+    // or new ones
+    if (!exec("RENAME TABLE " + renames.join(", "))) {
+        return false;
+    }
+    return exec("DROP TABLE " + olds.join(", "));
 }
 
-void Database::addCodingExon(ExonPtr exon)
+Database::~Database()
 {
-    const qint32 seqId = exon->isoform.toStrongRef()->gene.toStrongRef()->sequence.toStrongRef()->id;
-    const qint32 geneId = exon->isoform.toStrongRef()->gene.toStrongRef()->id;
-    const qint32 isoformId = exon->isoform.toStrongRef()->id;
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO exons("
-                  "id_isoforms"
-                  ", id_genes"
-                  ", id_sequences"
-                  ", startt"
-                  ", endd"
-                  ", lengthh"
-                  ", typee"
-                  ", start_phase"
-                  ", end_phase"
-                  ", length_phase"
-                  ", indexx"
-                  ", rev_index"
-                  ", start_codon"
-                  ", end_codon"
-                  ", error_in_pseudo_flag"
-                  ", error_n_in_sequence"
-                  ") VALUES("
-                  ":id_isoforms"
-                  ", :id_genes"
-                  ", :id_sequences"
-                  ", :startt"
-                  ", :endd"
-                  ", :lengthh"
-                  ", :typee"
-                  ", :start_phase"
-                  ", :end_phase"
-                  ", :length_phase"
-                  ", :indexx"
-                  ", :rev_index"
-                  ", :start_codon"
-                  ", :end_codon"
-                  ", :error_in_pseudo_flag"
-                  ", :error_n_in_sequence"
-                  ")");
-    query.bindValue(":id_isoforms", isoformId);
-    query.bindValue(":id_genes", geneId);
-    query.bindValue(":id_sequences", seqId);
-    query.bindValue(":startt", exon->start);
-    query.bindValue(":endd", exon->end);
-    query.bindValue(":lengthh", exon->end - exon->start + 1);
-    query.bindValue(":typee", qint16(exon->type));
-    query.bindValue(":start_phase", exon->startPhase);
-    query.bindValue(":end_phase", exon->endPhase);
-    query.bindValue(":length_phase", exon->lengthPhase);
-    query.bindValue(":indexx", exon->index);
-    query.bindValue(":rev_index", exon->revIndex);
-    query.bindValue(":start_codon", exon->startCodon);
-    query.bindValue(":end_codon", exon->endCodon);
-    query.bindValue(":error_in_pseudo_flag", exon->errorInPseudoFlag);
-    query.bindValue(":error_n_in_sequence", exon->errorNInSequence);
+    // Failure is reported by commit, with count of sequences lost
+    commit();
+    // Connection and its prepared statements are kept for next files of
+    // thread, and closed by closeConnection
+}
 
+QSqlQuery & Database::prepared(const QString &statement)
+{
+    // Statements are kept by connection of thread, so each shape is
+    // prepared by server once and then executed with new values only
+    _connectionsMutex.lock();
+    QHash< QString, QSharedPointer<QSqlQuery> > & statements =
+            _statements[QThread::currentThreadId()];
+    _connectionsMutex.unlock();
+
+    QSharedPointer<QSqlQuery> & query = statements[statement];
+    if (!query) {
+        query = QSharedPointer<QSqlQuery>(new QSqlQuery("", *_db));
+        if (!query->prepare(statement)) {
+            qWarning() << query->lastError();
+            qWarning() << query->lastError().text();
+            qWarning() << statement;
+        }
+    }
+    return *query;
+}
 
-    if (!query.exec()) {
+QSqlQuery Database::autocommitQuery(const QString &statement)
+{
+    // Reference rows are cached for the whole run, so they are inserted
+    // apart from transaction of sequences, which might be rolled back
+    QSqlQuery query("", idAllocator()->connection());
+    if (!query.prepare(statement)) {
         qWarning() << query.lastError();
         qWarning() << query.lastError().text();
-        qWarning() << query.lastQuery();
-        return;
-    }
-    else {
-        exon->id = query.lastInsertId().toInt();
+        qWarning() << statement;
     }
+    return query;
 }
 
-void Database::addIntron(IntronPtr intron)
+void Database::storeAggregates(const Aggregates &aggregates)
 {
-    const qint32 seqId = intron->isoform.toStrongRef()->gene.toStrongRef()->sequence.toStrongRef()->id;
-    const qint32 geneId = intron->isoform.toStrongRef()->gene.toStrongRef()->id;
-    const qint32 isoformId = intron->isoform.toStrongRef()->id;
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO introns("
-                  "id_isoforms"
-                  ", id_genes"
-                  ", id_sequences"
-                  ", prev_exon"
-                  ", next_exon"
-                  ", startt"
-                  ", endd"
-                  ", id_intron_types"
-                  ", start_dinucleotide"
-                  ", end_dinucleotide"
-                  ", lengthh"
-                  ", indexx"
-                  ", rev_index"
-                  ", length_phase"
-                  ", phase"
-                  ", error_start_dinucleotide"
-                  ", error_end_dinucleotide"
-                  ", error_main"
-                  ", warning_n_in_sequence"
-                  ") VALUES("
-                  ":id_isoforms"
-                  ", :id_genes"
-                  ", :id_sequences"
-                  ", :prev_exon"
-                  ", :next_exon"
-                  ", :startt"
-                  ", :endd"
-                  ", :id_intron_types"
-                  ", :start_dinucleotide"
-                  ", :end_dinucleotide"
-                  ", :lengthh"
-                  ", :indexx"
-                  ", :rev_index"
-                  ", :length_phase"
-                  ", :phase"
-                  ", :error_start_dinucleotide"
-                  ", :error_end_dinucleotide"
-                  ", :error_main"
-                  ", :warning_n_in_sequence"
-                  ")");
-    query.bindValue(":id_isoforms", isoformId);
-    query.bindValue(":id_genes", geneId);
-    query.bindValue(":id_sequences", seqId);
-
-    query.bindValue(":prev_exon", intron->prevExon.toStrongRef()->id);
-    query.bindValue(":next_exon", intron->nextExon.toStrongRef()->id);
-    query.bindValue(":startt", intron->start);
-    query.bindValue(":endd", intron->end);
-    query.bindValue(":id_intron_types", intron->intronTypeId);
-    query.bindValue(":start_dinucleotide", intron->startDinucleotide);
-    query.bindValue(":end_dinucleotide", intron->endDinucleotide);
-
-    query.bindValue(":lengthh", qint32(intron->end) - qint32(intron->start) + 1);
-    query.bindValue(":indexx", intron->index);
-    query.bindValue(":rev_index", UINT32_MAX == intron->revIndex ? 0 : intron->revIndex);
-    query.bindValue(":length_phase", intron->lengthPhase);
-    query.bindValue(":phase", intron->phase);
-    query.bindValue(":error_start_dinucleotide", intron->errorInStartDinucleotide);
-    query.bindValue(":error_end_dinucleotide", intron->errorInEndDinucleotide);
-    query.bindValue(":error_main", intron->errorMain);
-    query.bindValue(":warning_n_in_sequence", intron->warningNInSequence);
+    // Sums are added all or none, so failed run can be repeated
+    if (!beginTransaction()) {
+        return;
+    }
+    // Counts of previous runs are kept, the same as organism counters.
+    // Replaced sequences are subtracted, so added amounts might be negative.
+    QSqlQuery & query = prepared("INSERT INTO codon_usage(id_organisms, codon, codons_count) "
+                                 "VALUES(:id_organisms, :codon, :codons_count) "
+                                 "ON DUPLICATE KEY UPDATE "
+                                 "codons_count=codons_count+VALUES(codons_count)");
+    Q_FOREACH(const qint32 organismId, aggregates.codonUsage.keys()) {
+        const QVector<qint64> & counts = aggregates.codonUsage[organismId];
+        for (int i = 0; i < counts.size(); ++i) {
+            query.bindValue(":id_organisms", organismId);
+            query.bindValue(":codon", QString::fromLatin1(GeneticCode::codon(i)));
+            query.bindValue(":codons_count", counts[i]);
+            if (!query.exec()) {
+                qWarning() << query.lastError();
+                qWarning() << query.lastError().text();
+                qWarning() << query.lastQuery();
+                rollback();
+                return;
+            }
+        }
+    }
 
+    typedef QPair<qint32,qint32> Key;
+    Q_FOREACH(const Key & key, aggregates.intronCounts.keys()) {
+        const Aggregates::IntronCounts & counts = aggregates.intronCounts[key];
+        if (!storeIntronCounts(key.first, key.second, counts)) {
+            rollback();
+            return;
+        }
+    }
+    commit();
+}
 
+static bool execSummaryQuery(QSqlQuery & query)
+{
     if (!query.exec()) {
         qWarning() << query.lastError();
         qWarning() << query.lastError().text();
         qWarning() << query.lastQuery();
-        return;
-    }
-    else {
-        intron->id = query.lastInsertId().toInt();
+        return false;
     }
+    return true;
 }
 
-void Database::updateNeigbourIntronsIds(ExonPtr exon)
+bool Database::storeIntronCounts(qint32 organismId, qint32 chromosomeId,
+                                 const Aggregates::IntronCounts &counts)
 {
-    const qint32 exonId = exon->id;
-    QSqlQuery query("", *_db);
-    if (exon->prevIntron) {
-        const qint32 prevId = exon->prevIntron.toStrongRef()->id;
-        query.prepare("UPDATE exons SET prev_intron=:prev_id WHERE id=:exon_id");
-        query.bindValue(":prev_id", prevId);
-        query.bindValue(":exon_id", exonId);
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+    QSqlQuery & typesQuery = prepared("INSERT INTO intron_type_counts("
+                                      "id_organisms, id_chromosomes, id_intron_types, introns_count) "
+                                      "VALUES(:id_organisms, :id_chromosomes, :id_intron_types, :introns_count) "
+                                      "ON DUPLICATE KEY UPDATE "
+                                      "introns_count=introns_count+VALUES(introns_count)");
+    for (int i = 0; i < Aggregates::IntronTypesCount; ++i) {
+        if (0 == counts.types[i]) {
+            continue;
         }
-    }
-    if (exon->nextIntron) {
-        const qint32 nextId = exon->nextIntron.toStrongRef()->id;
-        query.prepare("UPDATE exons SET next_intron=:next_id WHERE id=:exon_id");
-        query.bindValue(":next_id", nextId);
-        query.bindValue(":exon_id", exonId);
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+        typesQuery.bindValue(":id_organisms", organismId);
+        typesQuery.bindValue(":id_chromosomes", chromosomeId);
+        typesQuery.bindValue(":id_intron_types", i + 1);
+        typesQuery.bindValue(":introns_count", counts.types[i]);
+        if (!execSummaryQuery(typesQuery)) {
+            return false;
         }
     }
-}
 
-Database::~Database()
-{
-    if (_db->isOpen()) {
-        _db->close();
+    QSqlQuery & binsQuery = prepared("INSERT INTO intron_length_bins("
+                                     "id_organisms, id_chromosomes, bin, min_length, max_length, introns_count) "
+                                     "VALUES(:id_organisms, :id_chromosomes, :bin, :min_length, :max_length, :introns_count) "
+                                     "ON DUPLICATE KEY UPDATE "
+                                     "introns_count=introns_count+VALUES(introns_count)");
+    for (int bin = 0; bin < Aggregates::LengthBinsCount; ++bin) {
+        if (0 == counts.lengthBins[bin]) {
+            continue;
+        }
+        binsQuery.bindValue(":id_organisms", organismId);
+        binsQuery.bindValue(":id_chromosomes", chromosomeId);
+        binsQuery.bindValue(":bin", bin);
+        binsQuery.bindValue(":min_length", quint64(1) << bin);
+        binsQuery.bindValue(":max_length", (quint64(1) << (bin + 1)) - 1);
+        binsQuery.bindValue(":introns_count", counts.lengthBins[bin]);
+        if (!execSummaryQuery(binsQuery)) {
+            return false;
+        }
     }
-}
 
+    QSqlQuery & classesQuery = prepared("INSERT INTO intron_class_counts("
+                                        "id_organisms, id_chromosomes, splice_class, introns_count) "
+                                        "VALUES(:id_organisms, :id_chromosomes, :splice_class, :introns_count) "
+                                        "ON DUPLICATE KEY UPDATE "
+                                        "introns_count=introns_count+VALUES(introns_count)");
+    Q_FOREACH(const QString & spliceClass, counts.spliceClasses.keys()) {
+        classesQuery.bindValue(":id_organisms", organismId);
+        classesQuery.bindValue(":id_chromosomes", chromosomeId);
+        classesQuery.bindValue(":splice_class", spliceClass);
+        classesQuery.bindValue(":introns_count", counts.spliceClasses[spliceClass]);
+        if (!execSummaryQuery(classesQuery)) {
+            return false;
+        }
+    }
 
+    QSqlQuery & phasesQuery = prepared("INSERT INTO intron_phase_counts("
+                                       "id_organisms, id_chromosomes, phase, introns_count) "
+                                       "VALUES(:id_organisms, :id_chromosomes, :phase, :introns_count) "
+                                       "ON DUPLICATE KEY UPDATE "
+                                       "introns_count=introns_count+VALUES(introns_count)");
+    for (int phase = 0; phase < counts.phases.size(); ++phase) {
+        if (0 == counts.phases[phase]) {
+            continue;
+        }
+        phasesQuery.bindValue(":id_organisms", organismId);
+        phasesQuery.bindValue(":id_chromosomes", chromosomeId);
+        phasesQuery.bindValue(":phase", phase);
+        phasesQuery.bindValue(":introns_count", counts.phases[phase]);
+        if (!execSummaryQuery(phasesQuery)) {
+            return false;
+        }
+    }
+    return true;
+}
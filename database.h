@@ -1,22 +1,79 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include "aggregates.h"
 #include "structures.h"
 
 #include <QDir>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QList>
 #include <QMap>
 #include <QMutex>
 #include <QPair>
 #include <QSqlDatabase>
+#include <QSqlQuery>
 #include <QSharedPointer>
+#include <QStringList>
+#include <QVariant>
+
+#include <functional>
+
+class BulkLoader;
+class IdAllocator;
 
 class Database {
 public:
   static QSharedPointer<Database> open(const QString &host,
                         const QString &userName, const QString &password,
                         const QString &dbName, const QString &sequencesStoreDir,
-                                       const QString &translationsStoreDir);
+                                       const QString &translationsStoreDir,
+                                       bool localInfile = false);
+
+  // Connection of thread is opened by the first open call and kept for
+  // the next ones, which reconnect it if it is broken. closeConnection
+  // closes it at the end of thread, when no Database of thread is left.
+  static void closeConnection();
+
+  // Stores exons and introns shared by isoforms of gene once, and links
+  // them to isoforms by isoform_exons and isoform_introns tables
+  void setDeduplicateFeatures(bool deduplicate);
+
+  // Loads genes, isoforms, exons and introns by LOAD DATA LOCAL INFILE
+  // from spool files in spoolDir instead of inserts. Connection must be
+  // opened with localInfile.
+  void setBulkLoad(const QString & spoolDir);
+
+  // Sequences and features are written to copies of their tables, which
+  // are only indexed by sequence, with unique and foreign key checks off,
+  // and copies replace tables by swapStagingTables at the end of run. Set
+  // before any connection opens.
+  static void setStagingTables(bool staging);
+  static QString tableName(const QString & name);
+  // Fails if original tables have rows, as the swap would drop them
+  bool createStagingTables();
+
+  // Builds indexes of staging tables like the ones of original tables in
+  // parallel, then renames staging tables to original ones at once
+  bool swapStagingTables(int threads);
+
+  static const quint32 DefaultCommitRows = 20000;
+  static const qint32 DefaultCommitLatencyMs = 2000;
+
+  // Each sequence is written atomically, and sequences written one after
+  // another share transaction, which is committed as soon as it has
+  // maxRows rows or is open for maxLatencyMs. One row commits each
+  // sequence by its own.
+  void setGroupCommit(quint32 maxRows, qint32 maxLatencyMs);
+
+  // Commits sequences written so far. Called on destruction too.
+  bool commit();
+
+  // Called for each sequence once its transaction is committed, so only
+  // stored sequences are added to aggregates and indexes. Sequences of
+  // rolled back transaction get zero id instead.
+  typedef std::function<void(SequencePtr sequence)> CommitHandler;
+  void setCommitHandler(const CommitHandler & handler);
 
   OrganismPtr findOrCreateOrganism(const QString & name);
   ChromosomePtr findOrCreateChromosome(const QString &name, OrganismPtr organism);
@@ -24,36 +81,81 @@ public:
   void updateOrganism(OrganismPtr organism);
   void updateChromosome(ChromosomePtr chromosome);
 
+  // Counters of organisms and chromosomes are kept in memory while their
+  // sequences are added, and written by flushStatistics once for each
+  // changed one. Checkpoint flushes them every 'seconds' too, 0 disables it.
+  static void setStatisticsCheckpoint(qint32 seconds);
+  void flushStatisticsIfDue();
+  void flushStatistics();
+
+  // Organisms of each scheduled input, as they are looked up by name, or
+  // empty list if not known before input is read. inputDone writes
+  // counters of organisms which have no inputs left, once no input of
+  // unknown organisms is left either.
+  static void scheduleInputs(const QList<QStringList> & inputs);
+  void inputDone(const QStringList & organismNames);
+
   TaxKingdomPtr findOrCreateTaxKingdom(const QString & name);
   TaxGroup1Ptr findOrCreateTaxGroup1(const QString & name, const QString & type, TaxKingdomPtr kingdom);
   TaxGroup2Ptr findOrCreateTaxGroup2(const QString & name, const QString & type, TaxGroup1Ptr group1);
 
-  void dropSequenceIfExists(SequencePtr sequence);
+  // Counts of dropped introns and codons are added to 'dropped'
+  void dropSequenceIfExists(SequencePtr sequence, Aggregates * dropped);
 
   void addSequence(SequencePtr sequence);
-  void addOrphanedCDS(const QString & fileName, const quint32 lineStart, const quint32 lineEnd,
-                      const QString &refSeqId,
-                      const QString &dbXref,
-                      const QString &product);
   void storeOrigin(SequencePtr sequence);
   void storeTranslation(IsoformPtr isoform);
   static QString format60(const QString &s);
 
-  void addGene(GenePtr gene);
-  void addIsoform(IsoformPtr isoform);
-  void addCodingExon(ExonPtr exon);
-  void addIntron(IntronPtr intron);
-  void updateNeigbourIntronsIds(ExonPtr exon);
+  // Adds run-wide aggregates to summary tables. Counts of sequences
+  // replaced by the run are subtracted from local aggregates of writer
+  // when replacement is committed.
+  void storeAggregates(const Aggregates & aggregates);
 
   ~Database();
 
 private:
 
+  typedef std::function<bool(const QString & tableName,
+                             const QStringList & columns,
+                             const QVariantList & values)> RowWriter;
+
+  // Writes genes, isoforms, exons and introns of sequence by multi-row
+  // inserts, or by bulk loader if set
+  bool addFeatures(SequencePtr sequence);
+
+  IdAllocator * idAllocator();
+  bool assignIds(SequencePtr sequence);
+  bool writeFeatures(SequencePtr sequence, qint32 organismId,
+                     const RowWriter & addRow);
+  // Cached prepared statement of connection. Values bound by previous
+  // user are kept, so all of them are bound again.
+  QSqlQuery & prepared(const QString & statement);
+  QSqlQuery autocommitQuery(const QString & statement);
+  QStringList secondaryIndexes(const QString & table);
+  bool beginTransaction();
+  void rollback();
+  void rollbackSequence();
+  bool loadSpools();
+  void dropUncommitted();
+  void addStatistics(SequencePtr sequence);
+  bool exec(const QString & statement);
+  bool storeIntronCounts(qint32 organismId, qint32 chromosomeId,
+                         const Aggregates::IntronCounts & counts);
+  void markChanged(OrganismPtr organism);
+  void markChanged(ChromosomePtr chromosome);
+  void writeStatistics(const QList<OrganismPtr> & organisms,
+                       const QList<ChromosomePtr> & chromosomes);
+
   static QMutex _connectionsMutex;
   static QMap<Qt::HANDLE, QSqlDatabase> _connections;
+  static QMap< Qt::HANDLE, QSharedPointer<IdAllocator> > _idAllocators;
+  static QMap< Qt::HANDLE, QHash< QString, QSharedPointer<QSqlQuery> > > _statements;
+  static bool _stagingTables;
 
   static QMutex _organismsMutex;
   static QMap<QString, OrganismPtr> _organisms;
+  static QMap<Organism*, QString> _organismKeys;
 
   static QMutex _chromosomesMutex;
   static QMap<QPair<OrganismPtr,QString>, ChromosomePtr> _chromosomes;
@@ -63,11 +165,31 @@ private:
   static QMap<QPair<QString,QString>, TaxGroup1Ptr> _taxGroups1;
   static QMap<QPair<QString,QString>, TaxGroup2Ptr> _taxGroups2;
 
+  static QMutex _statisticsMutex;
+  static QMap<Organism*, OrganismPtr> _changedOrganisms;
+  static QMap<Chromosome*, ChromosomePtr> _changedChromosomes;
+  static qint32 _statisticsCheckpointSec;
+  static QElapsedTimer _statisticsTimer;
+  static QMap<QString, qint32> _scheduledInputs;
+  static qint32 _unknownInputs;
+
 
   QDir _sequencesStoreDir;
   QDir _translationsStoreDir;
   QSqlDatabase * _db = nullptr;
 
+  bool _deduplicateFeatures = false;
+  QSharedPointer<BulkLoader> _bulkLoader;
+
+  quint32 _commitRows = DefaultCommitRows;
+  qint32 _commitLatencyMs = DefaultCommitLatencyMs;
+  bool _inTransaction = false;
+  quint32 _pendingRows = 0;
+  QElapsedTimer _transactionTimer;
+  QList<SequencePtr> _uncommitted;
+  Aggregates _droppedCounts;  // of sequences replaced by uncommitted ones
+  CommitHandler _commitHandler;
+
 };
 
 #endif // DATABASE_H
@@ -0,0 +1,101 @@
+#include "fastaindex.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QTextStream>
+
+QString FastaIndex::indexFileNameFor(const QString &fastaFileName)
+{
+    return fastaFileName + ".fai";
+}
+
+bool FastaIndex::open(const QString &fastaFileName)
+{
+    _entries.clear();
+    const QString indexFileName = indexFileNameFor(fastaFileName);
+    QFile indexFile(indexFileName);
+    if (!indexFile.open(QIODevice::ReadOnly|QIODevice::Text)) {
+        qWarning() << "Can't open FASTA index " << indexFileName
+                   << ". Use 'samtools faidx' to create it!";
+        return false;
+    }
+    QTextStream ts(&indexFile);
+    while (!ts.atEnd()) {
+        const QString line = ts.readLine();
+        if (line.isEmpty()) {
+            continue;
+        }
+        const QStringList fields = line.split('\t');
+        if (fields.size() < 5) {
+            qWarning() << "Malformed line in FASTA index '" << indexFileName << "': " << line;
+            continue;
+        }
+        Entry entry;
+        entry.length = fields[1].toULongLong();
+        entry.offset = fields[2].toULongLong();
+        entry.lineBases = fields[3].toUInt();
+        entry.lineWidth = fields[4].toUInt();
+        if (0 == entry.lineBases || entry.lineWidth < entry.lineBases) {
+            qWarning() << "Malformed line in FASTA index '" << indexFileName << "': " << line;
+            continue;
+        }
+        _entries[fields[0]] = entry;
+    }
+
+    _file.setFileName(fastaFileName);
+    if (!_file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Can't open FASTA file " << fastaFileName;
+        return false;
+    }
+    return true;
+}
+
+bool FastaIndex::contains(const QString &name) const
+{
+    return _entries.contains(name);
+}
+
+quint64 FastaIndex::length(const QString &name) const
+{
+    return _entries.contains(name) ? _entries[name].length : 0;
+}
+
+QByteArray FastaIndex::read(const QString &name, quint64 start, quint64 end)
+{
+    if (!_entries.contains(name) || 0 == start || end < start) {
+        return QByteArray();
+    }
+    const Entry & entry = _entries[name];
+    end = qMin(end, entry.length);
+    if (end < start) {
+        return QByteArray();
+    }
+
+    // Byte offsets of first and last bases, skipping line ends
+    const quint64 first = start - 1;
+    const quint64 last = end - 1;
+    const quint64 firstOffset = entry.offset +
+            (first / entry.lineBases) * entry.lineWidth + first % entry.lineBases;
+    const quint64 lastOffset = entry.offset +
+            (last / entry.lineBases) * entry.lineWidth + last % entry.lineBases;
+
+    QByteArray raw;
+    {
+        QMutexLocker lock(&_mutex);
+        if (!_file.seek(firstOffset)) {
+            return QByteArray();
+        }
+        raw = _file.read(lastOffset - firstOffset + 1);
+    }
+
+    QByteArray result;
+    result.reserve(end - start + 1);
+    for (int i = 0; i < raw.size(); ++i) {
+        const char c = raw[i];
+        if ('\n' != c && '\r' != c) {
+            result.append(c);
+        }
+    }
+    return result.toUpper();
+}
@@ -0,0 +1,38 @@
+#ifndef FASTAINDEX_H
+#define FASTAINDEX_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+
+// Random access to uncompressed FASTA file by its '.fai' index, as created
+// by 'samtools faidx'. Only requested windows are read from file.
+class FastaIndex
+{
+public:
+    static QString indexFileNameFor(const QString & fastaFileName);
+
+    bool open(const QString & fastaFileName);
+    bool contains(const QString & name) const;
+    quint64 length(const QString & name) const;
+
+    // Bases from start to end inclusive, 1-based, in upper case.
+    // Thread safe.
+    QByteArray read(const QString & name, quint64 start, quint64 end);
+
+private:
+    struct Entry {
+        quint64 length = 0;
+        quint64 offset = 0;
+        quint32 lineBases = 0;
+        quint32 lineWidth = 0;
+    };
+
+    QMap<QString,Entry> _entries;
+    QFile _file;
+    QMutex _mutex;
+};
+
+#endif // FASTAINDEX_H
@@ -0,0 +1,46 @@
+#include "filesegment.h"
+
+FileSegment::FileSegment(QIODevice *source, qint64 start, qint64 end,
+                         QObject *parent)
+    : QIODevice(parent)
+    , _in(source)
+    , _start(start)
+    , _end(end)
+    , _pos(start)
+{
+}
+
+bool FileSegment::open(OpenMode mode)
+{
+    if (!_in->isOpen() && !_in->open(ReadOnly)) {
+        return false;
+    }
+    if (!_in->seek(_start)) {
+        return false;
+    }
+    _pos = _start;
+    return QIODevice::open(mode);
+}
+
+bool FileSegment::isSequential() const
+{
+    return true;
+}
+
+bool FileSegment::atEnd() const
+{
+    return _pos >= _end && 0 == QIODevice::bytesAvailable();
+}
+
+qint64 FileSegment::readData(char *data, qint64 maxlen)
+{
+    const qint64 chunkSize = qMin(maxlen, _end - _pos);
+    if (chunkSize <= 0) {
+        return 0;
+    }
+    const qint64 bytesRead = _in->read(data, chunkSize);
+    if (bytesRead > 0) {
+        _pos += bytesRead;
+    }
+    return bytesRead;
+}
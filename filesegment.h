@@ -0,0 +1,31 @@
+#ifndef FILESEGMENT_H
+#define FILESEGMENT_H
+
+#include <QIODevice>
+#include <QObject>
+
+// Read-only view of byte range [start, end) of seekable source, so
+// records of one large input are parsed by several workers
+class FileSegment
+        : public QIODevice
+{
+public:
+    explicit FileSegment(QIODevice * source, qint64 start, qint64 end,
+                         QObject * parent = 0);
+
+    bool open(OpenMode mode) override;
+    bool isSequential() const override;
+    bool atEnd() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) override;
+    inline qint64 writeData(const char *, qint64 ) override { return 0; }
+
+private:
+    QIODevice * _in;
+    qint64 _start;
+    qint64 _end;
+    qint64 _pos;
+};
+
+#endif // FILESEGMENT_H
@@ -0,0 +1,315 @@
+#include "gbkreader.h"
+
+#include <QStringList>
+
+static bool isRecordEnd(const QString & line)
+{
+    return "//" == line.trimmed();
+}
+
+bool GbkHandler::startRecord(quint32 lineNo)
+{
+    Q_UNUSED(lineNo);
+    return true;
+}
+
+bool GbkHandler::headerField(const QString &name, const QString &value)
+{
+    Q_UNUSED(name);
+    Q_UNUSED(value);
+    return true;
+}
+
+bool GbkHandler::acceptFeatureKey(const QString &key)
+{
+    Q_UNUSED(key);
+    return true;
+}
+
+bool GbkHandler::feature(const QString &key,
+                         const FeatureLocation &location,
+                         const QMap<QString, QString> &qualifiers,
+                         quint32 lineStart, quint32 lineEnd)
+{
+    Q_UNUSED(key);
+    Q_UNUSED(location);
+    Q_UNUSED(qualifiers);
+    Q_UNUSED(lineStart);
+    Q_UNUSED(lineEnd);
+    return true;
+}
+
+bool GbkHandler::originChunk(const QByteArray &bases)
+{
+    Q_UNUSED(bases);
+    return true;
+}
+
+void GbkHandler::endRecord()
+{
+}
+
+void GbkReader::setSource(QIODevice *sourceStream)
+{
+    _io = sourceStream;
+    _stream = new QTextStream(_io);
+    _stream->setCodec("UTF-8");
+    _state = State::TopLevel;
+}
+
+bool GbkReader::atEnd() const
+{
+    return !_io || !_stream || _stream->atEnd();
+}
+
+bool GbkReader::readRecord(GbkHandler *handler)
+{
+    _state = TopLevel;
+    bool started = false;
+    bool skip = false;
+    QString topLevelName;
+    QString topLevelValue;
+    QString secondLevelName;
+    QString secondLevelValue;
+    while (!atEnd()) {
+        QString currentLine = _stream->readLine();
+        _currentLineNo += 1;
+        currentLine.replace('\t', "    ");
+        if (isRecordEnd(currentLine)) {
+            break;
+        }
+        if (!started) {
+            if (currentLine.trimmed().isEmpty()) {
+                continue;
+            }
+            started = true;
+            if (!handler->startRecord(_currentLineNo)) {
+                skipToRecordEnd();
+                break;
+            }
+        }
+        if (State::TopLevel == _state) {
+            const QString prefix =
+                    currentLine.length() > 12
+                    ? currentLine.left(12).trimmed()
+                    : currentLine.trimmed();
+
+            const QString value =
+                    currentLine.length() > 12
+                    ? currentLine.mid(12).trimmed()
+                    : QString();
+
+            if (prefix.isEmpty()) {
+                if (topLevelValue.length() > 0) {
+                    topLevelValue.push_back('\n');
+                }
+                topLevelValue += value;
+            }
+            else {
+                if (topLevelName.length() > 0) {
+                    skip = !parseTopLevel(topLevelName, topLevelValue, handler);
+                }
+                if (State::Features == _state) {
+                    secondLevelName = prefix;
+                    secondLevelValue = value;
+                }
+                else {
+                    topLevelName = prefix;
+                    topLevelValue = value;
+                }
+            }
+        }
+        else if (State::Features == _state) {
+            const QString prefix =
+                    currentLine.length() > 21
+                    ? currentLine.left(21).trimmed()
+                    : currentLine.trimmed();
+            const QString value =
+                    currentLine.length() > 21
+                    ? currentLine.mid(21).trimmed()
+                    : QString();
+
+            if (prefix.isEmpty()) {
+                if (secondLevelValue.length() > 0) {
+                    secondLevelValue.push_back('\n');
+                }
+                secondLevelValue += value;
+            }
+            else {
+                if (secondLevelName.length() > 0) {
+                    skip = !parseSecondLevel(secondLevelName, secondLevelValue, handler);
+                }
+                secondLevelName = prefix;
+                secondLevelValue = value;
+                _featureStartLineNo = _currentLineNo;
+            }
+            if ("ORIGIN" == prefix) {
+                _state = State::Origin;
+            }
+        }
+        else if (State::Origin == _state) {
+            QString value =
+                    currentLine.length() > 10
+                    ? currentLine.mid(10)
+                    : QString();
+            value.replace(' ', "");
+            value = value.toUpper();
+            skip = !handler->originChunk(value.toLatin1());
+        }
+        if (skip) {
+            skipToRecordEnd();
+            break;
+        }
+    }
+    if (started) {
+        handler->endRecord();
+    }
+    return started;
+}
+
+void GbkReader::skipToRecordEnd()
+{
+    while (!atEnd()) {
+        const QString currentLine = _stream->readLine();
+        _currentLineNo += 1;
+        if (isRecordEnd(currentLine)) {
+            break;
+        }
+    }
+}
+
+bool GbkReader::parseTopLevel(const QString &prefix, QString value,
+                              GbkHandler *handler)
+{
+    if ("FEATURES" == prefix) {
+        _state = State::Features;
+        _featureStartLineNo = _currentLineNo;
+        return true;
+    }
+    else if ("ORIGIN" == prefix) {
+        _state = State::Origin;
+        return true;
+    }
+    return handler->headerField(prefix, value);
+}
+
+bool GbkReader::parseSecondLevel(const QString &prefix, QString value,
+                                 GbkHandler *handler)
+{
+    if ("ORIGIN" == prefix) {
+        _state = State::Origin;
+        return true;
+    }
+    if (!handler->acceptFeatureKey(prefix)) {
+        return true;
+    }
+    FeatureLocation location;
+    parseRange(value, &location);
+    return handler->feature(prefix, location, parseFeatureAttributes(value),
+                            _featureStartLineNo, _currentLineNo);
+}
+
+void GbkReader::parseRange(const QString &value, FeatureLocation *location)
+{
+    location->start = UINT32_MAX;
+    location->end = 0;
+    bool complement = value.trimmed().startsWith("complement(");
+    bool join =
+            value.trimmed().startsWith("join(") ||
+            value.trimmed().startsWith("complement(join(");
+    int startPos = 0;
+    int endPos = 0;
+    if (!complement && !join) {
+        startPos = 0;
+        endPos = value.indexOf('\n');
+    }
+    else if ((complement && !join) || (!complement && join)) {
+        startPos = value.indexOf('(') + 1;
+        endPos = value.indexOf(")\n");
+    }
+    else if (complement && join) {
+        startPos = value.indexOf("(join(") + 6;
+        endPos = value.indexOf("))\n");
+    }
+
+    const QStringList rangesStrs =
+            value.mid(startPos, endPos-startPos).split(QRegExp(",\\s*"));
+
+    Q_FOREACH(const QString & rangeStr, rangesStrs) {
+        QStringList words = rangeStr.split("..");
+        Q_ASSERT(words.size() == 2 || words.size() == 1);
+        if (1 == words.size()) {
+            words.append(words[0]);
+        }
+        const bool partialLow = words[0].contains('<');
+        const bool partialHigh = words[1].contains('>');
+        words[0].remove(QRegExp("[<>]"));
+        words[1].remove(QRegExp("[<>]"));
+        quint32 st = words[0].toUInt();
+        quint32 en = words[1].toUInt();
+        location->starts.append(st);
+        location->ends.append(en);
+        if (st <= location->start) {
+            location->partialLow = partialLow;
+        }
+        if (en >= location->end) {
+            location->partialHigh = partialHigh;
+        }
+        location->start = qMin(location->start, st);
+        location->end = qMax(location->end, en);
+    }
+    location->backwardChain = complement;
+}
+
+QMap<QString, QString> GbkReader::parseFeatureAttributes(const QString &value)
+{
+    QRegExp rxAttr("/(\\S+)=\\\"(.+)\\\"");
+    QRegExp rxPlain("/([^\\s=]+)=([^\\\"\\s]\\S*)");  // like /transl_table=2
+    QRegExp rxFlags("/([^\\s=]+)");
+    rxAttr.setMinimal(true);
+    QMap<QString,QString> result;
+    int pos = 0;
+    Q_FOREVER {
+        pos = rxAttr.indexIn(value, pos);
+        if (-1 == pos) {
+            break;
+        }
+        else {
+            ++pos;
+        }
+        const QString key = rxAttr.cap(1);
+        QString value = rxAttr.cap(2);
+        value.replace('\n', " ");        
+        result[key] = value.simplified();
+    }
+    pos = 0;
+    Q_FOREVER {
+        pos = rxPlain.indexIn(value, pos);
+        if (-1 == pos) {
+            break;
+        }
+        else {
+            ++pos;
+        }
+        const QString key = rxPlain.cap(1);
+        if (!result.count(key)) {
+            result[key] = rxPlain.cap(2);
+        }
+    }
+    pos = 0;
+    Q_FOREVER {
+        pos = rxFlags.indexIn(value, pos);
+        if (-1 == pos) {
+            break;
+        }
+        else {
+            ++pos;
+        }
+        const QString key = rxFlags.cap(1);
+        if (!result.count(key)) {
+            result[key] = "";
+        }
+    }
+    return result;
+}
+
@@ -0,0 +1,72 @@
+#ifndef GBKREADER_H
+#define GBKREADER_H
+
+#include "structures.h"
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QMap>
+#include <QTextStream>
+
+// Receives parts of GBK record in order of their appearance. Each method
+// might return false to skip the rest of record, but endRecord is called
+// anyway. Nothing is kept by reader between calls, so handler which does
+// not collect data streams through records with constant memory.
+class GbkHandler
+{
+public:
+    virtual ~GbkHandler() {}
+
+    virtual bool startRecord(quint32 lineNo);
+
+    // Top-level fields like LOCUS, DEFINITION, VERSION, and their
+    // subfields like ORGANISM. Continuation lines are joined by '\n'.
+    virtual bool headerField(const QString & name, const QString & value);
+
+    // Features keys not accepted here are neither parsed nor reported
+    virtual bool acceptFeatureKey(const QString & key);
+    virtual bool feature(const QString & key,
+                         const FeatureLocation & location,
+                         const QMap<QString,QString> & qualifiers,
+                         quint32 lineStart, quint32 lineEnd);
+
+    // Upper case bases of one ORIGIN line
+    virtual bool originChunk(const QByteArray & bases);
+
+    virtual void endRecord();
+};
+
+// Splits GBK stream into records and passes their parts to handler.
+// Knows nothing about builder or database, so it might be used alone.
+class GbkReader
+{
+public:
+    virtual ~GbkReader() {}
+
+    void setSource(QIODevice * sourceStream);
+    bool atEnd() const;
+
+    // Reads one record and passes its parts to handler. Returns false if
+    // there are no more records.
+    bool readRecord(GbkHandler * handler);
+
+private:
+    void skipToRecordEnd();
+
+    bool parseTopLevel(const QString & prefix, QString value, GbkHandler * handler);
+    bool parseSecondLevel(const QString & prefix, QString value, GbkHandler * handler);
+
+    void parseRange(const QString & value, FeatureLocation * location);
+    QMap<QString,QString> parseFeatureAttributes(const QString & value);
+
+    enum State {
+        TopLevel, Features, Origin
+    } _state = TopLevel;
+
+    QIODevice * _io = nullptr;
+    QTextStream *_stream = nullptr;
+    quint32 _featureStartLineNo = 0u;
+    quint32 _currentLineNo = 0u;
+};
+
+#endif // GBKREADER_H
@@ -0,0 +1,237 @@
+#include "geneticcode.h"
+
+#include <cstring>
+
+// Bit mask of codons marked by 'mark' in NCBI style 64 letters string
+static constexpr quint64 codonsMask(const char * codons, char mark, int index = 0)
+{
+    return 64 == index
+            ? 0u
+            : (quint64(codons[index] == mark) << index) |
+              codonsMask(codons, mark, index + 1);
+}
+
+static constexpr int codonsLength(const char * codons)
+{
+    return '\0' == *codons ? 0 : 1 + codonsLength(codons + 1);
+}
+
+// Tables as published by NCBI: amino acids and starts strings. Codons which
+// are stops only at the end of CDS in some tables are marked by '*' in
+// starts string.
+#define NCBI_GENETIC_CODE(ID, AMINO_ACIDS, STARTS) \
+    GeneticCode(ID, AMINO_ACIDS, \
+                codonsMask(STARTS, 'M'), \
+                codonsMask(AMINO_ACIDS, '*') | codonsMask(STARTS, '*'))
+
+static constexpr GeneticCode GENETIC_CODES[] = {
+    NCBI_GENETIC_CODE(1,
+        "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "---M---------------M---------------M----------------------------"),
+    NCBI_GENETIC_CODE(2,
+        "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSS**VVVVAAAADDEEGGGG",
+        "--------------------------------MMMM---------------M------------"),
+    NCBI_GENETIC_CODE(3,
+        "FFLLSSSSYY**CCWWTTTTPPPPHHQQRRRRIIMMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "----------------------------------MM----------------------------"),
+    NCBI_GENETIC_CODE(4,
+        "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "--MM---------------M------------MMMM---------------M------------"),
+    NCBI_GENETIC_CODE(5,
+        "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSSSSVVVVAAAADDEEGGGG",
+        "---M----------------------------MMMM---------------M------------"),
+    NCBI_GENETIC_CODE(6,
+        "FFLLSSSSYYQQCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "-----------------------------------M----------------------------"),
+    NCBI_GENETIC_CODE(9,
+        "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNNKSSSSVVVVAAAADDEEGGGG",
+        "-----------------------------------M---------------M------------"),
+    NCBI_GENETIC_CODE(10,
+        "FFLLSSSSYY**CCCWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "-----------------------------------M----------------------------"),
+    NCBI_GENETIC_CODE(11,
+        "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "---M---------------M------------MMMM---------------M------------"),
+    NCBI_GENETIC_CODE(12,
+        "FFLLSSSSYY**CC*WLLLSPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "-------------------M---------------M----------------------------"),
+    NCBI_GENETIC_CODE(13,
+        "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSSGGVVVVAAAADDEEGGGG",
+        "---M------------------------------MM---------------M------------"),
+    NCBI_GENETIC_CODE(14,
+        "FFLLSSSSYYY*CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNNKSSSSVVVVAAAADDEEGGGG",
+        "-----------------------------------M----------------------------"),
+    NCBI_GENETIC_CODE(16,
+        "FFLLSSSSYY*LCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "-----------------------------------M----------------------------"),
+    NCBI_GENETIC_CODE(21,
+        "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNNKSSSSVVVVAAAADDEEGGGG",
+        "-----------------------------------M---------------M------------"),
+    NCBI_GENETIC_CODE(22,
+        "FFLLSS*SYY*LCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "-----------------------------------M----------------------------"),
+    NCBI_GENETIC_CODE(23,
+        "FF*LSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "--------------------------------M--M---------------M------------"),
+    NCBI_GENETIC_CODE(24,
+        "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSSKVVVVAAAADDEEGGGG",
+        "---M---------------M---------------M---------------M------------"),
+    NCBI_GENETIC_CODE(25,
+        "FFLLSSSSYY**CCGWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "---M-------------------------------M---------------M------------"),
+    NCBI_GENETIC_CODE(26,
+        "FFLLSSSSYY**CC*WLLLAPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "-------------------M---------------M----------------------------"),
+    NCBI_GENETIC_CODE(27,
+        "FFLLSSSSYYQQCCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "--------------*--------------------M----------------------------"),
+    NCBI_GENETIC_CODE(28,
+        "FFLLSSSSYYQQCCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "----------**--*--------------------M----------------------------"),
+    NCBI_GENETIC_CODE(29,
+        "FFLLSSSSYYYYCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "-----------------------------------M----------------------------"),
+    NCBI_GENETIC_CODE(30,
+        "FFLLSSSSYYEECC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "-----------------------------------M----------------------------"),
+    NCBI_GENETIC_CODE(31,
+        "FFLLSSSSYYEECCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "----------**-----------------------M----------------------------"),
+    NCBI_GENETIC_CODE(32,
+        "FFLLSSSSYY*WCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG",
+        "---M---------------M------------MMMM---------------M------------"),
+    NCBI_GENETIC_CODE(33,
+        "FFLLSSSSYYY*CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSSKVVVVAAAADDEEGGGG",
+        "---M---------------M---------------M---------------M------------"),
+};
+
+#undef NCBI_GENETIC_CODE
+
+static const int GENETIC_CODES_COUNT =
+        sizeof(GENETIC_CODES) / sizeof(GENETIC_CODES[0]);
+
+static_assert(codonsLength(
+                  "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG") == 64,
+              "NCBI tables are 64 codons long");
+static_assert(codonsMask(
+                  "---M---------------M---------------M----------------------------", 'M')
+              == ((quint64(1) << 3) | (quint64(1) << 19) | (quint64(1) << 35)),
+              "Standard code starts are TTG, CTG and ATG");
+
+static inline int baseIndex(char base)
+{
+    switch (base) {
+    case 'T': case 't': case 'U': case 'u': return 0;
+    case 'C': case 'c': return 1;
+    case 'A': case 'a': return 2;
+    case 'G': case 'g': return 3;
+    default: return -1;
+    }
+}
+
+// 2-bit codes of bases in TCAG order, other letters are marked by 4
+struct BaseCodes {
+    quint8 codes[256];
+
+    BaseCodes()
+    {
+        std::memset(codes, 4, sizeof(codes));
+        codes[quint8('T')] = codes[quint8('t')] = 0;
+        codes[quint8('U')] = codes[quint8('u')] = 0;
+        codes[quint8('C')] = codes[quint8('c')] = 1;
+        codes[quint8('A')] = codes[quint8('a')] = 2;
+        codes[quint8('G')] = codes[quint8('g')] = 3;
+    }
+};
+
+const GeneticCode *GeneticCode::byId(quint32 id)
+{
+    for (int i = 0; i < GENETIC_CODES_COUNT; ++i) {
+        if (GENETIC_CODES[i].id() == id) {
+            return &GENETIC_CODES[i];
+        }
+    }
+    return nullptr;
+}
+
+int GeneticCode::codonIndex(const char *codon)
+{
+    const int first = baseIndex(codon[0]);
+    const int second = baseIndex(codon[1]);
+    const int third = baseIndex(codon[2]);
+    if (first < 0 || second < 0 || third < 0) {
+        return -1;
+    }
+    return (first << 4) | (second << 2) | third;
+}
+
+int GeneticCode::codonIndex(const QByteArray &codon)
+{
+    return codon.size() < 3 ? -1 : codonIndex(codon.constData());
+}
+
+QByteArray GeneticCode::codon(int codonIndex)
+{
+    static const char BASES[] = "TCAG";
+    QByteArray result(3, 'N');
+    if (codonIndex >= 0 && codonIndex < CodonsCount) {
+        result[0] = BASES[(codonIndex >> 4) & 3];
+        result[1] = BASES[(codonIndex >> 2) & 3];
+        result[2] = BASES[codonIndex & 3];
+    }
+    return result;
+}
+
+void GeneticCode::countCodons(const QByteArray &codingSequence, int frame,
+                              quint32 *counts)
+{
+    static const BaseCodes baseCodes;
+    const int codonsCount = (codingSequence.size() - frame) / 3;
+    if (frame < 0 || codonsCount <= 0) {
+        return;
+    }
+    const uchar * bases =
+            reinterpret_cast<const uchar*>(codingSequence.constData()) + frame;
+    const quint8 * codes = baseCodes.codes;
+
+    // Unknown codons go to extra slot, so loop has no branches
+    quint32 local[CodonsCount + 1] = { 0 };
+    for (int i = 0; i < codonsCount; ++i) {
+        const quint8 first = codes[bases[3 * i]];
+        const quint8 second = codes[bases[3 * i + 1]];
+        const quint8 third = codes[bases[3 * i + 2]];
+        const quint8 index =
+                ((first & 3u) << 4) | ((second & 3u) << 2) | (third & 3u);
+        const bool unknown = (first | second | third) & 4u;
+        local[unknown ? CodonsCount : index] ++;
+    }
+    for (int i = 0; i < CodonsCount; ++i) {
+        counts[i] += local[i];
+    }
+}
+
+QByteArray GeneticCode::translate(const QByteArray &codingSequence, int frame) const
+{
+    static const BaseCodes baseCodes;
+    const int codonsCount = (codingSequence.size() - frame) / 3;
+    if (frame < 0 || codonsCount <= 0) {
+        return QByteArray();
+    }
+    const uchar * bases =
+            reinterpret_cast<const uchar*>(codingSequence.constData()) + frame;
+    const quint8 * codes = baseCodes.codes;
+    QByteArray result(codonsCount, 'X');
+    char * residues = result.data();
+
+    // No branches inside, so compiler is free to vectorize this loop
+    for (int i = 0; i < codonsCount; ++i) {
+        const quint8 first = codes[bases[3 * i]];
+        const quint8 second = codes[bases[3 * i + 1]];
+        const quint8 third = codes[bases[3 * i + 2]];
+        const quint8 index =
+                ((first & 3u) << 4) | ((second & 3u) << 2) | (third & 3u);
+        const bool unknown = (first | second | third) & 4u;
+        residues[i] = unknown ? 'X' : _aminoAcids[index];
+    }
+    return result;
+}
@@ -0,0 +1,71 @@
+#ifndef GENETICCODE_H
+#define GENETICCODE_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+// NCBI genetic code (translation table). Codons are encoded as 6-bit
+// indices in TCAG order, the same order as NCBI tables use, so start and
+// stop checks are bit tests and translation is a table lookup.
+class GeneticCode
+{
+public:
+    static const quint32 Standard = 1;
+
+    // Null if there is no such table
+    static const GeneticCode * byId(quint32 id);
+
+    // Index of first three bases, or -1 if any of them is not a nucleotide
+    static int codonIndex(const char * codon);
+    static int codonIndex(const QByteArray & codon);
+
+    static const int CodonsCount = 64;
+
+    // Bases of codon by its index, DNA letters
+    static QByteArray codon(int codonIndex);
+
+    // Adds occurrences of each codon of coding sequence, starting from
+    // 'frame' base, to 'counts' of CodonsCount entries. Codons with
+    // unknown bases are not counted.
+    static void countCodons(const QByteArray & codingSequence, int frame,
+                            quint32 * counts);
+
+    constexpr GeneticCode(quint32 id, const char * aminoAcids,
+                          quint64 starts, quint64 stops)
+        : _id(id)
+        , _aminoAcids(aminoAcids)
+        , _starts(starts)
+        , _stops(stops)
+    {
+    }
+
+    quint32 id() const { return _id; }
+
+    bool isStart(int codonIndex) const
+    {
+        return codonIndex >= 0 && ((_starts >> codonIndex) & 1u);
+    }
+
+    bool isStop(int codonIndex) const
+    {
+        return codonIndex >= 0 && ((_stops >> codonIndex) & 1u);
+    }
+
+    // One-letter amino acid, '*' for stop or 'X' for unknown codon
+    char aminoAcid(int codonIndex) const
+    {
+        return codonIndex >= 0 ? _aminoAcids[codonIndex] : 'X';
+    }
+
+    // Translates coding sequence starting from 'frame' base (0, 1 or 2).
+    // Incomplete last codon is dropped, stops are kept as '*'.
+    QByteArray translate(const QByteArray & codingSequence, int frame = 0) const;
+
+private:
+    quint32         _id;
+    const char *    _aminoAcids;
+    quint64         _starts;
+    quint64         _stops;
+};
+
+#endif // GENETICCODE_H
@@ -0,0 +1,444 @@
+#include "gffparser.h"
+
+#include "fastaindex.h"
+#include "structures.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QPair>
+#include <QVector>
+
+#include <algorithm>
+
+bool GffParser::isGffFileName(const QString &fileName)
+{
+    QString name = fileName.toLower();
+    if (name.endsWith(".gz")) {
+        name.chop(3);
+    }
+    return name.endsWith(".gff") || name.endsWith(".gff3");
+}
+
+QString GffParser::fastaFileNameFor(const QString &gffFileName)
+{
+    // NCBI assemblies are published as NAME.gff and NAME.fna
+    QString base = gffFileName;
+    if (base.endsWith(".gz")) {
+        base.chop(3);
+    }
+    const int dot = base.lastIndexOf('.');
+    if (dot > 0) {
+        base.truncate(dot);
+    }
+    static const char * extensions[] = { ".fna", ".fa", ".fasta" };
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i) {
+        const QString candidate = base + extensions[i];
+        if (QFile(candidate).exists()) {
+            return candidate;
+        }
+    }
+    return base + extensions[0];
+}
+
+void GffParser::setFastaFileName(const QString &fastaFileName)
+{
+    _fastaFileName = fastaFileName;
+}
+
+bool GffParser::setSource(QIODevice *sourceStream, const QString &fileName)
+{
+    _io = sourceStream;
+    _stream = new QTextStream(_io);
+    _stream->setCodec("UTF-8");
+    _fileName = QFileInfo(fileName).fileName();
+    _sequenceRegions.clear();
+    _pendingLine.clear();
+    _speciesName.clear();
+    _fastaReached = false;
+
+    if (_builder.coordinatesOnly()) {
+        return true;
+    }
+    const QString fastaFileName = _fastaFileName.isEmpty()
+            ? fastaFileNameFor(fileName)
+            : _fastaFileName;
+    _fasta = QSharedPointer<FastaIndex>(new FastaIndex);
+    if (!_fasta->open(fastaFileName)) {
+        qWarning() << "Can't use FASTA " << fastaFileName << " for " << fileName;
+        _fasta.clear();
+        return false;
+    }
+    _builder.setOriginSource(_fasta);
+    return true;
+}
+
+bool GffParser::atEnd() const
+{
+    return _fastaReached || !_io || !_stream ||
+            (_stream->atEnd() && _pendingLine.isEmpty());
+}
+
+SequencePtr GffParser::readSequence()
+{
+    _builder.startSequence(_fileName);
+    Record record;
+    QString seqId;
+    while (!atEnd()) {
+        QString line;
+        if (!_pendingLine.isEmpty()) {
+            line = _pendingLine;
+            _pendingLine.clear();
+        }
+        else {
+            line = _stream->readLine();
+            _currentLineNo += 1;
+        }
+        if (line.startsWith("##FASTA")) {
+            // Embedded sequences are not supported, indexed FASTA is used
+            _fastaReached = true;
+            break;
+        }
+        if (line.startsWith("##sequence-region")) {
+            const QStringList words = line.simplified().split(' ');
+            if (words.size() == 4) {
+                _sequenceRegions[words[1]] = words[3].toULongLong();
+            }
+            continue;
+        }
+        if (line.startsWith("#!species") || line.startsWith("##species")) {
+            _speciesName = speciesName(line.mid(9).trimmed());
+            continue;
+        }
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        const QStringList columns = line.split('\t');
+        if (columns.size() != 9) {
+            qWarning() << "Malformed line " << _currentLineNo
+                       << " in " << _fileName << ". Skipped!";
+            continue;
+        }
+        if (seqId.isEmpty()) {
+            seqId = columns[0];
+            startRecord(seqId, columns);
+        }
+        else if (seqId != columns[0]) {
+            _pendingLine = line;
+            break;
+        }
+        if (!_builder.rejected()) {
+            parseFeature(columns, &record);
+        }
+    }
+    if (!seqId.isEmpty() && !_builder.rejected()) {
+        buildRecord(&record);
+    }
+    return _builder.finishSequence();
+}
+
+void GffParser::startRecord(const QString &seqId, const QStringList &columns)
+{
+    const bool region = "region" == columns[2];
+    quint64 length = _sequenceRegions.value(seqId, 0);
+    if (0 == length && _fasta) {
+        length = _fasta->length(seqId);
+    }
+    if (0 == length && region) {
+        length = columns[4].toULongLong();
+    }
+
+    // Accession without version, as in LOCUS of GBK files
+    QString refSeqId = seqId;
+    const int dot = seqId.lastIndexOf('.');
+    bool numericVersion = false;
+    if (dot > 0) {
+        seqId.mid(dot + 1).toUInt(&numericVersion);
+    }
+    if (numericVersion) {
+        refSeqId = seqId.left(dot);
+    }
+    if (!_builder.setLocus(refSeqId, length)) {
+        return;
+    }
+    _builder.setVersion(seqId);
+
+    const QMap<QString,QString> attrs = region
+            ? parseAttributes(columns[8])
+            : QMap<QString,QString>();
+
+    QMap<QString,QString> source;
+    QStringList dbXrefs = attrs.value("Dbxref").split(',', QString::SkipEmptyParts);
+    Q_FOREACH(const QString & dbXref, dbXrefs) {
+        if (dbXref.startsWith("taxon:")) {
+            source["db_xref"] = dbXref;
+        }
+    }
+    if (attrs.contains("chromosome")) {
+        source["chromosome"] = attrs["chromosome"];
+    }
+    const QString genome = attrs.value("genome");
+    if (!genome.isEmpty() && "genomic" != genome && "chromosome" != genome) {
+        source["organelle"] = genome;
+    }
+
+    // Taxon reference is not a name, so record without organism name is
+    // skipped by builder unless .ini file gives one
+    const QString organismName = attrs.contains("organism")
+            ? attrs["organism"]
+            : _speciesName;
+    if (!_builder.setOrganism(organismName, QStringList())) {
+        return;
+    }
+    _builder.addSource(source);
+}
+
+void GffParser::parseFeature(const QStringList &columns, Record *record)
+{
+    const QString & type = columns[2];
+    const bool gene = "gene" == type || "pseudogene" == type;
+    const bool transcript = type.endsWith("RNA") || type.endsWith("transcript");
+    const bool exon = "exon" == type;
+    const bool cds = "CDS" == type;
+    if (!gene && !transcript && !exon && !cds) {
+        return;
+    }
+
+    const quint32 start = columns[3].toUInt();
+    const quint32 end = columns[4].toUInt();
+    const bool bw = "-" == columns[6];
+    const QMap<QString,QString> attrs = parseAttributes(columns[8]);
+    const QString id = attrs.value("ID");
+    // Feature might have several parents, the first one is used
+    const QString parent = attrs.value("Parent").section(',', 0, 0);
+
+    if (exon) {
+        // Exons define ranges of their transcript only. GFF3 does not
+        // require parents to go first, so the rest wait for record end.
+        if (record->transcriptIndex.contains(parent)) {
+            Feature & target = record->transcripts[record->transcriptIndex[parent]];
+            target.location.starts.append(start);
+            target.location.ends.append(end);
+        }
+        else {
+            record->pendingExons[parent].append(qMakePair(start, end));
+        }
+        return;
+    }
+
+    if (cds && !id.isEmpty() && record->cdsIndex.contains(id)) {
+        // Next part of already known CDS
+        Feature & target = record->cdses[record->cdsIndex[id]];
+        const bool fivePrime = bw
+                ? end > target.location.end
+                : start < target.location.start;
+        if (fivePrime) {
+            target.phase = columns[7].toUInt();
+        }
+        addRange(&target.location, start, end, bw);
+        target.location.partialLow |= attrs.contains("start_range");
+        target.location.partialHigh |= attrs.contains("end_range");
+        target.lineEnd = _currentLineNo;
+        return;
+    }
+
+    Feature feature;
+    feature.type = type;
+    feature.id = id;
+    feature.parent = parent;
+    feature.attrs = attrs;
+    feature.phase = columns[7].toUInt();  // '.' for non-CDS gives 0
+    feature.lineStart = feature.lineEnd = _currentLineNo;
+    feature.location.start = start;
+    feature.location.end = end;
+    feature.location.backwardChain = bw;
+    feature.location.partialLow = attrs.contains("start_range");
+    feature.location.partialHigh = attrs.contains("end_range");
+
+    if (gene) {
+        record->genes.append(feature);
+    }
+    else if (transcript) {
+        record->transcriptIndex[id] = record->transcripts.size();
+        record->transcripts.append(feature);
+    }
+    else {
+        addRange(&feature.location, start, end, bw);
+        if (!id.isEmpty()) {
+            record->cdsIndex[id] = record->cdses.size();
+        }
+        record->cdses.append(feature);
+    }
+}
+
+void GffParser::buildRecord(Record *record)
+{
+    typedef QPair<quint32,quint32> Range;
+    Q_FOREACH(const QString & parent, record->pendingExons.keys()) {
+        const QList<Range> & ranges = record->pendingExons[parent];
+        if (!record->transcriptIndex.contains(parent)) {
+            qWarning() << ranges.size() << " exons of unknown transcript '"
+                       << parent << "' in " << _fileName << ". Skipped!";
+            continue;
+        }
+        Feature & target = record->transcripts[record->transcriptIndex[parent]];
+        Q_FOREACH(const Range & range, ranges) {
+            target.location.starts.append(range.first);
+            target.location.ends.append(range.second);
+        }
+    }
+
+    QMap<QString, QList<int> > transcriptsOf;
+    QMap<QString, QList<int> > cdsesOf;
+    for (int i = 0; i < record->transcripts.size(); ++i) {
+        Feature & transcript = record->transcripts[i];
+        if (transcript.location.starts.isEmpty()) {
+            // Single exon transcript might be given without exon features
+            transcript.location.starts.append(transcript.location.start);
+            transcript.location.ends.append(transcript.location.end);
+        }
+        sortRanges(&transcript.location);
+        transcriptsOf[transcript.parent].append(i);
+    }
+    for (int i = 0; i < record->cdses.size(); ++i) {
+        Feature & cds = record->cdses[i];
+        sortRanges(&cds.location);
+        cdsesOf[cds.parent].append(i);
+    }
+
+    // Same order as in GBK files: gene, its transcripts, then its CDSes
+    QVector<bool> cdsAdded(record->cdses.size(), false);
+    Q_FOREACH(const Feature & gene, record->genes) {
+        _builder.addGene(gene.location, qualifiers(gene));
+        QList<int> geneCdses = cdsesOf.value(gene.id);
+        Q_FOREACH(int index, transcriptsOf.value(gene.id)) {
+            const Feature & transcript = record->transcripts[index];
+            const QString key = transcript.type.endsWith("RNA")
+                    ? transcript.type
+                    : QString("misc_RNA");
+            _builder.addCdsOrRna(key, transcript.location, qualifiers(transcript),
+                                 transcript.lineStart, transcript.lineEnd);
+            geneCdses.append(cdsesOf.value(transcript.id));
+        }
+        Q_FOREACH(int index, geneCdses) {
+            const Feature & cds = record->cdses[index];
+            _builder.addCdsOrRna("CDS", cds.location, qualifiers(cds),
+                                 cds.lineStart, cds.lineEnd);
+            cdsAdded[index] = true;
+        }
+    }
+
+    // CDSes without known parent are matched by location only,
+    // and most likely become orphaned ones
+    for (int i = 0; i < record->cdses.size(); ++i) {
+        if (!cdsAdded[i]) {
+            const Feature & cds = record->cdses[i];
+            _builder.addCdsOrRna("CDS", cds.location, qualifiers(cds),
+                                 cds.lineStart, cds.lineEnd);
+        }
+    }
+}
+
+void GffParser::addRange(FeatureLocation *location,
+                         quint32 start, quint32 end, bool bw)
+{
+    location->starts.append(start);
+    location->ends.append(end);
+    location->start = qMin(location->start, start);
+    location->end = qMax(location->end, end);
+    location->backwardChain = bw;
+}
+
+void GffParser::sortRanges(FeatureLocation *location)
+{
+    // GBK joins list ranges in ascending order for both chains
+    QList< QPair<quint32,quint32> > ranges;
+    for (int i = 0; i < location->starts.size(); ++i) {
+        ranges.append(qMakePair(location->starts[i], location->ends[i]));
+    }
+    std::sort(ranges.begin(), ranges.end());
+    location->starts.clear();
+    location->ends.clear();
+    for (int i = 0; i < ranges.size(); ++i) {
+        location->starts.append(ranges[i].first);
+        location->ends.append(ranges[i].second);
+    }
+}
+
+QString GffParser::speciesName(const QString &value)
+{
+    // Species is either a name or a taxonomy browser URL, which is useful
+    // only if it has 'name' parameter rather than 'id' one
+    if (!value.contains("://")) {
+        return value;
+    }
+    const QStringList parameters = value.section('?', 1).split('&');
+    Q_FOREACH(const QString & parameter, parameters) {
+        if (parameter.startsWith("name=")) {
+            return QString::fromUtf8(QByteArray::fromPercentEncoding(
+                        parameter.mid(5).toUtf8().replace('+', ' ')));
+        }
+    }
+    return QString();
+}
+
+QMap<QString, QString> GffParser::parseAttributes(const QString &value)
+{
+    QMap<QString,QString> result;
+    const QStringList pairs = value.split(';', QString::SkipEmptyParts);
+    Q_FOREACH(const QString & pair, pairs) {
+        const int eq = pair.indexOf('=');
+        if (eq <= 0) {
+            continue;
+        }
+        const QString key = pair.left(eq).trimmed();
+        const QString attrValue = QString::fromUtf8(
+                    QByteArray::fromPercentEncoding(pair.mid(eq + 1).toUtf8()));
+        result[key] = attrValue;
+    }
+    return result;
+}
+
+QMap<QString, QString> GffParser::qualifiers(const Feature &feature)
+{
+    // Convert GFF3 attributes to GBK qualifiers understood by builder
+    const QMap<QString,QString> & attrs = feature.attrs;
+    QMap<QString,QString> result;
+    if (attrs.contains("gene")) {
+        result["gene"] = attrs["gene"];
+    }
+    else if (feature.type.endsWith("gene") && attrs.contains("Name")) {
+        result["gene"] = attrs["Name"];
+    }
+    if ("pseudogene" == feature.type || "true" == attrs.value("pseudo")) {
+        result["pseudo"] = "";
+    }
+    if (attrs.contains("protein_id")) {
+        result["protein_id"] = attrs["protein_id"];
+    }
+    if (attrs.contains("product")) {
+        result["product"] = attrs["product"];
+    }
+    if (attrs.contains("Note")) {
+        result["note"] = attrs["Note"];
+    }
+    if (attrs.contains("transl_table")) {
+        result["transl_table"] = attrs["transl_table"];
+    }
+    if ("CDS" == feature.type && feature.phase > 0) {
+        // Phase of GFF3 is the number of bases before the first codon
+        result["codon_start"] = QString::number(feature.phase + 1);
+    }
+    const QString dbXref = lastDbXref(attrs);
+    if (!dbXref.isEmpty()) {
+        result["db_xref"] = dbXref;
+    }
+    return result;
+}
+
+QString GffParser::lastDbXref(const QMap<QString, QString> &attrs)
+{
+    // GBK parser keeps the last of repeated db_xref qualifiers
+    const QStringList dbXrefs = attrs.value("Dbxref").split(',', QString::SkipEmptyParts);
+    return dbXrefs.isEmpty() ? QString() : dbXrefs.last();
+}
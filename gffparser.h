@@ -0,0 +1,77 @@
+#ifndef GFFPARSER_H
+#define GFFPARSER_H
+
+#include "sequenceparser.h"
+#include "structures.h"
+
+#include <QIODevice>
+#include <QMap>
+#include <QPair>
+#include <QStringList>
+#include <QTextStream>
+
+class FastaIndex;
+
+// GFF3 annotation parser. Each sequence region (lines with the same seqid)
+// is one record, and its gene, transcript, exon and CDS features are
+// linked by ID and Parent attributes. Bases are read from FASTA file by
+// gene windows, so FASTA file must be indexed by 'samtools faidx'.
+class GffParser
+        : public SequenceParser
+{
+public:
+    static bool isGffFileName(const QString & fileName);
+    static QString fastaFileNameFor(const QString & gffFileName);
+
+    void setFastaFileName(const QString & fastaFileName);
+    bool setSource(QIODevice * sourceStream, const QString &fileName) override;
+    bool atEnd() const override;
+    SequencePtr readSequence() override;
+
+private:
+    struct Feature {
+        QString type;
+        QString id;
+        QString parent;
+        FeatureLocation location;
+        QMap<QString,QString> attrs;
+        quint32 phase = 0;  // of 5'-most CDS part
+        quint32 lineStart = 0;
+        quint32 lineEnd = 0;
+    };
+
+    struct Record {
+        QList<Feature> genes;
+        QList<Feature> transcripts;
+        QList<Feature> cdses;
+        QMap<QString,int> transcriptIndex;
+        QMap<QString,int> cdsIndex;
+        // Exons given before their transcript, by transcript id
+        QMap< QString, QList< QPair<quint32,quint32> > > pendingExons;
+    };
+
+    void startRecord(const QString & seqId, const QStringList & columns);
+    void parseFeature(const QStringList & columns, Record * record);
+    void buildRecord(Record * record);
+
+    static void addRange(FeatureLocation * location,
+                         quint32 start, quint32 end, bool bw);
+    static void sortRanges(FeatureLocation * location);
+    static QString speciesName(const QString & value);
+    static QMap<QString,QString> parseAttributes(const QString & value);
+    static QMap<QString,QString> qualifiers(const Feature & feature);
+    static QString lastDbXref(const QMap<QString,QString> & attrs);
+
+    QIODevice * _io = nullptr;
+    QTextStream * _stream = nullptr;
+    QString _fileName;
+    QString _fastaFileName;
+    QSharedPointer<FastaIndex> _fasta;
+    QMap<QString,quint64> _sequenceRegions;
+    QString _pendingLine;
+    QString _speciesName;  // of species directive
+    quint32 _currentLineNo = 0u;
+    bool _fastaReached = false;
+};
+
+#endif // GFFPARSER_H
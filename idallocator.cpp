@@ -0,0 +1,117 @@
+#include "idallocator.h"
+
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include <limits>
+
+IdAllocator::IdAllocator(const QSqlDatabase &db)
+    : _connectionName(db.connectionName() + "_ids")
+{
+    _db = QSqlDatabase::cloneDatabase(db, _connectionName);
+}
+
+IdAllocator::~IdAllocator()
+{
+    _db.close();
+    _db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(_connectionName);
+}
+
+qint32 IdAllocator::next(const QString &tableName)
+{
+    // Reservation might reopen connection and drop all blocks, so block
+    // is looked up again after it
+    if (_blocks[tableName].next >= _blocks[tableName].end &&
+            !reserve(tableName)) {
+        return 0;
+    }
+    return _blocks[tableName].next++;
+}
+
+QSqlDatabase IdAllocator::connection()
+{
+    // Connection is idle between reservations, so server might have
+    // closed it by wait_timeout
+    if (_db.isOpen() && !QSqlQuery("", _db).exec("DO 1")) {
+        qWarning() << "Connection " << _connectionName
+                   << " is broken, reconnecting";
+        _db.close();
+        // Ids of blocks are given up, as ids of destroyed allocator are
+        _blocks.clear();
+    }
+    if (!_db.isOpen() && !_db.open()) {
+        qWarning() << _db.lastError();
+        qWarning() << _db.lastError().text();
+    }
+    return _db;
+}
+
+bool IdAllocator::reserve(const QString &tableName)
+{
+    if (!connection().isOpen()) {
+        return false;
+    }
+    QSqlQuery query("", _db);
+    if (!_tableCreated) {
+        // Database created by older schema has no table yet
+        if (!query.exec("CREATE TABLE IF NOT EXISTS id_allocators("
+                        "table_name VARCHAR(64) NOT NULL PRIMARY KEY, "
+                        "next_id INT NOT NULL)")) {
+            qWarning() << query.lastError();
+            qWarning() << query.lastError().text();
+            qWarning() << query.lastQuery();
+            qWarning() << "Can't create id_allocators table, see create_database.sql";
+            return false;
+        }
+        _tableCreated = true;
+    }
+    if (0 == _blocks[tableName].end) {
+        // Row of table is created once, by the first allocator using it
+        if (!query.exec("INSERT IGNORE INTO id_allocators(table_name, next_id) "
+                        "SELECT '" + tableName + "', COALESCE(MAX(id), 0) + 1 "
+                        "FROM " + tableName)) {
+            qWarning() << query.lastError();
+            qWarning() << query.lastError().text();
+            qWarning() << query.lastQuery();
+            return false;
+        }
+    }
+    // LAST_INSERT_ID(expr) keeps value for this connection, so the block
+    // is known without locking row for read. Block must end within INT
+    // column, otherwise row is not updated at all.
+    query.prepare("UPDATE id_allocators "
+                  "SET next_id=LAST_INSERT_ID(next_id+:block_size) "
+                  "WHERE table_name=:table_name AND next_id<=:max_start");
+    query.bindValue(":block_size", DefaultBlockSize);
+    query.bindValue(":table_name", tableName);
+    query.bindValue(":max_start", std::numeric_limits<qint32>::max() - DefaultBlockSize);
+    if (!query.exec()) {
+        qWarning() << query.lastError();
+        qWarning() << query.lastError().text();
+        qWarning() << query.lastQuery();
+        return false;
+    }
+    if (1 != query.numRowsAffected()) {
+        qWarning() << "Ids of table " << tableName << " are exhausted or its "
+                   << "id_allocators row is missing";
+        return false;
+    }
+    if (!query.exec("SELECT LAST_INSERT_ID()") || !query.next()) {
+        qWarning() << query.lastError();
+        qWarning() << query.lastError().text();
+        qWarning() << query.lastQuery();
+        return false;
+    }
+    const qint64 end = query.value(0).toLongLong();
+    if (end <= DefaultBlockSize || end > std::numeric_limits<qint32>::max()) {
+        qWarning() << "Id block of table " << tableName << " ending at "
+                   << end << " is out of INT range";
+        return false;
+    }
+    Block & block = _blocks[tableName];
+    block.end = qint32(end);
+    block.next = block.end - DefaultBlockSize;
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef IDALLOCATOR_H
+#define IDALLOCATOR_H
+
+#include <QMap>
+#include <QSqlDatabase>
+#include <QString>
+
+// Gives ids to rows before they are inserted, so rows referencing each
+// other are built at once. Ids are reserved in blocks from id_allocators
+// table by its own autocommit connection, so reservation row is not
+// locked by transaction of loader. The first reservation of table starts
+// after its maximum id, and ids left in blocks of destroyed allocator are
+// never used. Table is created on first use if database has none.
+class IdAllocator
+{
+public:
+    static const qint32 DefaultBlockSize = 10000;
+
+    // Connection parameters are copied from 'db'
+    explicit IdAllocator(const QSqlDatabase & db);
+    ~IdAllocator();
+
+    // Next id of table, or 0 on error
+    qint32 next(const QString & tableName);
+
+    // Autocommit connection of allocator, opened on first use and
+    // reopened if it is broken. Rows which must outlive rollback of loader
+    // transaction are inserted by it too.
+    QSqlDatabase connection();
+
+private:
+    bool reserve(const QString & tableName);
+
+    struct Block {
+        qint32  next = 0;
+        qint32  end = 0;  // not included
+    };
+
+    QString _connectionName;
+    QSqlDatabase _db;
+    QMap<QString, Block> _blocks;
+    bool _tableCreated = false;
+};
+
+#endif // IDALLOCATOR_H
@@ -0,0 +1,512 @@
+#include "intervalindex.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QVector>
+#include <QtEndian>
+
+#include <algorithm>
+
+extern "C" {
+#include <string.h>
+}
+
+static const char INDEX_MAGIC[8] = { 'I', 'D', 'F', 'I', 'N', 'T', 'V', 'L' };
+static const quint32 INDEX_VERSION = 1;
+static const qint64 HEADER_SIZE = 24;
+static const int RECORD_SIZE = 32;
+
+namespace {
+
+struct Record {
+    quint32 start;
+    quint32 end;
+    quint32 maxEnd;
+    quint32 kind;
+    qint32  id;
+    qint32  geneId;
+    qint32  isoformId;
+
+    bool operator<(const Record & other) const
+    {
+        if (start != other.start) return start < other.start;
+        if (end != other.end) return end < other.end;
+        if (kind != other.kind) return kind < other.kind;
+        return id < other.id;
+    }
+
+    bool operator==(const Record & other) const
+    {
+        return start == other.start && end == other.end &&
+                kind == other.kind && id == other.id;
+    }
+};
+
+Record makeRecord(quint32 start, quint32 end, IntervalIndex::Kind kind,
+                  qint32 id, qint32 geneId, qint32 isoformId)
+{
+    Record record;
+    record.start = start;
+    record.end = end;
+    record.maxEnd = end;
+    record.kind = kind;
+    record.id = id;
+    record.geneId = geneId;
+    record.isoformId = isoformId;
+    return record;
+}
+
+// Sets maximum ends of implicit tree nodes over sorted records and
+// returns level of root
+int buildTree(QVector<Record> & records)
+{
+    const qint64 n = records.size();
+    if (n <= 0) {
+        return -1;
+    }
+    qint64 lastIndex = 0;
+    quint32 last = 0;  // maximum end of subtree containing the last record
+    for (qint64 i = 0; i < n; i += 2) {
+        lastIndex = i;
+        last = records[i].maxEnd = records[i].end;
+    }
+    int k = 1;
+    for (; (qint64(1) << k) <= n; ++k) {
+        const qint64 x = qint64(1) << (k - 1);
+        const qint64 first = (x << 1) - 1;
+        const qint64 step = x << 2;
+        for (qint64 i = first; i < n; i += step) {
+            // Right child might be out of range, then its subtree is
+            // the one of the last record
+            const quint32 left = records[i - x].maxEnd;
+            const quint32 right = i + x < n ? records[i + x].maxEnd : last;
+            records[i].maxEnd = qMax(records[i].end, qMax(left, right));
+        }
+        // Move to parent: left child is below it, right child above
+        lastIndex = ((lastIndex >> k) & 1) ? lastIndex - x : lastIndex + x;
+        if (lastIndex < n && records[lastIndex].maxEnd > last) {
+            last = records[lastIndex].maxEnd;
+        }
+    }
+    return k - 1;
+}
+
+void put32(QByteArray * out, quint32 value)
+{
+    uchar buf[4];
+    qToLittleEndian<quint32>(value, buf);
+    out->append(reinterpret_cast<const char*>(buf), 4);
+}
+
+}
+
+QString IntervalIndex::fileNameFor(const QString &indexDir,
+                                   const QString &sequenceVersion)
+{
+    // VERSION line may carry GI number after accession.version
+    const QString accession = sequenceVersion.simplified().section(' ', 0, 0);
+    return QDir(indexDir).absoluteFilePath(accession + ".intervals");
+}
+
+bool IntervalIndex::write(const QString &fileName, SequencePtr seq)
+{
+    QVector<Record> records;
+    Q_FOREACH(GenePtr gene, seq->genes) {
+        records.append(makeRecord(gene->start, gene->end, Gene,
+                                  gene->id, gene->id, 0));
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            const quint32 start = qMin(isoform->cdsStart, isoform->mrnaStart);
+            const quint32 end = qMax(isoform->cdsEnd, isoform->mrnaEnd);
+            if (start <= end) {
+                records.append(makeRecord(start, end, Isoform,
+                                          isoform->id, gene->id, 0));
+            }
+            Q_FOREACH(ExonPtr exon, isoform->exons) {
+                records.append(makeRecord(exon->start, exon->end, Exon,
+                                          exon->id, gene->id, isoform->id));
+            }
+            Q_FOREACH(IntronPtr intron, isoform->introns) {
+                records.append(makeRecord(intron->start, intron->end, Intron,
+                                          intron->id, gene->id, isoform->id));
+            }
+        }
+    }
+    // Features shared by isoforms have the same id, so they are kept once
+    // with gene and isoform of their first copy, like their rows
+    std::stable_sort(records.begin(), records.end());
+    records.erase(std::unique(records.begin(), records.end()), records.end());
+    const int rootLevel = buildTree(records);
+
+    QByteArray out(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    out.reserve(HEADER_SIZE + records.size() * RECORD_SIZE);
+    put32(&out, INDEX_VERSION);
+    put32(&out, quint32(rootLevel));
+    put32(&out, quint32(records.size()));
+    put32(&out, 0);
+    Q_FOREACH(const Record & record, records) {
+        put32(&out, record.start);
+        put32(&out, record.end);
+        put32(&out, record.maxEnd);
+        put32(&out, record.kind);
+        put32(&out, quint32(record.id));
+        put32(&out, quint32(record.geneId));
+        put32(&out, quint32(record.isoformId));
+        put32(&out, 0);
+    }
+
+    QDir::root().mkpath(QFileInfo(fileName).absolutePath());
+    QFile file(fileName + ".tmp");
+    if (!file.open(QIODevice::WriteOnly|QIODevice::Truncate) ||
+            file.write(out) != out.size()) {
+        qWarning() << "Can't write interval index " << fileName;
+        file.close();
+        file.remove();
+        return false;
+    }
+    file.close();
+    QFile::remove(fileName);
+    return file.rename(fileName);
+}
+
+bool IntervalIndex::open(const QString &fileName)
+{
+    _file.setFileName(fileName);
+    if (!_file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Can't open interval index " << fileName;
+        return false;
+    }
+    _size = _file.size();
+    _data = _size >= HEADER_SIZE ? _file.map(0, _size) : nullptr;
+    if (!_data || 0 != memcmp(_data, INDEX_MAGIC, sizeof(INDEX_MAGIC)) ||
+            INDEX_VERSION != qFromLittleEndian<quint32>(_data + 8)) {
+        qWarning() << "Not an interval index or unsupported version: " << fileName;
+        return false;
+    }
+    _rootLevel = qint32(qFromLittleEndian<quint32>(_data + 12));
+    _count = qFromLittleEndian<quint32>(_data + 16);
+    if (HEADER_SIZE + _count * RECORD_SIZE > quint64(_size)) {
+        qWarning() << "Interval index " << fileName << " is damaged";
+        _count = 0;
+        return false;
+    }
+    _records = _data + HEADER_SIZE;
+    return true;
+}
+
+IntervalIndex::Interval IntervalIndex::interval(quint64 index) const
+{
+    const uchar * record = _records + index * RECORD_SIZE;
+    Interval result;
+    result.start = qFromLittleEndian<quint32>(record);
+    result.end = qFromLittleEndian<quint32>(record + 4);
+    result.kind = Kind(qFromLittleEndian<quint32>(record + 12));
+    result.id = qint32(qFromLittleEndian<quint32>(record + 16));
+    result.geneId = qint32(qFromLittleEndian<quint32>(record + 20));
+    result.isoformId = qint32(qFromLittleEndian<quint32>(record + 24));
+    return result;
+}
+
+quint32 IntervalIndex::maxEnd(quint64 index) const
+{
+    return qFromLittleEndian<quint32>(_records + index * RECORD_SIZE + 8);
+}
+
+QList<IntervalIndex::Interval> IntervalIndex::overlapping(quint32 start,
+                                                          quint32 end) const
+{
+    QList<Interval> result;
+    if (_count == 0 || _rootLevel < 0 || start > end) {
+        return result;
+    }
+    const qint64 n = qint64(_count);
+
+    // Top-down traversal; 'leftDone' marks nodes whose left subtree is
+    // already visited, so results come in order of records
+    struct Node {
+        qint64  index;
+        int     level;
+        bool    leftDone;
+    } stack[64];
+    int top = 0;
+    stack[top].index = (qint64(1) << _rootLevel) - 1;
+    stack[top].level = _rootLevel;
+    stack[top++].leftDone = false;
+
+    while (top > 0) {
+        const Node node = stack[--top];
+        if (node.level <= 3) {
+            // Small subtree is scanned linearly
+            const qint64 first = node.index >> node.level << node.level;
+            const qint64 last = qMin(n, first + (qint64(1) << (node.level + 1)) - 1);
+            for (qint64 i = first; i < last; ++i) {
+                const Interval candidate = interval(i);
+                if (candidate.start > end) {
+                    break;
+                }
+                if (start <= candidate.end) {
+                    result.append(candidate);
+                }
+            }
+        }
+        else if (!node.leftDone) {
+            const qint64 left = node.index - (qint64(1) << (node.level - 1));
+            stack[top].index = node.index;
+            stack[top].level = node.level;
+            stack[top++].leftDone = true;
+            // Node out of range has no record, but its left subtree might
+            if (left >= n || maxEnd(left) >= start) {
+                stack[top].index = left;
+                stack[top].level = node.level - 1;
+                stack[top++].leftDone = false;
+            }
+        }
+        else if (node.index < n) {
+            const Interval candidate = interval(node.index);
+            if (candidate.start <= end) {
+                if (start <= candidate.end) {
+                    result.append(candidate);
+                }
+                stack[top].index = node.index + (qint64(1) << (node.level - 1));
+                stack[top].level = node.level - 1;
+                stack[top++].leftDone = false;
+            }
+        }
+    }
+    return result;
+}
+
+QList<IntervalIndex::Interval> IntervalIndex::nearest(quint32 position) const
+{
+    // Window grows twice until it reaches something: every interval at
+    // distance not greater than radius overlaps window, so the nearest
+    // ones are among found ones
+    for (quint64 radius = 1; radius <= quint64(UINT32_MAX) * 2; radius *= 2) {
+        const quint32 start = quint32(qMax<qint64>(1, qint64(position) - qint64(radius)));
+        const quint32 end = quint32(qMin<quint64>(UINT32_MAX, quint64(position) + radius));
+        const QList<Interval> found = overlapping(start, end);
+        if (found.isEmpty()) {
+            continue;
+        }
+        quint32 best = UINT32_MAX;
+        QList<Interval> result;
+        Q_FOREACH(const Interval & candidate, found) {
+            const quint32 distance = candidate.end < position
+                    ? position - candidate.end
+                    : candidate.start > position
+                      ? candidate.start - position
+                      : 0u;
+            if (distance < best) {
+                best = distance;
+                result.clear();
+            }
+            if (distance == best) {
+                result.append(candidate);
+            }
+        }
+        return result;
+    }
+    return QList<Interval>();
+}
+
+namespace {
+
+typedef IntervalIndex::Interval Interval;
+
+bool lessInterval(const Interval & a, const Interval & b)
+{
+    if (a.start != b.start) return a.start < b.start;
+    if (a.end != b.end) return a.end < b.end;
+    if (a.kind != b.kind) return a.kind < b.kind;
+    return a.id < b.id;
+}
+
+bool sameIntervals(QList<Interval> a, QList<Interval> b)
+{
+    std::sort(a.begin(), a.end(), lessInterval);
+    std::sort(b.begin(), b.end(), lessInterval);
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (int i = 0; i < a.size(); ++i) {
+        if (a[i].start != b[i].start || a[i].end != b[i].end ||
+                a[i].kind != b[i].kind || a[i].id != b[i].id ||
+                a[i].geneId != b[i].geneId || a[i].isoformId != b[i].isoformId) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Interval makeInterval(quint32 start, quint32 end, IntervalIndex::Kind kind,
+                      qint32 id, qint32 geneId, qint32 isoformId)
+{
+    Interval result;
+    result.start = start;
+    result.end = end;
+    result.kind = kind;
+    result.id = id;
+    result.geneId = geneId;
+    result.isoformId = isoformId;
+    return result;
+}
+
+// Genes only, so sequence has exactly 'count' intervals
+SequencePtr randomGenes(int count, quint32 length, QList<Interval> * intervals)
+{
+    SequencePtr seq(new Sequence);
+    for (int i = 0; i < count; ++i) {
+        GenePtr gene(new Gene);
+        gene->id = i + 1;
+        gene->start = 1 + quint32(qrand()) % length;
+        gene->end = gene->start + quint32(qrand()) % (1 + length / 10);
+        seq->genes.append(gene);
+        intervals->append(makeInterval(gene->start, gene->end, IntervalIndex::Gene,
+                                       gene->id, gene->id, 0));
+    }
+    return seq;
+}
+
+// Genes of isoforms, which share exons and introns by ids as stored
+// with deduplication
+SequencePtr randomFeatures(int genesCount, QList<Interval> * intervals)
+{
+    SequencePtr seq(new Sequence);
+    qint32 nextId = 1;
+    QSet<qint32> seen;
+    for (int g = 0; g < genesCount; ++g) {
+        GenePtr gene(new Gene);
+        gene->id = nextId++;
+        gene->start = 1 + quint32(qrand()) % 100000;
+        seq->genes.append(gene);
+        QList<ExonPtr> sharedExons;
+        QList<IntronPtr> sharedIntrons;
+        quint32 position = gene->start;
+        for (int e = 0; e < 1 + qrand() % 6; ++e) {
+            ExonPtr exon(new Exon);
+            exon->id = nextId++;
+            exon->start = position;
+            exon->end = position + quint32(qrand()) % 300;
+            sharedExons.append(exon);
+            IntronPtr intron(new Intron);
+            intron->id = nextId++;
+            intron->start = exon->end + 1;
+            intron->end = intron->start + quint32(qrand()) % 1000;
+            sharedIntrons.append(intron);
+            position = intron->end + 1;
+        }
+        sharedIntrons.removeLast();
+        gene->end = sharedExons.last()->end;
+        intervals->append(makeInterval(gene->start, gene->end, IntervalIndex::Gene,
+                                       gene->id, gene->id, 0));
+        for (int i = 0; i < 1 + qrand() % 3; ++i) {
+            IsoformPtr isoform(new Isoform);
+            isoform->id = nextId++;
+            isoform->mrnaStart = gene->start;
+            isoform->mrnaEnd = gene->end;
+            isoform->exons = sharedExons;
+            isoform->introns = sharedIntrons;
+            gene->isoforms.append(isoform);
+            intervals->append(makeInterval(gene->start, gene->end, IntervalIndex::Isoform,
+                                           isoform->id, gene->id, 0));
+            // Shared features keep gene and isoform of their first copy
+            Q_FOREACH(ExonPtr exon, sharedExons) {
+                if (!seen.contains(exon->id)) {
+                    seen.insert(exon->id);
+                    intervals->append(makeInterval(exon->start, exon->end, IntervalIndex::Exon,
+                                                   exon->id, gene->id, isoform->id));
+                }
+            }
+            Q_FOREACH(IntronPtr intron, sharedIntrons) {
+                if (!seen.contains(intron->id)) {
+                    seen.insert(intron->id);
+                    intervals->append(makeInterval(intron->start, intron->end, IntervalIndex::Intron,
+                                                   intron->id, gene->id, isoform->id));
+                }
+            }
+        }
+    }
+    return seq;
+}
+
+bool checkIndex(const QString & fileName, SequencePtr seq,
+                const QList<Interval> & intervals, quint32 length)
+{
+    IntervalIndex index;
+    bool ok = IntervalIndex::write(fileName, seq) && index.open(fileName);
+    for (int i = 0; i < 300 && ok; ++i) {
+        const quint32 start = 1 + quint32(qrand()) % length;
+        const quint32 end = start + quint32(qrand()) % (1 + length / (1 + qrand() % 100));
+        QList<Interval> wanted;
+        Q_FOREACH(const Interval & interval, intervals) {
+            if (interval.start <= end && start <= interval.end) {
+                wanted.append(interval);
+            }
+        }
+        const QList<Interval> got = index.overlapping(start, end);
+        bool ordered = true;
+        for (int j = 1; j < got.size(); ++j) {
+            ordered = ordered && !lessInterval(got[j], got[j - 1]);
+        }
+        if (!ordered || !sameIntervals(got, wanted)) {
+            qWarning() << "Interval index check failed for overlap of "
+                       << start << "-" << end << " among "
+                       << intervals.size() << " intervals";
+            ok = false;
+        }
+    }
+    for (int i = 0; i < 300 && ok; ++i) {
+        const quint32 position = 1 + quint32(qrand()) % length;
+        quint32 best = UINT32_MAX;
+        QList<Interval> wanted;
+        Q_FOREACH(const Interval & interval, intervals) {
+            const quint32 distance = interval.end < position
+                    ? position - interval.end
+                    : interval.start > position ? interval.start - position : 0u;
+            if (distance < best) {
+                best = distance;
+                wanted.clear();
+            }
+            if (distance == best) {
+                wanted.append(interval);
+            }
+        }
+        if (!sameIntervals(index.nearest(position), wanted)) {
+            qWarning() << "Interval index check failed for nearest to "
+                       << position << " among " << intervals.size() << " intervals";
+            ok = false;
+        }
+    }
+    QFile::remove(fileName);
+    return ok;
+}
+
+}
+
+bool IntervalIndex::selfCheck(const QString &dir)
+{
+    qsrand(1);
+    const QString fileName = QDir(dir).absoluteFilePath("check.intervals");
+    bool ok = true;
+    // Sizes around powers of two, where implicit tree is incomplete
+    static const int COUNTS[] = { 0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 100, 1023, 1024, 1025, 5000 };
+    for (size_t i = 0; i < sizeof(COUNTS) / sizeof(COUNTS[0]); ++i) {
+        QList<Interval> intervals;
+        const quint32 length = 1000 + COUNTS[i] * 10;
+        SequencePtr seq = randomGenes(COUNTS[i], length, &intervals);
+        ok = checkIndex(fileName, seq, intervals, length) && ok;
+    }
+    QList<Interval> intervals;
+    SequencePtr seq = randomFeatures(200, &intervals);
+    ok = checkIndex(fileName, seq, intervals, 110000) && ok;
+    return ok;
+}
+
+IntervalIndex::~IntervalIndex()
+{
+    if (_data) {
+        _file.unmap(_data);
+    }
+    _file.close();
+}
@@ -0,0 +1,68 @@
+#ifndef INTERVALINDEX_H
+#define INTERVALINDEX_H
+
+#include "structures.h"
+
+#include <QFile>
+#include <QList>
+#include <QString>
+
+// Coordinate index of genes, isoforms, exons and introns of one sequence.
+// Index file is a header followed by fixed width records sorted by start,
+// which form implicit augmented interval tree: record at index with k
+// lowest bits set (and bit k clear) is a node of level k, and every node
+// keeps the maximum end of its subtree. So overlap queries go through a
+// memory map with no tree building and no pointers.
+class IntervalIndex
+{
+public:
+    enum Kind {
+        Gene = 0, Isoform = 1, Exon = 2, Intron = 3
+    };
+
+    struct Interval {
+        quint32     start = 0;  // 1-based, both ends included
+        quint32     end = 0;
+        Kind        kind = Gene;
+        qint32      id = 0;  // database id
+        qint32      geneId = 0;
+        qint32      isoformId = 0;  // 0 for genes and isoforms
+    };
+
+    // Named by accession.version, the first word of VERSION line, so
+    // files written and looked up by either form are the same
+    static QString fileNameFor(const QString & indexDir,
+                               const QString & sequenceVersion);
+
+    // Sequence must be already stored, so its features have ids
+    static bool write(const QString & fileName, SequencePtr seq);
+
+    bool open(const QString & fileName);
+
+    // Intervals which have at least one common base with [start, end],
+    // ordered by start
+    QList<Interval> overlapping(quint32 start, quint32 end) const;
+
+    // Intervals at the smallest distance from position, which is zero for
+    // intervals containing it
+    QList<Interval> nearest(quint32 position) const;
+
+    // Writes indexes of random features into 'dir' and compares queries
+    // with brute force scan of their intervals
+    static bool selfCheck(const QString & dir);
+
+    ~IntervalIndex();
+
+private:
+    Interval interval(quint64 index) const;
+    quint32 maxEnd(quint64 index) const;
+
+    QFile _file;
+    uchar * _data = nullptr;
+    qint64 _size = 0;
+    quint64 _count = 0;
+    int _rootLevel = -1;
+    const uchar * _records = nullptr;
+};
+
+#endif // INTERVALINDEX_H
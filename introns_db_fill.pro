@@ -19,19 +19,56 @@ TEMPLATE = app
 
 
 SOURCES += main.cpp \
+    aggregates.cpp \
+    batchinserter.cpp \
+    bulkloader.cpp \
+    catalog.cpp \
+    composition.cpp \
+    fastaindex.cpp \
+    filesegment.cpp \
     gbkparser.cpp \
+    gbkreader.cpp \
+    geneticcode.cpp \
+    gffparser.cpp \
     database.cpp \
     gzipreader.cpp \
+    idallocator.cpp \
     iniparser.cpp \
-    logger.cpp
+    intervalindex.cpp \
+    junctionindex.cpp \
+    logger.cpp \
+    recordfilter.cpp \
+    sequencebuilder.cpp \
+    sequencecache.cpp \
+    sequencequeue.cpp \
+    splicesites.cpp
 
 HEADERS += \
+    aggregates.h \
+    batchinserter.h \
+    bulkloader.h \
+    catalog.h \
+    composition.h \
+    fastaindex.h \
+    filesegment.h \
     gbkparser.h \
+    gbkreader.h \
+    geneticcode.h \
+    gffparser.h \
     structures.h \
     database.h \
     gzipreader.h \
+    idallocator.h \
     iniparser.h \
-    logger.h
+    intervalindex.h \
+    junctionindex.h \
+    logger.h \
+    recordfilter.h \
+    sequencebuilder.h \
+    sequencecache.h \
+    sequencequeue.h \
+    sequenceparser.h \
+    splicesites.h
 
 RESOURCES +=
 
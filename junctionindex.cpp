@@ -0,0 +1,600 @@
+#include "junctionindex.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QMutexLocker>
+#include <QSet>
+#include <QtEndian>
+
+#include <algorithm>
+
+extern "C" {
+#include <string.h>
+}
+
+static const char INDEX_MAGIC[8] = { 'I', 'D', 'F', 'J', 'U', 'N', 'C', 'T' };
+static const quint32 INDEX_VERSION = 1;
+static const qint64 HEADER_SIZE = 40;
+static const int DIRECTORY_ENTRY_SIZE = 16;
+static const int RUN_BUFFER_ENTRIES = 64 * 1024;
+static const int POSTINGS_BUFFER_SIZE = 1024 * 1024;
+
+static const char BASES[] = "ACGT";
+
+static inline int baseCode(char base)
+{
+    switch (base) {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return -1;
+    }
+}
+
+static QByteArray kmerText(quint32 code, int length)
+{
+    QByteArray result(length, 'N');
+    for (int i = length - 1; i >= 0; --i) {
+        result[i] = BASES[code & 3u];
+        code >>= 2;
+    }
+    return result;
+}
+
+static void put32(QByteArray * out, quint32 value)
+{
+    uchar buf[4];
+    qToLittleEndian<quint32>(value, buf);
+    out->append(reinterpret_cast<const char*>(buf), 4);
+}
+
+static void put64(QByteArray * out, quint64 value)
+{
+    uchar buf[8];
+    qToLittleEndian<quint64>(value, buf);
+    out->append(reinterpret_cast<const char*>(buf), 8);
+}
+
+static void putVarint(QByteArray * out, quint32 value)
+{
+    while (value >= 0x80u) {
+        out->append(char(0x80u | (value & 0x7Fu)));
+        value >>= 7;
+    }
+    out->append(char(value));
+}
+
+namespace {
+
+// Sequential reader of sorted run file
+class RunReader
+{
+public:
+    explicit RunReader(const QString & fileName)
+        : _file(fileName)
+    {
+        _file.open(QIODevice::ReadOnly);
+        fill();
+    }
+
+    bool atEnd() const
+    {
+        return _pos >= _buffer.size();
+    }
+
+    quint64 current() const
+    {
+        return _buffer[_pos];
+    }
+
+    void next()
+    {
+        if (++_pos >= _buffer.size()) {
+            fill();
+        }
+    }
+
+private:
+    void fill()
+    {
+        const QByteArray bytes = _file.read(RUN_BUFFER_ENTRIES * 8);
+        const uchar * data = reinterpret_cast<const uchar*>(bytes.constData());
+        _buffer.resize(bytes.size() / 8);
+        for (int i = 0; i < _buffer.size(); ++i) {
+            _buffer[i] = qFromLittleEndian<quint64>(data + 8 * i);
+        }
+        _pos = 0;
+    }
+
+    QFile _file;
+    QVector<quint64> _buffer;
+    int _pos = 0;
+};
+
+}
+
+bool JunctionIndex::open(const QString &fileName)
+{
+    _file.setFileName(fileName);
+    if (!_file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Can't open junction index " << fileName;
+        return false;
+    }
+    _size = _file.size();
+    _data = _size >= HEADER_SIZE ? _file.map(0, _size) : nullptr;
+    if (!_data || 0 != memcmp(_data, INDEX_MAGIC, sizeof(INDEX_MAGIC)) ||
+            INDEX_VERSION != qFromLittleEndian<quint32>(_data + 8)) {
+        qWarning() << "Not a junction index or unsupported version: " << fileName;
+        return false;
+    }
+    _kmerLength = qFromLittleEndian<quint32>(_data + 12);
+    _kmersCount = qFromLittleEndian<quint64>(_data + 16);
+    const quint64 postingsOffset = qFromLittleEndian<quint64>(_data + 24);
+    const quint64 directoryOffset = qFromLittleEndian<quint64>(_data + 32);
+    if (_kmerLength < 1 || _kmerLength > MaxKmerLength ||
+            postingsOffset > directoryOffset ||
+            directoryOffset + _kmersCount * DIRECTORY_ENTRY_SIZE > quint64(_size)) {
+        qWarning() << "Junction index " << fileName << " is damaged";
+        return false;
+    }
+    _postings = _data + postingsOffset;
+    _directory = _data + directoryOffset;
+    return true;
+}
+
+int JunctionIndex::kmerLength() const
+{
+    return _kmerLength;
+}
+
+quint32 JunctionIndex::directoryKmer(quint64 index) const
+{
+    return qFromLittleEndian<quint32>(_directory + index * DIRECTORY_ENTRY_SIZE);
+}
+
+QList<JunctionIndex::Hit> JunctionIndex::lookup(const QByteArray &prefix) const
+{
+    QList<Hit> result;
+    if (!_directory || prefix.isEmpty() || prefix.size() > _kmerLength) {
+        return result;
+    }
+    quint64 code = 0;
+    for (int i = 0; i < prefix.size(); ++i) {
+        const int base = baseCode(prefix[i]);
+        if (base < 0) {
+            return result;
+        }
+        code = (code << 2) | base;
+    }
+    // Prefix covers contiguous range of k-mer codes
+    const int shift = 2 * (_kmerLength - prefix.size());
+    const quint64 low = code << shift;
+    const quint64 high = (code + 1) << shift;
+
+    quint64 first = 0;
+    quint64 count = _kmersCount;
+    while (count > 0) {
+        const quint64 step = count / 2;
+        if (directoryKmer(first + step) < low) {
+            first += step + 1;
+            count -= step + 1;
+        }
+        else {
+            count = step;
+        }
+    }
+
+    for (quint64 index = first;
+         index < _kmersCount && directoryKmer(index) < high; ++index) {
+        const uchar * entry = _directory + index * DIRECTORY_ENTRY_SIZE;
+        const quint32 kmer = qFromLittleEndian<quint32>(entry);
+        const quint32 postingsCount = qFromLittleEndian<quint32>(entry + 4);
+        const uchar * posting = _postings + qFromLittleEndian<quint64>(entry + 8);
+        const QByteArray text = kmerText(kmer, _kmerLength);
+        quint32 value = 0;
+        for (quint32 i = 0; i < postingsCount && posting < _directory; ++i) {
+            quint32 delta = 0;
+            int bits = 0;
+            while (posting < _directory) {
+                const uchar byte = *posting++;
+                delta |= quint32(byte & 0x7Fu) << bits;
+                bits += 7;
+                if (0 == (byte & 0x80u)) {
+                    break;
+                }
+            }
+            value += delta;
+            Hit hit;
+            hit.kmer = text;
+            hit.intronId = value >> 1;
+            hit.acceptor = value & 1u;
+            result.append(hit);
+        }
+    }
+    return result;
+}
+
+namespace {
+
+// Bases with rare unknown ones, which break k-mers
+QByteArray randomBases(int length)
+{
+    static const char ALPHABET[] = "ACGTACGTACGTACGTN";
+    QByteArray result(length, 'A');
+    for (int i = 0; i < length; ++i) {
+        result[i] = ALPHABET[qrand() % (sizeof(ALPHABET) - 1)];
+    }
+    return result;
+}
+
+// One isoform of alternating exons and introns with growing ids, so
+// postings need multi-byte varints
+SequencePtr randomJunctions(int intronsCount, qint32 * nextId)
+{
+    SequencePtr seq(new Sequence);
+    GenePtr gene(new Gene);
+    IsoformPtr isoform(new Isoform);
+    seq->genes.append(gene);
+    gene->isoforms.append(isoform);
+    ExonPtr prevExon(new Exon);
+    prevExon->origin = randomBases(1 + qrand() % 40);
+    isoform->exons.append(prevExon);
+    for (int i = 0; i < intronsCount; ++i) {
+        ExonPtr nextExon(new Exon);
+        nextExon->origin = randomBases(1 + qrand() % 40);
+        IntronPtr intron(new Intron);
+        intron->id = *nextId;
+        *nextId += 1 + qrand() % 100000;
+        intron->origin = randomBases(4 + qrand() % 60);
+        intron->prevExon = prevExon.toWeakRef();
+        intron->nextExon = nextExon.toWeakRef();
+        isoform->introns.append(intron);
+        isoform->exons.append(nextExon);
+        prevExon = nextExon;
+    }
+    return seq;
+}
+
+// Hit as sortable text: k-mer, zero padded id and flank
+QByteArray hitKey(const QByteArray & kmer, quint32 intronId, bool acceptor)
+{
+    return kmer + QByteArray::number(intronId).rightJustified(10, '0') +
+            (acceptor ? "1" : "0");
+}
+
+void addExpected(const QByteArray & flank, int kmerLength, quint32 intronId,
+                 bool acceptor, QSet<QByteArray> * expected)
+{
+    for (int i = 0; i + kmerLength <= flank.size(); ++i) {
+        const QByteArray kmer = flank.mid(i, kmerLength);
+        if (!kmer.contains('N')) {
+            expected->insert(hitKey(kmer, intronId, acceptor));
+        }
+    }
+}
+
+bool checkIndex(const QString & fileName, int kmerLength, int spillEntries,
+                const QList<SequencePtr> & sequences)
+{
+    static const int F = JunctionIndex::FlankLength;
+    bool ok = true;
+    {
+        JunctionIndexWriter writer;
+        writer.setSpillEntries(spillEntries);
+        ok = writer.create(fileName, kmerLength);
+        Q_FOREACH(SequencePtr seq, sequences) {
+            writer.addSequence(seq);
+        }
+        ok = ok && writer.commit();
+    }
+
+    QSet<QByteArray> expected;
+    Q_FOREACH(SequencePtr seq, sequences) {
+        Q_FOREACH(IntronPtr intron, seq->genes.first()->isoforms.first()->introns) {
+            const ExonPtr prevExon = intron->prevExon.toStrongRef();
+            const ExonPtr nextExon = intron->nextExon.toStrongRef();
+            addExpected(prevExon->origin.right(F) + intron->origin.left(F),
+                        kmerLength, intron->id, false, &expected);
+            addExpected(intron->origin.right(F) + nextExon->origin.left(F),
+                        kmerLength, intron->id, true, &expected);
+        }
+    }
+
+    // Prefixes of every length of indexed k-mers, and random ones
+    QSet<QByteArray> prefixes;
+    Q_FOREACH(const QByteArray & key, expected) {
+        for (int length = 1; length <= kmerLength; ++length) {
+            prefixes.insert(key.left(length));
+        }
+    }
+    for (int i = 0; i < 100; ++i) {
+        prefixes.insert(randomBases(1 + qrand() % kmerLength).replace('N', 'A'));
+    }
+
+    JunctionIndex index;
+    ok = ok && index.open(fileName) && index.kmerLength() == kmerLength;
+    Q_FOREACH(const QByteArray & prefix, prefixes) {
+        if (!ok) {
+            break;
+        }
+        QList<QByteArray> wanted;
+        Q_FOREACH(const QByteArray & key, expected) {
+            if (key.startsWith(prefix)) {
+                wanted.append(key);
+            }
+        }
+        std::sort(wanted.begin(), wanted.end());
+        QList<QByteArray> got;
+        Q_FOREACH(const JunctionIndex::Hit & hit, index.lookup(prefix)) {
+            got.append(hitKey(hit.kmer, hit.intronId, hit.acceptor));
+        }
+        if (got != wanted) {
+            qWarning() << "Junction index check failed for prefix " << prefix
+                       << " and k-mer length " << kmerLength << ": "
+                       << got.size() << " hits instead of " << wanted.size();
+            ok = false;
+        }
+    }
+    QFile::remove(fileName);
+    return ok;
+}
+
+}
+
+bool JunctionIndex::selfCheck(const QString &dir)
+{
+    qsrand(1);
+    const QString fileName = QDir(dir).absoluteFilePath("check.junctions");
+    QList<SequencePtr> sequences;
+    qint32 nextId = 1;
+    for (int i = 0; i < 20; ++i) {
+        sequences.append(randomJunctions(1 + qrand() % 20, &nextId));
+    }
+    // The same sequence added twice has its postings written once
+    sequences.append(sequences.first());
+
+    const int spillEntries = JunctionIndexWriter::DefaultSpillEntries;
+    bool ok = checkIndex(fileName, DefaultKmerLength, spillEntries,
+                         QList<SequencePtr>());
+    // Several runs are merged when spill limit is small
+    ok = checkIndex(fileName, DefaultKmerLength, 100, sequences) && ok;
+    ok = checkIndex(fileName, DefaultKmerLength, spillEntries, sequences) && ok;
+    ok = checkIndex(fileName, 1, 7, sequences) && ok;
+    ok = checkIndex(fileName, 3, spillEntries, sequences) && ok;
+    ok = checkIndex(fileName, MaxKmerLength, 50, sequences) && ok;
+    return ok;
+}
+
+JunctionIndex::~JunctionIndex()
+{
+    if (_data) {
+        _file.unmap(_data);
+    }
+    _file.close();
+}
+
+bool JunctionIndexWriter::create(const QString &fileName, int kmerLength)
+{
+    _fileName = fileName;
+    _kmerLength = qBound(1, kmerLength, int(JunctionIndex::MaxKmerLength));
+    QFile file(_fileName + ".tmp");
+    if (!file.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+        qWarning() << "Can't create junction index " << fileName
+                   << ". Index will not be stored!";
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+void JunctionIndexWriter::setSpillEntries(int entries)
+{
+    _spillEntries = qMax(1, entries);
+}
+
+void JunctionIndexWriter::addFlank(const QByteArray &flank, quint32 value,
+                                   QVector<quint64> *entries) const
+{
+    const quint64 mask = (quint64(1) << (2 * _kmerLength)) - 1u;
+    quint64 code = 0;
+    int valid = 0;
+    for (int i = 0; i < flank.size(); ++i) {
+        const int base = baseCode(flank[i]);
+        if (base < 0) {
+            // K-mers with unknown bases are not indexed
+            valid = 0;
+            code = 0;
+            continue;
+        }
+        code = ((code << 2) | base) & mask;
+        if (++valid >= _kmerLength) {
+            entries->append((code << 32) | value);
+        }
+    }
+}
+
+void JunctionIndexWriter::addSequence(SequencePtr seq)
+{
+    static const int F = JunctionIndex::FlankLength;
+    QVector<quint64> entries;
+    Q_FOREACH(GenePtr gene, seq->genes) {
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            Q_FOREACH(IntronPtr intron, isoform->introns) {
+                const ExonPtr prevExon = intron->prevExon.toStrongRef();
+                const ExonPtr nextExon = intron->nextExon.toStrongRef();
+                if (intron->id <= 0 || intron->origin.isEmpty() ||
+                        !prevExon || !nextExon) {
+                    continue;
+                }
+                const quint32 posting = quint32(intron->id) << 1;
+                addFlank(prevExon->origin.right(F) + intron->origin.left(F),
+                         posting, &entries);
+                addFlank(intron->origin.right(F) + nextExon->origin.left(F),
+                         posting | 1u, &entries);
+            }
+        }
+    }
+    if (entries.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker lock(&_mutex);
+    if (_failed) {
+        return;
+    }
+    _entries += entries;
+    if (_entries.size() >= _spillEntries) {
+        _failed = !spill();
+    }
+}
+
+bool JunctionIndexWriter::spill()
+{
+    std::sort(_entries.begin(), _entries.end());
+    _entries.erase(std::unique(_entries.begin(), _entries.end()), _entries.end());
+
+    const QString runFileName =
+            QString("%1.run%2").arg(_fileName).arg(_runFileNames.size());
+    _runFileNames.append(runFileName);
+    QFile run(runFileName);
+    if (!run.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+        qWarning() << "Can't write junction index run " << runFileName
+                   << ". Index will not be stored!";
+        return false;
+    }
+    QByteArray out;
+    out.reserve(RUN_BUFFER_ENTRIES * 8);
+    for (int i = 0; i < _entries.size(); ++i) {
+        put64(&out, _entries[i]);
+        if (out.size() >= RUN_BUFFER_ENTRIES * 8 || i == _entries.size() - 1) {
+            if (run.write(out) != out.size()) {
+                qWarning() << "Can't write junction index run " << runFileName
+                           << ". Index will not be stored!";
+                return false;
+            }
+            out.clear();
+        }
+    }
+    _entries.clear();
+    _entries.squeeze();
+    return true;
+}
+
+bool JunctionIndexWriter::commit()
+{
+    QMutexLocker lock(&_mutex);
+    if (_fileName.isEmpty() || _failed || !spill()) {
+        removeRuns();
+        return false;
+    }
+
+    QFile out(_fileName + ".tmp");
+    if (!out.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+        qWarning() << "Can't create junction index " << _fileName;
+        removeRuns();
+        return false;
+    }
+    bool ok = out.write(QByteArray(HEADER_SIZE, '\0')) == HEADER_SIZE;
+
+    QList< QSharedPointer<RunReader> > runs;
+    Q_FOREACH(const QString & runFileName, _runFileNames) {
+        runs.append(QSharedPointer<RunReader>(new RunReader(runFileName)));
+    }
+
+    // Runs are merged by k-mer and posting, and postings repeated in
+    // several runs are written once
+    QByteArray postings;
+    QByteArray directory;
+    quint64 postingsSize = 0;
+    bool haveEntry = false;
+    quint64 previousEntry = 0;
+    quint32 kmer = 0;
+    quint32 kmerPostings = 0;
+    quint64 kmerOffset = 0;
+    quint32 previousValue = 0;
+    Q_FOREVER {
+        int best = -1;
+        for (int i = 0; i < runs.size(); ++i) {
+            if (!runs[i]->atEnd() &&
+                    (best < 0 || runs[i]->current() < runs[best]->current())) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        const quint64 entry = runs[best]->current();
+        runs[best]->next();
+        if (haveEntry && entry == previousEntry) {
+            continue;
+        }
+        const quint32 entryKmer = quint32(entry >> 32);
+        const quint32 value = quint32(entry);
+        if (!haveEntry || entryKmer != kmer) {
+            if (haveEntry) {
+                put32(&directory, kmer);
+                put32(&directory, kmerPostings);
+                put64(&directory, kmerOffset);
+            }
+            kmer = entryKmer;
+            kmerPostings = 0;
+            kmerOffset = postingsSize + postings.size();
+            previousValue = 0;
+        }
+        haveEntry = true;
+        previousEntry = entry;
+        putVarint(&postings, value - previousValue);
+        previousValue = value;
+        ++kmerPostings;
+        if (postings.size() >= POSTINGS_BUFFER_SIZE) {
+            ok = ok && out.write(postings) == postings.size();
+            postingsSize += postings.size();
+            postings.clear();
+        }
+    }
+    if (haveEntry) {
+        put32(&directory, kmer);
+        put32(&directory, kmerPostings);
+        put64(&directory, kmerOffset);
+    }
+    postingsSize += postings.size();
+    while (0 != postingsSize % 8) {
+        postings.append('\0');
+        ++postingsSize;
+    }
+    ok = ok && out.write(postings) == postings.size();
+    ok = ok && out.write(directory) == directory.size();
+
+    QByteArray header(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    put32(&header, INDEX_VERSION);
+    put32(&header, _kmerLength);
+    put64(&header, directory.size() / DIRECTORY_ENTRY_SIZE);
+    put64(&header, HEADER_SIZE);
+    put64(&header, HEADER_SIZE + postingsSize);
+    ok = ok && out.seek(0) && out.write(header) == header.size();
+    out.close();
+
+    runs.clear();
+    removeRuns();
+    if (!ok) {
+        qWarning() << "Can't write junction index " << _fileName;
+        out.remove();
+        return false;
+    }
+    QFile::remove(_fileName);
+    return out.rename(_fileName);
+}
+
+void JunctionIndexWriter::removeRuns()
+{
+    Q_FOREACH(const QString & runFileName, _runFileNames) {
+        QFile::remove(runFileName);
+    }
+    _runFileNames.clear();
+}
+
+JunctionIndexWriter::~JunctionIndexWriter()
+{
+    removeRuns();
+}
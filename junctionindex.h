@@ -0,0 +1,94 @@
+#ifndef JUNCTIONINDEX_H
+#define JUNCTIONINDEX_H
+
+#include "structures.h"
+
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Index of k-mers around splice junctions: donor flank is the end of
+// exon and the start of intron, acceptor flank is the end of intron and
+// the start of next exon, both in transcription order.
+//
+// Index file is a header, then postings of all k-mers, then directory of
+// k-mers sorted by their 2-bit codes (A, C, G, T), so k-mer or any its
+// prefix is found through a memory map by binary search. Postings of
+// k-mer are ascending intron ids, shifted left by one bit with acceptor
+// flag in the lowest bit, and stored as varint deltas.
+class JunctionIndex
+{
+public:
+    static const int DefaultKmerLength = 8;
+    static const int MaxKmerLength = 16;
+    static const int FlankLength = 16;  // bases at each side of junction
+
+    struct Hit {
+        QByteArray  kmer;
+        quint32     intronId;
+        bool        acceptor;
+    };
+
+    bool open(const QString & fileName);
+    int kmerLength() const;
+
+    // Hits of all k-mers starting with 'prefix', which is not longer
+    // than k-mer length
+    QList<Hit> lookup(const QByteArray & prefix) const;
+
+    // Writes indexes of random junctions into 'dir' and compares lookups
+    // with brute force scan of their flanks
+    static bool selfCheck(const QString & dir);
+
+    ~JunctionIndex();
+
+private:
+    quint32 directoryKmer(quint64 index) const;
+
+    QFile _file;
+    uchar * _data = nullptr;
+    qint64 _size = 0;
+    int _kmerLength = 0;
+    quint64 _kmersCount = 0;
+    const uchar * _postings = nullptr;
+    const uchar * _directory = nullptr;
+};
+
+// Collects junction k-mers of stored sequences from all workers. Entries
+// above memory limit are sorted and spilled to run files next to index,
+// and runs are merged into index on commit.
+class JunctionIndexWriter
+{
+public:
+    static const int DefaultSpillEntries = 16 * 1024 * 1024;  // 128 MB
+
+    bool create(const QString & fileName, int kmerLength);
+
+    // Number of entries kept in memory before they are spilled to run
+    void setSpillEntries(int entries);
+
+    // Thread-safe. Introns must already have database ids.
+    void addSequence(SequencePtr seq);
+    bool commit();
+
+    ~JunctionIndexWriter();
+
+private:
+    void addFlank(const QByteArray & flank, quint32 value,
+                  QVector<quint64> * entries) const;
+    bool spill();
+    void removeRuns();
+
+    QMutex _mutex;
+    QString _fileName;
+    int _kmerLength = JunctionIndex::DefaultKmerLength;
+    int _spillEntries = DefaultSpillEntries;
+    QVector<quint64> _entries;  // k-mer code in high half, posting in low
+    QStringList _runFileNames;
+    bool _failed = false;
+};
+
+#endif // JUNCTIONINDEX_H
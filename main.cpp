@@ -1,16 +1,38 @@
+#include "aggregates.h"
+#include "catalog.h"
 #include "database.h"
+#include "filesegment.h"
 #include "iniparser.h"
+#include "intervalindex.h"
+#include "junctionindex.h"
 #include "gbkparser.h"
+#include "gffparser.h"
 #include "gzipreader.h"
 #include "logger.h"
+#include "recordfilter.h"
+#include "sequencecache.h"
+#include "sequencequeue.h"
+#include "splicesites.h"
 
 #include <QCoreApplication>
 #include <QDebug>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QPair>
+#include <QRegExp>
 #include <QSemaphore>
 #include <QSharedPointer>
 #include <QString>
+#include <QStringList>
+#include <QTextStream>
 #include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include <algorithm>
+#include <functional>
 
 
 struct Arguments {
@@ -21,13 +43,37 @@ struct Arguments {
 
     QString sequencesDir;  // --seqdir=...
     QString translationsDir;  // --transdir=...
+    QString cacheDir;  // --cache-dir=...
+    bool coordinatesOnly = false;  // --coordinates-only
+    bool deduplicateFeatures = false;  // --deduplicate-features
+    quint32 commitRows = Database::DefaultCommitRows;  // --commit-rows=...
+    qint32 commitLatencyMs = Database::DefaultCommitLatencyMs;  // --commit-latency=...
+    QString bulkLoadDir;  // --bulk-load=...
+    bool stagingTables = false;  // --staging-tables
+    quint16 writerThreads = 0;  // --writer-threads=...
+    qint64 writerQueueBytes = SequenceQueue::DefaultMaxBytes;  // --writer-queue=...
+    qint32 statisticsCheckpointSec = 0;  // --stats-checkpoint=...
 
     quint16 maxThreads = 1;  // --threads=...
+    bool scheduleBySize = false;  // --schedule-by-size
+    qint32 deriveThreads = -1;  // --derive-threads=...
 
     QStringList sourceFileNames;    // positional parameters
     QString extraDataFile;  // --use-data=...
+    QString fastaFileName;  // --fasta=...
+    QString spliceModelFileName;  // --splice-model=...
+    QString junctionIndexFileName;  // --junction-index=...
+    qint32 junctionKmerLength = JunctionIndex::DefaultKmerLength;  // --junction-kmer=...
+    QString junctionLookup;  // --junction-lookup=...
+    QString intervalDir;  // --interval-dir=...
+    QString intervalOverlap;  // --interval-overlap=...
+    QString intervalNearest;  // --interval-nearest=...
+    RecordFilter recordFilter;  // --filter-...=...
 
     QString loggerFileName; // --logfile=...
+
+    bool catalogOnly = false;  // --catalog
+    bool selfCheck = false;  // --self-check
 };
 
 
@@ -57,9 +103,87 @@ Arguments parseArguments()
         else if (arg.startsWith("--threads=")) {
             result.maxThreads = arg.mid(10).toUShort();
         }
+        else if (arg.startsWith("--cache-dir=")) {
+            result.cacheDir = arg.mid(12);
+        }
+        else if ("--schedule-by-size" == arg) {
+            result.scheduleBySize = true;
+        }
+        else if ("--catalog" == arg) {
+            result.catalogOnly = true;
+        }
+        else if (arg.startsWith("--derive-threads=")) {
+            result.deriveThreads = arg.mid(17).toInt();
+        }
+        else if ("--coordinates-only" == arg) {
+            result.coordinatesOnly = true;
+        }
+        else if ("--deduplicate-features" == arg) {
+            result.deduplicateFeatures = true;
+        }
+        else if (arg.startsWith("--commit-rows=")) {
+            result.commitRows = arg.mid(14).toUInt();
+        }
+        else if (arg.startsWith("--commit-latency=")) {
+            result.commitLatencyMs = arg.mid(17).toInt();
+        }
+        else if (arg.startsWith("--bulk-load=")) {
+            result.bulkLoadDir = arg.mid(12);
+        }
+        else if ("--staging-tables" == arg) {
+            result.stagingTables = true;
+        }
+        else if (arg.startsWith("--writer-threads=")) {
+            result.writerThreads = arg.mid(17).toUShort();
+        }
+        else if (arg.startsWith("--writer-queue=")) {
+            result.writerQueueBytes = arg.mid(15).toLongLong() * 1024 * 1024;
+        }
+        else if (arg.startsWith("--stats-checkpoint=")) {
+            result.statisticsCheckpointSec = arg.mid(19).toInt();
+        }
+        else if (arg.startsWith("--filter-accessions=")) {
+            result.recordFilter.setAccessionPrefixes(arg.mid(20).split(','));
+        }
+        else if (arg.startsWith("--filter-chromosomes=")) {
+            result.recordFilter.setChromosomes(arg.mid(21).split(','));
+        }
+        else if (arg.startsWith("--filter-organisms=")) {
+            result.recordFilter.setOrganisms(arg.mid(19).split(','));
+        }
+        else if (arg.startsWith("--filter-min-length=")) {
+            result.recordFilter.setMinLength(arg.mid(20).toUInt());
+        }
         else if (arg.startsWith("--use-data=")) {
             result.extraDataFile = arg.mid(11);
         }
+        else if (arg.startsWith("--splice-model=")) {
+            result.spliceModelFileName = arg.mid(15);
+        }
+        else if (arg.startsWith("--junction-index=")) {
+            result.junctionIndexFileName = arg.mid(17);
+        }
+        else if (arg.startsWith("--junction-kmer=")) {
+            result.junctionKmerLength = arg.mid(16).toInt();
+        }
+        else if (arg.startsWith("--junction-lookup=")) {
+            result.junctionLookup = arg.mid(18).toUpper();
+        }
+        else if ("--self-check" == arg) {
+            result.selfCheck = true;
+        }
+        else if (arg.startsWith("--interval-dir=")) {
+            result.intervalDir = arg.mid(15);
+        }
+        else if (arg.startsWith("--interval-overlap=")) {
+            result.intervalOverlap = arg.mid(19);
+        }
+        else if (arg.startsWith("--interval-nearest=")) {
+            result.intervalNearest = arg.mid(19);
+        }
+        else if (arg.startsWith("--fasta=")) {
+            result.fastaFileName = arg.mid(8);
+        }
         else if (arg.startsWith("--logfile=")) {
             result.loggerFileName = arg.mid(10);
         }
@@ -93,6 +217,93 @@ Arguments parseArguments()
         result.maxThreads = qMin(QThread::idealThreadCount(), result.sourceFileNames.size());
         qWarning() << "Threads count not specified. " << result.maxThreads << " cores will be utilized.";
     }
+    if (result.deriveThreads < 0) {
+        result.deriveThreads = qMax(0, QThread::idealThreadCount() - result.maxThreads);
+    }
+    return result;
+}
+
+
+// Adds committed sequence to run aggregates and indices
+void indexSequence(SequencePtr seq, const Arguments & args,
+                   JunctionIndexWriter * junctionIndex)
+{
+    Aggregates & aggregates = Aggregates::local();
+    const OrganismPtr organism = seq->organism.toStrongRef();
+    if (organism) {
+        Q_FOREACH(GenePtr gene, seq->genes) {
+            Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+                aggregates.addCodons(organism->id, isoform->codonCounts);
+            }
+        }
+    }
+    aggregates.addIntrons(seq);
+    if (junctionIndex) {
+        junctionIndex->addSequence(seq);
+    }
+    if (!args.intervalDir.isEmpty()) {
+        IntervalIndex::write(
+                    IntervalIndex::fileNameFor(args.intervalDir, seq->version),
+                    seq);
+    }
+}
+
+
+QSharedPointer<Database> openDatabase(const Arguments & args,
+                                      JunctionIndexWriter * junctionIndex)
+{
+    QSharedPointer<Database> db(Database::open(
+                                    args.databaseHost,
+                                    args.databaseUser,
+                                    args.databasePass,
+                                    args.databaseName,
+                                    args.sequencesDir,
+                                    args.translationsDir,
+                                    !args.bulkLoadDir.isEmpty()
+                                    ));
+    if (db) {
+        db->setDeduplicateFeatures(args.deduplicateFeatures);
+        db->setGroupCommit(args.commitRows, args.commitLatencyMs);
+        if (!args.bulkLoadDir.isEmpty()) {
+            db->setBulkLoad(args.bulkLoadDir);
+        }
+        db->setCommitHandler([&args, junctionIndex](SequencePtr seq) {
+            indexSequence(seq, args, junctionIndex);
+        });
+    }
+    return db;
+}
+
+
+// Stores parsed sequence. It is indexed when its transaction is committed.
+void storeSequence(Database * db, SequencePtr seq)
+{
+    db->storeOrigin(seq);
+    db->addSequence(seq);
+}
+
+
+// Whole input file, or byte range of its records when large plain file
+// is split between workers by its catalog
+struct InputPart {
+    int         fileIndex = -1;
+    quint64     start = 0;
+    quint64     end = 0;  // 0 for the whole file
+    QStringList organisms;  // known before reading, empty if not
+};
+
+
+// Supplementary data of input, given for all inputs or found by its name
+QString supplementaryFileName(const Arguments & args, const QString & inputFileName)
+{
+    QString result = args.extraDataFile;
+    if (result.isEmpty()) {
+        result =
+            QFileInfo(inputFileName).absoluteDir()
+            .absoluteFilePath(
+                QFileInfo(inputFileName).baseName() + ".ini"
+                );
+    }
     return result;
 }
 
@@ -101,23 +312,35 @@ class Worker
         : public QThread
 {
 public:
-    explicit Worker(const Arguments & args, int from, int to);
+    explicit Worker(const Arguments & args, QThreadPool * derivationPool,
+                    JunctionIndexWriter * junctionIndex,
+                    SequenceQueue * queue,
+                    const QList<InputPart> & parts);
     void launch();
 private:
     void processOneFile();
+    void catalogOneFile(QIODevice * inputSource, const QString & inputFileName);
     void run() override;
     const Arguments & _args;
+    QThreadPool * _derivationPool;
+    JunctionIndexWriter * _junctionIndex;
+    SequenceQueue * _queue;
     int _index = -1;
-    const int _from;
-    const int _to;
+    InputPart _part;
+    const QList<InputPart> _parts;
     QSemaphore _semaphore;
 };
 
-Worker::Worker(const Arguments &args, int from, int to)
+Worker::Worker(const Arguments &args, QThreadPool *derivationPool,
+               JunctionIndexWriter *junctionIndex,
+               SequenceQueue *queue,
+               const QList<InputPart> &parts)
     : QThread()
     , _args(args)
-    , _from(from)
-    , _to(to)
+    , _derivationPool(derivationPool)
+    , _junctionIndex(junctionIndex)
+    , _queue(queue)
+    , _parts(parts)
 {
 }
 
@@ -125,14 +348,29 @@ void Worker::run()
 {
     qDebug() << "Created thread " << QThread::currentThreadId();
     _semaphore.acquire();
-    for (_index = _from; _index < _to; ++_index) {
+    Q_FOREACH(const InputPart & part, _parts) {
+        _part = part;
+        _index = part.fileIndex;
         const QString &fileName = _args.sourceFileNames.at(_index);
         qDebug() << "Start processing file " << fileName
+                 << " bytes " << part.start << "-" << part.end
                  << " by worker " << QThread::currentThreadId();
         processOneFile();
         qDebug() << "Done processing file " << fileName
                  << " by worker " << QThread::currentThreadId();
+        // Sequences of queue are not stored yet, so writers tell when
+        // input is done
+        if (_queue) {
+            _queue->pushInputEnd(part.organisms);
+        }
+        else if (!_args.catalogOnly) {
+            QSharedPointer<Database> db = openDatabase(_args, _junctionIndex);
+            if (db) {
+                db->inputDone(part.organisms);
+            }
+        }
     }
+    Database::closeConnection();
     qDebug() << "Finished thread " << QThread::currentThreadId();
 }
 
@@ -147,8 +385,14 @@ void Worker::processOneFile()
     QIODevice * inputSource = nullptr;
     QFile * inputFile = new QFile(inputFileName);
     GZipReader * gzipReader = nullptr;
+    FileSegment * segment = nullptr;
 
-    if (inputFileName.endsWith(".gz") && inputFile->open(QIODevice::ReadOnly)) {
+    if (_part.end > 0 && inputFile->open(QIODevice::ReadOnly)) {
+        segment = new FileSegment(inputFile, _part.start, _part.end);
+        segment->open(QIODevice::ReadOnly|QIODevice::Text);
+        inputSource = segment;
+    }
+    else if (inputFileName.endsWith(".gz") && inputFile->open(QIODevice::ReadOnly)) {
         gzipReader = new GZipReader(inputFile);
         gzipReader->open(QIODevice::ReadOnly|QIODevice::Text);
         inputSource = gzipReader;
@@ -160,46 +404,115 @@ void Worker::processOneFile()
         qWarning() << "Can't open file " << inputFileName << ". Skipped!";
     }
 
-    if (inputSource) {
-        QSharedPointer<GbkParser> parser(new GbkParser);
+    const bool gff = GffParser::isGffFileName(inputFileName);
+
+    if (inputSource && _args.catalogOnly && gff) {
+        qWarning() << "Catalog is not supported for GFF file " << inputFileName << ". Skipped!";
+    }
+    else if (inputSource && _args.catalogOnly) {
+        catalogOneFile(inputSource, inputFileName);
+    }
+    else if (inputSource) {
+        QSharedPointer<SequenceParser> parser;
+        if (gff) {
+            GffParser * gffParser = new GffParser;
+            gffParser->setFastaFileName(_args.fastaFileName);
+            parser = QSharedPointer<SequenceParser>(gffParser);
+        }
+        else {
+            parser = QSharedPointer<SequenceParser>(new GbkParser);
+        }
         QSharedPointer<IniParser> supplParser(new IniParser);
-        QSharedPointer<Database> db(Database::open(
-                                        _args.databaseHost,
-                                        _args.databaseUser,
-                                        _args.databasePass,
-                                        _args.databaseName,
-                                        _args.sequencesDir,
-                                        _args.translationsDir
-                                        ));
-        parser->setDatabase(db);
-        parser->setSource(inputSource, inputFileName);
-        QString supplFileName = _args.extraDataFile;
-        if (supplFileName.isEmpty()) {
-            supplFileName =
-                QFileInfo(inputFileName).absoluteDir()
-                .absoluteFilePath(
-                    QFileInfo(inputFileName).baseName() + ".ini"
-                    );
+        QSharedPointer<Database> db = openDatabase(_args, _junctionIndex);
+        SequenceBuilder & builder = parser->builder();
+        builder.setDatabase(db);
+        builder.setDerivationPool(_derivationPool);
+        builder.setCoordinatesOnly(_args.coordinatesOnly);
+        builder.setRecordFilter(_args.recordFilter);
+        const bool sourceOk = parser->setSource(inputSource, inputFileName);
+        if (!sourceOk) {
+            qWarning() << "Can't process file " << inputFileName << ". Skipped!";
         }
+        const QString supplFileName = supplementaryFileName(_args, inputFileName);
         if (!supplFileName.isEmpty() && QFile(supplFileName).exists()) {
             supplParser->setSourceFileName(supplFileName);
             supplParser->setDatabase(db);
-            parser->setOverrideOrganismName(
+            builder.setOverrideOrganismName(
                         supplParser->value("organisms", "name").toString()
                         );
         }
-        while (!parser->atEnd()) {
-            SequencePtr seq = parser->readSequence();
+
+        // Splice sites model of organism takes precedence over run one
+        QString spliceModelFileName = _args.spliceModelFileName;
+        const QString organismSpliceModel =
+                supplParser->value("splice_sites", "model").toString();
+        if (!organismSpliceModel.isEmpty()) {
+            spliceModelFileName =
+                    QFileInfo(supplFileName).absoluteDir()
+                    .absoluteFilePath(organismSpliceModel);
+        }
+        if (!spliceModelFileName.isEmpty()) {
+            QSharedPointer<SpliceSiteModel> spliceModel(new SpliceSiteModel);
+            spliceModel->load(spliceModelFileName);
+            builder.setSpliceSiteModel(spliceModel);
+        }
+
+        SequenceCacheReader cacheReader;
+        SequenceCacheWriter cacheWriter;
+        bool fromCache = false;
+        // Cache is kept for whole files only
+        if (!_args.cacheDir.isEmpty() && 0 == _part.end) {
+            const QString cacheFileName =
+                    SequenceCache::fileNameFor(_args.cacheDir, inputFileName);
+            const QString options = QString("coordinates_only=%1;organism=%2;%3")
+                    .arg(_args.coordinatesOnly)
+                    .arg(supplParser->value("organisms", "name").toString())
+                    .arg(_args.recordFilter.signature());
+            fromCache = cacheReader.open(cacheFileName, inputFileName, options);
+            if (fromCache) {
+                qDebug() << "Using cache " << cacheFileName << " for " << inputFileName;
+                cacheReader.setDatabase(db);
+            }
+            else {
+                cacheWriter.create(cacheFileName, inputFileName, options);
+            }
+        }
+
+        while (sourceOk && (fromCache ? !cacheReader.atEnd() : !parser->atEnd())) {
+            SequencePtr seq;
+            if (fromCache) {
+                seq = cacheReader.readSequence();
+                if (seq && !seq->coordinatesOnly) {
+                    builder.fillIntronsAndExonsFromOrigin(seq);
+                }
+            }
+            else {
+                seq = parser->readSequence();
+                if (seq) {
+                    cacheWriter.write(seq);
+                }
+            }
             if (!seq) {
                 continue;
             }
             supplParser->updateOrganism(seq->organism);
             supplParser->updateOrganismTaxonomy(seq->organism);
-            db->storeOrigin(seq);
-            db->addSequence(seq);
-            if (seq->organism) {
-                db->updateOrganism(seq->organism);
+            if (_queue) {
+                _queue->push(seq);
+            }
+            else {
+                storeSequence(db.data(), seq);
+            }
+        }
+        if (sourceOk && !fromCache) {
+            cacheWriter.commit();
+        }
+        if (db) {
+            if (!db->commit()) {
+                qWarning() << "Last sequences of file " << inputFileName
+                           << " are not stored!";
             }
+            db->flushStatisticsIfDue();
         }
     }
 
@@ -207,31 +520,405 @@ void Worker::processOneFile()
         gzipReader->close();
         delete gzipReader;
     }
+    if (segment) {
+        segment->close();
+        delete segment;
+    }
     if (inputFile) {
         inputFile->close();
         delete inputFile;
     }
 }
 
+void Worker::catalogOneFile(QIODevice *inputSource, const QString &inputFileName)
+{
+    Catalog catalog;
+    if (!catalog.scan(inputSource)) {
+        qWarning() << "No records found in " << inputFileName;
+    }
+    catalog.save(Catalog::fileNameFor(inputFileName));
+}
 
-int main(int argc, char *argv[])
+
+class Writer
+        : public QThread
 {
-    QCoreApplication a(argc, argv);
+public:
+    explicit Writer(const Arguments & args, SequenceQueue * queue,
+                    JunctionIndexWriter * junctionIndex);
+private:
+    void run() override;
+    const Arguments & _args;
+    SequenceQueue * _queue;
+    JunctionIndexWriter * _junctionIndex;
+};
 
-    const Arguments args = parseArguments();
-    Logger::init(args.loggerFileName);
+Writer::Writer(const Arguments &args, SequenceQueue *queue,
+               JunctionIndexWriter *junctionIndex)
+    : QThread()
+    , _args(args)
+    , _queue(queue)
+    , _junctionIndex(junctionIndex)
+{
+}
 
-    const quint32 filesPerWorker = args.sourceFileNames.size() / args.maxThreads;
+void Writer::run()
+{
+    qDebug() << "Created writer " << QThread::currentThreadId();
+    // Connection of writer is kept for the whole run
+    QSharedPointer<Database> db = openDatabase(_args, _junctionIndex);
+    if (!db) {
+        qWarning() << "Can't connect database by writer "
+                   << QThread::currentThreadId() << ". Its sequences are skipped!";
+    }
+    const unsigned long idleMs = qMax(1, _args.commitLatencyMs);
+    while (!_queue->isFinished()) {
+        bool atInputEnd = false;
+        SequencePtr seq = _queue->pop(idleMs, &atInputEnd);
+        if (atInputEnd) {
+            // Sequences of input taken by this writer are committed before
+            // it passes end of input, so the last one sees all of them
+            if (db) {
+                db->commit();
+            }
+            QStringList organisms;
+            if (_queue->passInputEnd(&organisms) && db) {
+                db->inputDone(organisms);
+            }
+        }
+        else if (!seq) {
+            // Queue is idle, so written sequences need not wait for more
+            if (db) {
+                db->commit();
+            }
+        }
+        else if (db) {
+            storeSequence(db.data(), seq);
+            db->flushStatisticsIfDue();
+        }
+    }
+    db.clear();
+    Database::closeConnection();
+    qDebug() << "Finished writer " << QThread::currentThreadId();
+}
 
-    QList<Worker*> pool;
 
+QList< QList<InputPart> > scheduleInOrder(const Arguments & args)
+{
+    const int filesPerWorker = args.sourceFileNames.size() / args.maxThreads;
+    QList< QList<InputPart> > result;
     for (quint16 threadNo = 0; threadNo < args.maxThreads; ++threadNo) {
         int start = threadNo * filesPerWorker;
         int end = start + filesPerWorker;
         if (args.maxThreads-1 == threadNo) {
             end = args.sourceFileNames.size();
         }
-        Worker * worker = new Worker(args, start, end);
+        QList<InputPart> parts;
+        for (int index = start; index < end; ++index) {
+            InputPart part;
+            part.fileIndex = index;
+            parts.append(part);
+        }
+        result.append(parts);
+    }
+    return result;
+}
+
+// Splits plain GBK input into parts of records by its catalog, so each
+// part has at least maxPartWeight of records length, except the last one
+static QList< QPair<quint64,InputPart> > splitByRecords(
+        int fileIndex, const QString & fileName, const Catalog & catalog,
+        quint64 maxPartWeight)
+{
+    QList< QPair<quint64,InputPart> > result;
+    const QList<CatalogEntry> & entries = catalog.entries();
+    InputPart part;
+    part.fileIndex = fileIndex;
+    part.start = entries.first().offset;
+    quint64 partWeight = 0;
+    for (int i = 0; i < entries.size(); ++i) {
+        partWeight += entries[i].length;
+        const bool last = entries.size() - 1 == i;
+        if (last || partWeight >= maxPartWeight) {
+            part.end = last
+                    ? quint64(QFileInfo(fileName).size())
+                    : entries[i + 1].offset;
+            result.append(qMakePair(partWeight, part));
+            part.start = part.end;
+            partWeight = 0;
+        }
+    }
+    return result;
+}
+
+// Catalog older than input has stale offsets, so it is not loaded
+static bool loadCatalog(const QString & fileName, Catalog * catalog)
+{
+    const QString catalogFileName = Catalog::fileNameFor(fileName);
+    return QFileInfo(catalogFileName).lastModified() >=
+            QFileInfo(fileName).lastModified() &&
+            catalog->load(catalogFileName);
+}
+
+QList< QList<InputPart> > scheduleBySize(const Arguments & args)
+{
+    // Largest inputs are distributed first, each one to the least loaded
+    // worker. Input size is total records length taken from catalog, or
+    // file size if there is no catalog for input.
+    QList<Catalog> catalogs;
+    QList<quint64> fileWeights;
+    quint64 totalWeight = 0;
+    for (int index = 0; index < args.sourceFileNames.size(); ++index) {
+        const QString & fileName = args.sourceFileNames.at(index);
+        Catalog catalog;
+        const bool hasCatalog = loadCatalog(fileName, &catalog);
+        const quint64 weight = hasCatalog
+                ? catalog.totalLength()
+                : quint64(QFileInfo(fileName).size());
+        catalogs.append(hasCatalog ? catalog : Catalog());
+        fileWeights.append(weight);
+        totalWeight += weight;
+    }
+
+    // Plain GBK input larger than half of worker share is split by its
+    // records, so one huge input does not keep single worker busy.
+    // Compressed inputs can't be read from the middle.
+    const quint64 maxPartWeight =
+            qMax<quint64>(1, totalWeight / (2 * args.maxThreads));
+    QList< QPair<quint64,InputPart> > weights;
+    for (int index = 0; index < args.sourceFileNames.size(); ++index) {
+        const QString & fileName = args.sourceFileNames.at(index);
+        const bool splittable =
+                !args.catalogOnly &&
+                !catalogs[index].entries().isEmpty() &&
+                !fileName.endsWith(".gz") &&
+                !GffParser::isGffFileName(fileName) &&
+                fileWeights[index] > maxPartWeight;
+        const QList< QPair<quint64,InputPart> > parts = splittable
+                ? splitByRecords(index, fileName, catalogs[index], maxPartWeight)
+                : QList< QPair<quint64,InputPart> >();
+        if (parts.size() > 1) {
+            weights += parts;
+        }
+        else {
+            InputPart part;
+            part.fileIndex = index;
+            weights.append(qMakePair(fileWeights[index], part));
+        }
+    }
+    std::stable_sort(weights.begin(), weights.end(),
+                     [](const QPair<quint64,InputPart> & a,
+                        const QPair<quint64,InputPart> & b) {
+                         return a.first > b.first;
+                     });
+
+    QVector<quint64> loads(args.maxThreads, 0);
+    QList< QList<InputPart> > result;
+    for (quint16 threadNo = 0; threadNo < args.maxThreads; ++threadNo) {
+        result.append(QList<InputPart>());
+    }
+    for (int i = 0; i < weights.size(); ++i) {
+        const int threadNo =
+                std::min_element(loads.begin(), loads.end()) - loads.begin();
+        loads[threadNo] += weights[i].first;
+        result[threadNo].append(weights[i].second);
+    }
+    return result;
+}
+
+
+// Organism of input is named by its supplementary data, or its records
+// are listed by catalog. Otherwise it is known only when input is read.
+void findOrganisms(const Arguments & args, QList< QList<InputPart> > * schedule)
+{
+    QMap<int, Catalog> catalogs;
+    for (int threadNo = 0; threadNo < schedule->size(); ++threadNo) {
+        for (int i = 0; i < (*schedule)[threadNo].size(); ++i) {
+            InputPart & part = (*schedule)[threadNo][i];
+            const QString & fileName = args.sourceFileNames.at(part.fileIndex);
+            IniParser supplParser;
+            supplParser.setSourceFileName(supplementaryFileName(args, fileName));
+            const QString name = supplParser.value("organisms", "name").toString();
+            if (!name.isEmpty()) {
+                part.organisms.append(name);
+                continue;
+            }
+            if (!catalogs.contains(part.fileIndex)) {
+                Catalog catalog;
+                loadCatalog(fileName, &catalog);
+                catalogs[part.fileIndex] = catalog;
+            }
+            Q_FOREACH(const CatalogEntry & entry, catalogs[part.fileIndex].entries()) {
+                const bool inPart = 0 == part.end ||
+                        (part.start <= entry.offset && entry.offset < part.end);
+                if (inPart && !part.organisms.contains(entry.organism)) {
+                    part.organisms.append(entry.organism);
+                }
+            }
+        }
+    }
+}
+
+
+int lookupJunctions(const Arguments & args)
+{
+    JunctionIndex index;
+    if (args.junctionIndexFileName.isEmpty()) {
+        qWarning() << "Junction index file not specified by --junction-index";
+        return 1;
+    }
+    if (!index.open(args.junctionIndexFileName)) {
+        return 1;
+    }
+    if (args.junctionLookup.size() > index.kmerLength()) {
+        qWarning() << "K-mer " << args.junctionLookup << " is longer than "
+                   << index.kmerLength() << " bases of index k-mers";
+        return 1;
+    }
+    QTextStream out(stdout);
+    Q_FOREACH(const JunctionIndex::Hit & hit, index.lookup(args.junctionLookup)) {
+        out << hit.kmer << "\t" << hit.intronId << "\t"
+            << (hit.acceptor ? "acceptor" : "donor") << "\n";
+    }
+    return 0;
+}
+
+
+int queryIntervals(const Arguments & args)
+{
+    static const char * KINDS[] = { "gene", "isoform", "exon", "intron" };
+    // VERSION:START-END or VERSION:POSITION
+    const bool nearest = !args.intervalNearest.isEmpty();
+    const QString query = nearest ? args.intervalNearest : args.intervalOverlap;
+    QRegExp rxQuery("(.+):(\\d+)(?:-(\\d+))?");
+    if (args.intervalDir.isEmpty() || !rxQuery.exactMatch(query)) {
+        qWarning() << "Interval query must be VERSION:START-END or VERSION:POSITION"
+                      " and index directory must be given by --interval-dir";
+        return 1;
+    }
+    IntervalIndex index;
+    if (!index.open(IntervalIndex::fileNameFor(args.intervalDir, rxQuery.cap(1)))) {
+        return 1;
+    }
+    const quint32 start = rxQuery.cap(2).toUInt();
+    const quint32 end = rxQuery.cap(3).isEmpty() ? start : rxQuery.cap(3).toUInt();
+    const QList<IntervalIndex::Interval> found = nearest
+            ? index.nearest(start)
+            : index.overlapping(start, end);
+    QTextStream out(stdout);
+    Q_FOREACH(const IntervalIndex::Interval & interval, found) {
+        out << KINDS[interval.kind] << "\t" << interval.id << "\t"
+            << interval.start << "\t" << interval.end << "\t"
+            << interval.geneId << "\t" << interval.isoformId << "\n";
+    }
+    return 0;
+}
+
+
+int selfCheck()
+{
+    // Index files are written into temporary directory and removed
+    const QString dir = QDir::temp().absoluteFilePath(
+                QString("introns_db_fill_check_%1").arg(qApp->applicationPid()));
+    QDir::root().mkpath(dir);
+    const bool junctionsOk = JunctionIndex::selfCheck(dir);
+    const bool intervalsOk = IntervalIndex::selfCheck(dir);
+    QDir::root().rmdir(dir);
+    QTextStream out(stdout);
+    out << "junction index: " << (junctionsOk ? "ok" : "FAILED") << "\n";
+    out << "interval index: " << (intervalsOk ? "ok" : "FAILED") << "\n";
+    return junctionsOk && intervalsOk ? 0 : 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    const Arguments args = parseArguments();
+    Logger::init(args.loggerFileName);
+
+    if (args.selfCheck) {
+        return selfCheck();
+    }
+    if (!args.junctionLookup.isEmpty()) {
+        return lookupJunctions(args);
+    }
+    if (!args.intervalOverlap.isEmpty() || !args.intervalNearest.isEmpty()) {
+        return queryIntervals(args);
+    }
+
+    QList< QList<InputPart> > schedule = args.scheduleBySize
+            ? scheduleBySize(args)
+            : scheduleInOrder(args);
+
+    // Staging tables must exist before workers write into them, and the
+    // same connection swaps them at the end
+    QSharedPointer<Database> stagingDb;
+    if (args.stagingTables && !args.catalogOnly) {
+        Database::setStagingTables(true);
+        stagingDb = Database::open(args.databaseHost,
+                                   args.databaseUser,
+                                   args.databasePass,
+                                   args.databaseName,
+                                   args.sequencesDir,
+                                   args.translationsDir);
+        if (!stagingDb || !stagingDb->createStagingTables()) {
+            qWarning() << "Can't create staging tables";
+            return 1;
+        }
+    }
+
+    // Organisms and chromosomes are written when their last input is
+    // done, at the end of run, and at checkpoints if set
+    Database::setStatisticsCheckpoint(args.statisticsCheckpointSec);
+    if (!args.catalogOnly) {
+        findOrganisms(args, &schedule);
+        QList<QStringList> inputs;
+        Q_FOREACH(const QList<InputPart> & parts, schedule) {
+            Q_FOREACH(const InputPart & part, parts) {
+                inputs.append(part.organisms);
+            }
+        }
+        Database::scheduleInputs(inputs);
+    }
+
+    // Shared by all workers to derive large sequences gene by gene
+    QThreadPool derivationPool;
+    derivationPool.setMaxThreadCount(qMax(1, args.deriveThreads));
+
+    // Junction k-mers of all workers go to one index
+    QSharedPointer<JunctionIndexWriter> junctionIndex;
+    if (!args.junctionIndexFileName.isEmpty() && !args.catalogOnly) {
+        junctionIndex = QSharedPointer<JunctionIndexWriter>(new JunctionIndexWriter);
+        if (!junctionIndex->create(args.junctionIndexFileName,
+                                   args.junctionKmerLength)) {
+            junctionIndex.clear();
+        }
+    }
+
+    // Parsed sequences go to writers, if any, so parsing and storing
+    // threads are tuned separately
+    QSharedPointer<SequenceQueue> queue;
+    QList<Writer*> writers;
+    if (args.writerThreads > 0 && !args.catalogOnly) {
+        queue = QSharedPointer<SequenceQueue>(new SequenceQueue(args.writerThreads,
+                                                                  args.writerQueueBytes));
+        for (quint16 writerNo = 0; writerNo < args.writerThreads; ++writerNo) {
+            Writer * writer = new Writer(args, queue.data(), junctionIndex.data());
+            writer->start();
+            writers.append(writer);
+        }
+    }
+
+    QList<Worker*> pool;
+
+    Q_FOREACH(const QList<InputPart> & parts, schedule) {
+        Worker * worker = new Worker(args,
+                                     args.deriveThreads > 0 ? &derivationPool : nullptr,
+                                     junctionIndex.data(),
+                                     queue.data(),
+                                     parts);
         worker->start();
         pool.append(worker);
     }
@@ -245,5 +932,41 @@ int main(int argc, char *argv[])
         delete worker;
     }
 
+    if (queue) {
+        queue->close();
+    }
+    Q_FOREACH(Writer * writer, writers) {
+        writer->wait();
+        delete writer;
+    }
+
+    // Derivation tasks of finished workers are done too, so per-thread
+    // aggregates are complete
+    derivationPool.waitForDone();
+    if (!args.catalogOnly) {
+        // Connection of main thread is shared, so staging one is reused
+        QSharedPointer<Database> db = stagingDb;
+        if (!db) {
+            db = Database::open(args.databaseHost,
+                                args.databaseUser,
+                                args.databasePass,
+                                args.databaseName,
+                                args.sequencesDir,
+                                args.translationsDir);
+        }
+        if (db) {
+            db->flushStatistics();
+            db->storeAggregates(Aggregates::merged());
+        }
+    }
+    if (stagingDb) {
+        stagingDb->swapStagingTables(QThread::idealThreadCount());
+        stagingDb.clear();
+    }
+    Database::closeConnection();
+    if (junctionIndex) {
+        junctionIndex->commit();
+    }
+
     return 0;
 }
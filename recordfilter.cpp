@@ -0,0 +1,77 @@
+#include "recordfilter.h"
+
+void RecordFilter::setAccessionPrefixes(const QStringList &prefixes)
+{
+    _accessionPrefixes = normalized(prefixes);
+}
+
+void RecordFilter::setChromosomes(const QStringList &names)
+{
+    _chromosomes = normalized(names);
+}
+
+void RecordFilter::setOrganisms(const QStringList &names)
+{
+    _organisms = normalized(names);
+}
+
+void RecordFilter::setMinLength(quint32 length)
+{
+    _minLength = length;
+}
+
+bool RecordFilter::isEmpty() const
+{
+    return _accessionPrefixes.isEmpty() && _chromosomes.isEmpty() &&
+            _organisms.isEmpty() && 0u == _minLength;
+}
+
+QString RecordFilter::signature() const
+{
+    return QString("accessions=%1;chromosomes=%2;organisms=%3;min_length=%4")
+            .arg(_accessionPrefixes.join(","))
+            .arg(_chromosomes.join(","))
+            .arg(_organisms.join(","))
+            .arg(_minLength);
+}
+
+bool RecordFilter::acceptLocus(const QString &refSeqId, quint32 length) const
+{
+    if (length < _minLength) {
+        return false;
+    }
+    if (_accessionPrefixes.isEmpty()) {
+        return true;
+    }
+    const QString id = refSeqId.toLower();
+    Q_FOREACH(const QString & prefix, _accessionPrefixes) {
+        if (id.startsWith(prefix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RecordFilter::acceptOrganism(const QString &name) const
+{
+    return _organisms.isEmpty() ||
+            _organisms.contains(name.simplified().toLower());
+}
+
+bool RecordFilter::acceptChromosome(const QString &name) const
+{
+    return _chromosomes.isEmpty() ||
+            _chromosomes.contains(name.simplified().toLower());
+}
+
+QStringList RecordFilter::normalized(const QStringList &values)
+{
+    QStringList result;
+    Q_FOREACH(const QString & value, values) {
+        const QString item = value.simplified().toLower();
+        if (!item.isEmpty()) {
+            result.append(item);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,33 @@
+#ifndef RECORDFILTER_H
+#define RECORDFILTER_H
+
+#include <QString>
+#include <QStringList>
+
+// Record-level predicates checked by parser as soon as corresponding
+// header fields are known. Empty criteria accept everything.
+class RecordFilter
+{
+public:
+    void setAccessionPrefixes(const QStringList & prefixes);
+    void setChromosomes(const QStringList & names);
+    void setOrganisms(const QStringList & names);
+    void setMinLength(quint32 length);
+
+    bool isEmpty() const;
+    QString signature() const;
+
+    bool acceptLocus(const QString & refSeqId, quint32 length) const;
+    bool acceptOrganism(const QString & name) const;
+    bool acceptChromosome(const QString & name) const;
+
+private:
+    static QStringList normalized(const QStringList & values);
+
+    QStringList _accessionPrefixes;
+    QStringList _chromosomes;
+    QStringList _organisms;
+    quint32 _minLength = 0u;
+};
+
+#endif // RECORDFILTER_H
@@ -0,0 +1,835 @@
+#include "sequencebuilder.h"
+
+#include "composition.h"
+#include "database.h"
+#include "fastaindex.h"
+#include "geneticcode.h"
+#include "splicesites.h"
+#include "structures.h"
+
+#include <QAtomicInt>
+#include <QDebug>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+struct SequenceBuilder::DerivationContext {
+    SequenceBuilder * builder = nullptr;
+    SequencePtr     seq;  // released once all genes are done
+    int             genesCount = 0;
+    QAtomicInt      nextGene;
+    QSemaphore      genesDone;
+
+    void run()
+    {
+        // Gene is claimed before seq is touched: late tasks find no work
+        // and never see seq, which is cleared after the last gene is done
+        Q_FOREVER {
+            const int index = nextGene.fetchAndAddOrdered(1);
+            if (index >= genesCount) {
+                break;
+            }
+            builder->fillIntronsAndExonsFromOrigin(seq->genes.at(index), seq);
+            genesDone.release();
+        }
+    }
+};
+
+class SequenceBuilder::DerivationTask
+        : public QRunnable
+{
+public:
+    explicit DerivationTask(QSharedPointer<DerivationContext> context)
+        : _context(context)
+    {
+    }
+
+    void run() override
+    {
+        _context->run();
+    }
+
+private:
+    QSharedPointer<DerivationContext> _context;
+};
+
+void SequenceBuilder::setDatabase(QSharedPointer<Database> db)
+{
+    _db = db;
+}
+
+void SequenceBuilder::setOverrideOrganismName(const QString &name)
+{
+    _overrideOrganismName = name;
+}
+
+void SequenceBuilder::setDerivationPool(QThreadPool *pool)
+{
+    _derivationPool = pool;
+}
+
+void SequenceBuilder::setCoordinatesOnly(bool coordinatesOnly)
+{
+    _coordinatesOnly = coordinatesOnly;
+}
+
+void SequenceBuilder::setRecordFilter(const RecordFilter &filter)
+{
+    _filter = filter;
+}
+
+void SequenceBuilder::setOriginSource(QSharedPointer<FastaIndex> fasta)
+{
+    _originSource = fasta;
+}
+
+void SequenceBuilder::setSpliceSiteModel(QSharedPointer<const SpliceSiteModel> model)
+{
+    _spliceSiteModel = model;
+}
+
+bool SequenceBuilder::coordinatesOnly() const
+{
+    return _coordinatesOnly;
+}
+
+void SequenceBuilder::startSequence(const QString &sourceFileName)
+{
+    _rejected = false;
+    _seq = SequencePtr(new Sequence);
+    _seq->sourceFileName = sourceFileName;
+    _seq->coordinatesOnly = _coordinatesOnly;
+    _sourceTranslTable = GeneticCode::Standard;
+}
+
+bool SequenceBuilder::setLocus(const QString &refSeqId, quint32 length)
+{
+    _seq->refSeqId = refSeqId;
+    _seq->length = length;
+    _rejected = !_filter.acceptLocus(refSeqId, length);
+    if (_rejected) {
+        qDebug() << "... " << refSeqId
+                 << " from " << _seq->sourceFileName
+                 << " skipped by filter";
+    }
+    else {
+        qDebug() << "... " << refSeqId
+                 << " from " << _seq->sourceFileName
+                 << " by worker " << QThread::currentThreadId();
+    }
+    return !_rejected;
+}
+
+void SequenceBuilder::setDefinition(const QString &description)
+{
+    _seq->description = description;
+}
+
+void SequenceBuilder::setVersion(const QString &version)
+{
+    _seq->version = version;
+}
+
+bool SequenceBuilder::setOrganism(const QString &name, const QStringList &taxonomy)
+{
+    const QString organismName = _overrideOrganismName.isEmpty()
+            ? name
+            : _overrideOrganismName;
+    if (organismName.isEmpty()) {
+        qWarning() << "Record " << _seq->refSeqId << " from " << _seq->sourceFileName
+                   << " has no organism name. Skipped!";
+        _rejected = true;
+        return false;
+    }
+    if (!_filter.acceptOrganism(organismName)) {
+        _rejected = true;
+        return false;
+    }
+    _seq->organism = _db->findOrCreateOrganism(organismName).toWeakRef();
+    _seq->taxonomyList = taxonomy;
+    if (_seq->organism.toStrongRef()->taxonomyList.size() == 0) {
+        _seq->organism.toStrongRef()->taxonomyList = _seq->taxonomyList;
+    }
+    return true;
+}
+
+bool SequenceBuilder::addSource(const QMap<QString, QString> &attrs)
+{
+    const bool mitochondrion =
+            attrs.contains("organelle") && "mitochondrion" == attrs["organelle"];
+    const QString chromosomeName = attrs.contains("chromosome")
+            ? attrs["chromosome"]
+            : (mitochondrion ? QString("mitochondrion") : QString());
+    if (!_filter.acceptChromosome(chromosomeName)) {
+        _rejected = true;
+        return false;
+    }
+    if (attrs.contains("organelle")) {
+        _seq->organelle = attrs["organelle"];
+        _seq->organism.toStrongRef()->dbMitochondria =
+                "mitochondrion" == attrs["organelle"];
+    }
+    if (attrs.contains("transl_table")) {
+        _sourceTranslTable = attrs["transl_table"].toUInt();
+    }
+    if (attrs.contains("db_xref")) {
+        _seq->taxonomyXref = attrs["db_xref"];
+        _seq->organism.toStrongRef()->taxonomyXref =
+                attrs["db_xref"];
+    }
+    if (!chromosomeName.isEmpty()) {
+        _seq->chromosome =
+                _db->findOrCreateChromosome(
+                    chromosomeName,
+                    _seq->organism.toStrongRef()
+                );
+    }
+    return true;
+}
+
+void SequenceBuilder::addGene(const FeatureLocation &location,
+                              const QMap<QString, QString> &attrs)
+{
+    GenePtr gene(new Gene);
+    gene->start = location.start;
+    gene->end = location.end;
+    gene->backwardChain = location.backwardChain;
+    gene->sequence = _seq.toWeakRef();
+    if (attrs.contains("gene")) {
+        gene->name = attrs["gene"];
+    }
+    gene->isPseudoGene = attrs.contains("pseudo") || attrs.contains("pseudogene");
+    if (_seq->chromosome && _seq->chromosome.toStrongRef()->name.toLower().startsWith("unk")) {
+        _seq->unknownProtGenesCount++;
+    }
+    _seq->genes.append(gene);
+}
+
+void SequenceBuilder::appendOrigin(const QByteArray &bases)
+{
+    _seq->origin.append(bases);
+}
+
+bool SequenceBuilder::rejected() const
+{
+    return _rejected;
+}
+
+SequencePtr SequenceBuilder::finishSequence()
+{
+    SequencePtr seq = _seq;
+    _seq.clear();
+    if (_rejected) {
+        seq.clear();
+    }
+    else if (seq->genes.isEmpty() && seq->description.isEmpty()) {
+        seq.clear();
+    }
+    else if (!seq->coordinatesOnly) {
+        fillIntronsAndExonsFromOrigin(seq);
+    }
+    return seq;
+}
+
+GenePtr SequenceBuilder::findGeneMatchingLocation(
+        const QList<GenePtr> &genes,
+        const quint32 start, const quint32 end,
+        const bool backwardChain)
+{
+    Q_FOREACH(GenePtr gene, genes) {
+        const bool startMatch = start >= gene->start;
+        const bool endMatch = end <= gene->end;
+        const bool chainMatch = backwardChain == gene->backwardChain;
+        if (startMatch && endMatch && chainMatch) {
+            return gene;
+        }
+    }
+
+    return GenePtr();
+}
+
+GenePtr SequenceBuilder::findGeneContainingLocation(
+        const QList<GenePtr> &genes,
+        const quint32 start, const quint32 end,
+        const bool backwardChain)
+{
+    Q_FOREACH(GenePtr gene, genes) {
+        const bool startMatch = start >= gene->start;
+        const bool endMatch = end <= gene->end;
+        const bool chainMatch = backwardChain == gene->backwardChain;
+        if (startMatch && endMatch && chainMatch) {
+            return gene;
+        }
+    }
+
+    return GenePtr();
+}
+
+static bool cdsRangesMatchesRnaRanges(const QList<Range> & cdsRanges,
+                                      const QList<Range> & mrnaRanges)
+{
+    // CDS corresponds to mRNA ⇔ :
+    //  1. First exocC[xc,yc] ∊ CDS: (∃ exonM[xm,ym] : xc >= xm && yc == ym)
+    //  2. ∀ inner exonC ∊ CDS: (∃ exonM ∊ mRNA: exonC == exonM)
+    //  3. Last exonC[xc,yx] ∊ CDS: (∃ exonM[xm,ym] : xc == xm && yc <= ym)
+    QVector<bool> cdsRangesGood(cdsRanges.size(), false);
+    for (int i=0; i<cdsRanges.size(); ++i) {
+        const bool first = 0 == i;
+        const bool last  = cdsRanges.size()-1 == i;
+        const bool mid = !first && !last;
+        const bool single = cdsRanges.size() == 1;
+
+        const bool leftBoundMustExactMatch  = (!single) && (mid || last);
+        const bool rightBoundMustExactMatch = (!single) && (mid || first);
+
+        const Range & cds = cdsRanges.at(i);
+
+        for (int j=0; j<mrnaRanges.size(); ++j) {
+            const Range & mrna = mrnaRanges.at(j);
+            bool leftOk = leftBoundMustExactMatch
+                    ? mrna.start == cds.start
+                    : mrna.start <= cds.start;
+            bool rightOk = rightBoundMustExactMatch
+                    ? mrna.end == cds.end
+                    : mrna.end >= cds.end;
+            if (leftOk && rightOk) {
+                cdsRangesGood[i] = true;
+                break;
+            }
+        }
+    }
+    return cdsRangesGood.count(true) == cdsRangesGood.size();
+}
+
+IsoformPtr SequenceBuilder::findRnaIsoformContainingLocation(
+        const QList<IsoformPtr> &isoforms,
+        const QList<quint32> & starts,
+        const QList<quint32> & ends,
+        const bool backwardChain)
+{
+    const QList<Range> ranges = Range::createList(starts, ends);
+
+    Q_FOREACH(IsoformPtr iso, isoforms) {
+        if (Isoform::MRNA == iso->type) {
+            const bool chainMatch = backwardChain == iso->gene.toStrongRef()->backwardChain;
+            if (chainMatch && cdsRangesMatchesRnaRanges(ranges, iso->mRnaRanges)) {
+                return iso;
+            }
+        }
+    }
+    return IsoformPtr();
+}
+
+void SequenceBuilder::addCdsOrRna(const QString & key,
+                                  const FeatureLocation &location,
+                                  const QMap<QString, QString> &attrs,
+                                  quint32 lineStart, quint32 lineEnd)
+{
+    const quint32 start = location.start;
+    const quint32 end = location.end;
+    const bool bw = location.backwardChain;
+    const QList<quint32> & starts = location.starts;
+    const QList<quint32> & ends = location.ends;
+    const QList<GenePtr> & allGenes = _seq->genes;
+
+    GenePtr targetGene;
+    IsoformPtr targetIsoform;
+
+    if ("CDS" == key) {
+        // CDS might have non-coding bounds inside gene
+        targetGene = findGeneContainingLocation(allGenes, start, end, bw);
+        const QString dbXref = attrs.contains("db_xref") ? attrs["db_xref"] : QString();
+        const QString product = attrs.contains("product") ? attrs["product"] : QString();
+
+        if (! targetGene) {
+            addOrphanedCds(dbXref, product, lineStart, lineEnd);
+            return;
+        }
+
+        // CDS must be linked to existing mRNA isoform
+        const QList<IsoformPtr> & geneIsoforms = targetGene->isoforms;
+        targetIsoform = findRnaIsoformContainingLocation(
+                    geneIsoforms, starts, ends, bw
+                    );
+
+        if (! targetIsoform) {
+            addOrphanedCds(dbXref, product, lineStart, lineEnd);
+            return;
+        }
+
+        if (Isoform::CDS == targetIsoform->type) {
+            // There is existing CDS, so clone it as new isoform. Only mRNA
+            // part is kept, everything of previous CDS is dropped.
+            targetIsoform = IsoformPtr(new Isoform(*targetIsoform.data()));
+            targetGene->isoforms.push_back(targetIsoform);
+            targetIsoform->id = 0;
+            targetIsoform->exons.clear();
+            targetIsoform->introns.clear();
+            targetIsoform->proteinId.clear();
+            targetIsoform->proteinXref.clear();
+            targetIsoform->product.clear();
+            targetIsoform->translation.clear();
+            targetIsoform->startCodon.clear();
+            targetIsoform->endCodon.clear();
+            targetIsoform->exonsLength = 0;
+            targetIsoform->codonCounts.clear();
+            targetIsoform->errorInLength = false;
+            targetIsoform->errorInStartCodon = false;
+            targetIsoform->errorInEndCodon = false;
+            targetIsoform->errorInIntron = false;
+            targetIsoform->errorInCodingExon = false;
+            targetIsoform->errorMain = false;
+            targetIsoform->errorComment.clear();
+        }
+
+        targetIsoform->type = Isoform::CDS;
+        targetGene->hasCDS = true;
+        _seq->cdsCount ++;
+        if (_seq->chromosome && _seq->chromosome.toStrongRef()->name.toLower().startsWith("unk")) {
+            _seq->unknownProtCdsCount ++;
+        }
+
+        targetIsoform->cdsStart = start;
+        targetIsoform->cdsEnd = end;
+        targetIsoform->exonsCdsCount = starts.size();
+        targetGene->isProteinButNotRna = true;
+        targetGene->startCode = start;
+        targetGene->endCode = end;
+    }
+    else {
+        // *RNA range must be equal to gene location
+        targetGene = findGeneMatchingLocation(allGenes, start, end, bw);
+
+        if (! targetGene) {
+            return;
+        }
+
+        if ("mRNA" == key) {
+            targetIsoform = IsoformPtr(new Isoform);
+            targetIsoform->type = Isoform::MRNA;
+            targetIsoform->mrnaStart = start;
+            targetIsoform->mrnaEnd = end;
+            targetIsoform->exonsMrnaCount = starts.size();
+            targetIsoform->mRnaRanges = Range::createList(starts, ends);
+            targetGene->isoforms.push_back(targetIsoform);
+        }
+        else {
+            targetGene->hasRNA = true;
+            _seq->rnaCount ++;
+        }
+    }
+
+    if (! targetIsoform) {
+        return;
+    }
+
+    targetIsoform->gene = targetGene.toWeakRef();
+    targetIsoform->sequence = targetGene->sequence;
+
+    if (attrs.contains("protein_id")) {
+        targetIsoform->proteinId = attrs["protein_id"];
+    }
+    if (attrs.contains("db_xref")) {
+        targetIsoform->proteinXref = attrs["db_xref"];
+    }
+    if (attrs.contains("product")) {
+        targetIsoform->product = attrs["product"];
+    }
+    if (attrs.contains("note")) {
+        targetIsoform->note = attrs["note"];
+    }
+
+    if ("CDS" == key) {
+        createIntronsAndExons(targetIsoform,
+                              false,
+                              bw,
+                              starts, ends);
+
+        if (attrs.contains("translation")) {
+            targetIsoform->translation = attrs["translation"];
+        }
+
+        targetIsoform->codonStart = attrs.contains("codon_start")
+                ? qBound(1u, attrs["codon_start"].toUInt(), 3u)
+                : 1u;
+        targetIsoform->partialStart = bw ? location.partialHigh : location.partialLow;
+        targetIsoform->partialEnd = bw ? location.partialLow : location.partialHigh;
+
+        // Organelle alone does not tell the code: mitochondria of
+        // vertebrates, yeasts, invertebrates and plants use different ones
+        targetIsoform->translTable = attrs.contains("transl_table")
+                ? attrs["transl_table"].toUInt()
+                : _sourceTranslTable;
+
+    }
+}
+
+void SequenceBuilder::addOrphanedCds(const QString &dbXref, const QString &product,
+                                     quint32 lineStart, quint32 lineEnd)
+{
+    OrphanedCds cds;
+    cds.lineStart = lineStart;
+    cds.lineEnd = lineEnd;
+    cds.dbXref = dbXref;
+    cds.product = product;
+    _seq->orphanedCdses.append(cds);
+}
+
+void SequenceBuilder::createIntronsAndExons(IsoformPtr isoform,
+                                            bool rna, bool bw,
+                                            const QList<quint32> &starts,
+                                            const QList<quint32> ends)
+{
+    Q_ASSERT(starts.size() == ends.size());
+    if (starts.size() == 0) {
+        return;
+    }
+
+    int startIndex = bw ? starts.size() - 1 : 0;
+    int endIndex = bw ? -1 : starts.size();
+    int increment = bw ? -1 : 1;
+
+    quint8 phase = 0;
+
+    for (int exonIndex = startIndex;
+         exonIndex != endIndex;
+         exonIndex += increment)
+    {
+        const int start = starts[exonIndex];
+        const int end = ends[exonIndex];
+        ExonPtr exon(new Exon);
+        exon->start = start;
+        exon->end = end;
+        exon->isoform = isoform;
+        exon->gene = isoform->gene;
+        exon->sequence = isoform->sequence;
+        exon->startPhase = phase;
+        phase = exon->endPhase = (phase + end - start + 1) % 3;
+        isoform->exons.push_back(exon);
+    }
+
+    if (1 == isoform->exons.size()) {
+        ExonPtr exon = isoform->exons.first();
+        exon->index = exon->revIndex = 0;
+        exon->type = Exon::Type::OneExon;
+    }
+    else {
+        for (int index = 0; index < isoform->exons.size(); ++index) {
+            ExonPtr exon = isoform->exons.at(index);
+            exon->index = index;
+            exon->revIndex = isoform->exons.size() - index - 1;
+            if (0 == index) {
+                exon->type = Exon::Type::Start;
+            }
+            else if (isoform->exons.size()-1 == index) {
+                exon->type = Exon::Type::End;
+            }
+            else {
+                exon->type = Exon::Type::Inner;
+            }
+            if (index > 0) {
+                ExonPtr prevExon = isoform->exons[index-1];
+                IntronPtr intron(new Intron);
+                intron->isoform = isoform;
+                intron->gene = isoform->gene;
+                intron->sequence = isoform->sequence;
+                intron->prevExon = prevExon;
+                intron->nextExon = exon;
+                intron->start = bw ? exon->end + 1 : prevExon->end + 1;
+                intron->end = bw ? prevExon->start - 1 : exon->start - 1;
+                intron->index = index - 1;
+                intron->revIndex = isoform->exons.size() - index - 2;
+                intron->phase = prevExon->endPhase;
+                intron->lengthPhase = (intron->end - intron->start + 1) % 3;
+                const quint8 prevStartPhase = prevExon->startPhase;
+                const quint8 intrStartPhase = prevExon->endPhase;
+                const quint8 nextEndPhase = exon->endPhase;
+                const size_t typeIndex =
+                        1 +  // SQL id's starts from 1 but not 0
+                        9 * prevStartPhase +  // use prev start phase as group number
+                        3 * intrStartPhase +  // use intron phase as row number
+                        nextEndPhase;  // use next end phase as column number
+                intron->intronTypeId = typeIndex;
+                isoform->introns.push_back(intron);
+                prevExon->nextIntron = intron;
+                exon->prevIntron = intron;
+            }
+        }
+    }
+    GenePtr gene = isoform->gene.toStrongRef();
+
+    gene->maxIntronsCount =
+            qMax(gene->maxIntronsCount, quint32(isoform->introns.size()));
+
+    if (rna) {
+        gene->isProteinButNotRna = false;
+        isoform->exonsMrnaCount = isoform->exons.size();
+    }
+    else {
+        isoform->exonsCdsCount = isoform->exons.size();
+    }
+
+    Q_FOREACH(IsoformPtr iso, gene->isoforms) {
+        iso->isMaximumByIntrons =
+                quint32(iso->introns.size()) == gene->maxIntronsCount;
+    }
+}
+
+QByteArray SequenceBuilder::dnaReverseComplement(const QByteArray &origin,
+                                                 int start, int end)
+{
+    if (end > start) {
+        // ensure reverse indexing
+        int t = start;
+        start = end;
+        end = t;
+    }
+    const int length = start - end + 1;  // inclusive both bounds
+    QByteArray result(length, '?');
+    for (int i=0; i<length; ++i) {
+        int originIndex = start - i - 1;
+        char c = origin[originIndex];
+        char t = '?';
+        switch (c) {
+        case 'A': t = 'T'; break;
+        case 'T': t = 'A'; break;
+        case 'G': t = 'C'; break;
+        case 'C': t = 'G'; break;
+        case 'N': t = 'N'; break;
+        default:
+            qWarning() << "Unknown letter: " << c;
+            break;
+        }
+        result[i] = t;
+    }
+    return result;
+}
+
+void SequenceBuilder::fillIntronsAndExonsFromOrigin(SequencePtr seq)
+{
+    // Genes do not share any derived data, so each gene is an independent
+    // task. Calling thread takes part too, while idle pool threads pick up
+    // the rest one gene at a time. Organism counters are not touched here.
+    const int genesCount = seq->genes.size();
+    const int helpersCount = _derivationPool
+            ? qMin(_derivationPool->maxThreadCount(), genesCount - 1)
+            : 0;
+
+    if (helpersCount <= 0) {
+        Q_FOREACH(GenePtr gene, seq->genes) {
+            fillIntronsAndExonsFromOrigin(gene, seq);
+        }
+        return;
+    }
+
+    QSharedPointer<DerivationContext> context(new DerivationContext);
+    context->builder = this;
+    context->seq = seq;
+    context->genesCount = genesCount;
+    for (int i=0; i<helpersCount; ++i) {
+        _derivationPool->start(new DerivationTask(context));
+    }
+    context->run();
+
+    // Wait for genes but not for helpers: late helpers will find no work,
+    // so the sequence is not kept alive by tasks still queued in the pool
+    context->genesDone.acquire(genesCount);
+    context->seq.clear();
+}
+
+void SequenceBuilder::fillIntronsAndExonsFromOrigin(GenePtr gene,
+                                                    SequencePtr seq)
+{
+    QByteArray window;
+    qint32 offset = 0;
+    if (seq->origin.isEmpty() && _originSource) {
+        // No origin in record itself, so read just the gene window
+        window = _originSource->read(seq->version, gene->start, gene->end);
+        offset = gene->start - 1;
+        if (quint32(window.size()) != gene->end - gene->start + 1) {
+            qWarning() << "Can't read origin of gene " << gene->name
+                       << " from " << seq->version << ". Derivation skipped!";
+            return;
+        }
+    }
+    const QByteArray & origin = window.isEmpty() ? seq->origin : window;
+
+    QList<IntronPtr> introns;
+    Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+        fillIntronsAndExonsFromOrigin(isoform, origin, offset);
+        introns += isoform->introns;
+    }
+
+    // All introns of gene are scored as one batch
+    static const SpliceSiteModel defaultModel;
+    const SpliceSiteScorer scorer(_spliceSiteModel ? *_spliceSiteModel : defaultModel);
+    scorer.score(introns, origin, offset);
+}
+
+void SequenceBuilder::fillIntronsAndExonsFromOrigin(IsoformPtr isoform,
+                                                    const QByteArray &origin,
+                                                    qint32 offset)
+{
+    // Coordinates are 1-based in sequence, while origin might be a window
+    // which starts right after 'offset' bases
+    qint32 start = qMin(isoform->cdsStart, isoform->mrnaStart) - offset;
+    qint32 end = qMax(isoform->cdsEnd, isoform->mrnaEnd) - offset;
+
+    bool bw = isoform->gene.toStrongRef()->backwardChain;
+
+    const QByteArray isoformOrigin = bw
+            ? dnaReverseComplement(origin, start, end)
+            : origin.mid(start-1, end-start+1);
+
+    isoform->startCodon = isoformOrigin.left(3);
+    isoform->endCodon = isoformOrigin.right(3);
+
+    Q_FOREACH(ExonPtr exon, isoform->exons) {
+        const qint32 exonStart = exon->start - offset;
+        const qint32 exonEnd = exon->end - offset;
+
+        exon->origin = bw
+                ? dnaReverseComplement(origin, exonStart, exonEnd)
+                : origin.mid(exonStart-1, exonEnd-exonStart+1);
+
+        exon->startCodon = exon->origin.left(3);
+        exon->endCodon = exon->origin.right(3);
+        exon->composition = countComposition(exon->origin);
+        exon->errorNInSequence = exon->composition.nCount > 0;
+        if (exon->errorNInSequence) {
+            exon->isoform.toStrongRef()->errorInCodingExon = true;
+            exon->isoform.toStrongRef()->errorMain = true;
+        }
+    }
+
+    if (Isoform::CDS == isoform->type) {
+        validateCodons(isoform);
+        validateTranslation(isoform);
+        countCodons(isoform);
+    }
+
+    Q_FOREACH(IntronPtr intron, isoform->introns) {
+        const qint32 intronStart = intron->start - offset;
+        const qint32 intronEnd = intron->end - offset;
+        Q_ASSERT(intronStart > start);
+        Q_ASSERT(intronEnd < end);
+
+        intron->origin = bw
+                ? dnaReverseComplement(origin, intronStart, intronEnd)
+                : origin.mid(intronStart-1, intronEnd-intronStart+1);
+
+        intron->startDinucleotide = intron->origin.left(2);
+        intron->endDinucleotide = intron->origin.right(2);
+
+        intron->errorInStartDinucleotide = "GT" != intron->startDinucleotide;
+        intron->errorInEndDinucleotide = "AG" != intron->endDinucleotide;
+        intron->errorMain =
+                intron->errorMain ||
+                intron->errorInStartDinucleotide ||
+                intron->errorInEndDinucleotide;
+        if (intron->errorMain) {
+            intron->isoform.toStrongRef()->errorInIntron = true;
+            intron->isoform.toStrongRef()->errorMain = true;
+        }
+        intron->composition = countComposition(intron->origin);
+        intron->warningNInSequence = intron->composition.nCount > 0;
+    }
+
+}
+
+void SequenceBuilder::validateCodons(IsoformPtr isoform)
+{
+    // Codons are checked by spliced coding sequence, so exon shorter
+    // than three bases does not break them. Stored codons of isoform are
+    // still the ones of its whole span.
+    QByteArray startCodon;
+    for (int i = 0; i < isoform->exons.size() && startCodon.size() < 3; ++i) {
+        startCodon += isoform->exons[i]->origin.left(3 - startCodon.size());
+    }
+    QByteArray endCodon;
+    for (int i = isoform->exons.size() - 1; i >= 0 && endCodon.size() < 3; --i) {
+        endCodon.prepend(isoform->exons[i]->origin.right(3 - endCodon.size()));
+    }
+
+    const GeneticCode * code = GeneticCode::byId(isoform->translTable);
+    if (!code) {
+        qWarning() << "Unknown translation table " << isoform->translTable
+                   << " of " << isoform->proteinId << ". Codons not checked!";
+        return;
+    }
+    // CDS which is partial at 5' or 3' end has no start or stop codon
+    isoform->errorInStartCodon = !isoform->partialStart &&
+            1 == isoform->codonStart &&
+            !code->isStart(GeneticCode::codonIndex(startCodon));
+    isoform->errorInEndCodon = !isoform->partialEnd &&
+            !code->isStop(GeneticCode::codonIndex(endCodon));
+}
+
+QByteArray SequenceBuilder::codingSequence(IsoformPtr isoform)
+{
+    QByteArray result;
+    Q_FOREACH(ExonPtr exon, isoform->exons) {
+        result += exon->origin;
+    }
+    return result;
+}
+
+void SequenceBuilder::countCodons(IsoformPtr isoform)
+{
+    isoform->codonCounts.fill(0u, GeneticCode::CodonsCount);
+    GeneticCode::countCodons(codingSequence(isoform), isoform->codonStart - 1,
+                             isoform->codonCounts.data());
+}
+
+void SequenceBuilder::validateTranslation(IsoformPtr isoform)
+{
+    QString expected = isoform->translation;
+    expected.remove(' ');  // qualifier lines were joined by spaces
+    const GeneticCode * code = GeneticCode::byId(isoform->translTable);
+    if (expected.isEmpty() || !code) {
+        return;
+    }
+
+    const QByteArray codingSequence = SequenceBuilder::codingSequence(isoform);
+    const int frame = isoform->codonStart - 1;
+    QByteArray actual = code->translate(codingSequence, frame);
+    if (actual.isEmpty()) {
+        return;
+    }
+
+    // Initiator codon is translated as methionine whatever it encodes.
+    // CDS which is partial at 5' end has no initiator.
+    if (0 == frame && !isoform->partialStart &&
+            code->isStart(GeneticCode::codonIndex(codingSequence))) {
+        actual[0] = 'M';
+    }
+    if (actual.endsWith('*')) {
+        actual.chop(1);
+    }
+
+    QString comment;
+    const int commonLength = qMin(actual.size(), expected.size());
+    for (int i = 0; i < commonLength; ++i) {
+        const char got = actual[i];
+        const char want = expected[i].toLatin1();
+        // Ambiguous residues and stops read through as selenocysteine
+        // or pyrrolysine (/transl_except) are not mismatches
+        const bool readThrough = '*' == got && ('U' == want || 'O' == want);
+        if (got != want && 'X' != want && 'X' != got && !readThrough) {
+            comment = QString("translation mismatch at residue %1: %2 instead of %3")
+                    .arg(i + 1).arg(got).arg(want);
+            break;
+        }
+    }
+    if (comment.isEmpty() && actual.size() != expected.size()) {
+        comment = QString("translation length %1 instead of %2")
+                .arg(actual.size()).arg(expected.size());
+    }
+    if (!comment.isEmpty()) {
+        isoform->errorComment = isoform->errorComment.isEmpty()
+                ? comment
+                : isoform->errorComment + "; " + comment;
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef SEQUENCEBUILDER_H
+#define SEQUENCEBUILDER_H
+
+#include "recordfilter.h"
+#include "structures.h"
+
+#include <QByteArray>
+#include <QMap>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+
+class Database;
+class FastaIndex;
+class SpliceSiteModel;
+class QThreadPool;
+
+// Builds Sequence graph from parsed record parts, regardless of input
+// format. Parser calls header methods first, then adds features in their
+// order and origin, and takes the result by finishSequence. Header methods
+// return false as soon as record is rejected by filter, so parser should
+// skip the rest of record.
+class SequenceBuilder
+{
+public:
+    void setDatabase(QSharedPointer<Database> db);
+    void setOverrideOrganismName(const QString & name);
+    void setDerivationPool(QThreadPool * pool);
+    void setCoordinatesOnly(bool coordinatesOnly);
+    void setRecordFilter(const RecordFilter & filter);
+    void setOriginSource(QSharedPointer<FastaIndex> fasta);
+    void setSpliceSiteModel(QSharedPointer<const SpliceSiteModel> model);
+    bool coordinatesOnly() const;
+
+    void startSequence(const QString & sourceFileName);
+    bool setLocus(const QString & refSeqId, quint32 length);
+    void setDefinition(const QString & description);
+    void setVersion(const QString & version);
+    bool setOrganism(const QString & name, const QStringList & taxonomy);
+    bool addSource(const QMap<QString,QString> & attrs);
+    void addGene(const FeatureLocation & location,
+                 const QMap<QString,QString> & attrs);
+    void addCdsOrRna(const QString & key,
+                     const FeatureLocation & location,
+                     const QMap<QString,QString> & attrs,
+                     quint32 lineStart, quint32 lineEnd);
+    void appendOrigin(const QByteArray & bases);
+    bool rejected() const;
+    SequencePtr finishSequence();
+
+    // Derives codons, dinucleotides and feature origins. Sequence without
+    // origin is read by gene windows from origin source, if set.
+    void fillIntronsAndExonsFromOrigin(SequencePtr seq);
+
+private:
+    static GenePtr findGeneMatchingLocation(const QList<GenePtr> &genes,
+                                            const quint32 start,
+                                            const quint32 end,
+                                            const bool backwardChain
+                                            );
+
+    static GenePtr findGeneContainingLocation(const QList<GenePtr> &genes,
+                                              const quint32 start,
+                                              const quint32 end,
+                                              const bool backwardChain
+                                              );
+
+    static IsoformPtr findRnaIsoformContainingLocation(
+            const QList<IsoformPtr> &isoforms,
+            const QList<quint32> & starts, const QList<quint32> & ends,
+            const bool backwardChain);
+
+    void addOrphanedCds(const QString & dbXref, const QString & product,
+                        quint32 lineStart, quint32 lineEnd);
+
+    void createIntronsAndExons(IsoformPtr isoform, bool rna, bool bw,
+                               const QList<quint32> & starts,
+                               const QList<quint32> ends);
+
+    static QByteArray dnaReverseComplement(const QByteArray & origin, int start, int end);
+    void fillIntronsAndExonsFromOrigin(GenePtr gene, SequencePtr seq);
+    void fillIntronsAndExonsFromOrigin(IsoformPtr isoform,
+                                       const QByteArray & origin,
+                                       qint32 offset);
+
+    // Sets start and end codons of CDS and checks them by its genetic code
+    static void validateCodons(IsoformPtr isoform);
+
+    // Translates CDS and compares result with its /translation qualifier.
+    // Mismatch is described in error comment.
+    static void validateTranslation(IsoformPtr isoform);
+
+    // Counts codons of CDS in its reading frame
+    static void countCodons(IsoformPtr isoform);
+
+    static QByteArray codingSequence(IsoformPtr isoform);
+
+    // Per-sequence state shared by derivation tasks
+    struct DerivationContext;
+    class DerivationTask;
+
+    SequencePtr _seq;
+    bool _rejected = false;
+    quint32 _sourceTranslTable = 1;  // of CDS without /transl_table
+
+    QSharedPointer<Database> _db;
+    QString _overrideOrganismName;
+    QThreadPool * _derivationPool = nullptr;
+    bool _coordinatesOnly = false;
+    RecordFilter _filter;
+    QSharedPointer<FastaIndex> _originSource;
+    QSharedPointer<const SpliceSiteModel> _spliceSiteModel;
+};
+
+#endif // SEQUENCEBUILDER_H
@@ -0,0 +1,620 @@
+#include "sequencecache.h"
+
+#include "database.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+#include <QtEndian>
+
+extern "C" {
+#include <string.h>
+}
+
+static const char CACHE_MAGIC[8] = { 'I', 'D', 'F', 'C', 'A', 'C', 'H', 'E' };
+static const qint64 HASH_CHUNK_SIZE = 1024 * 1024;
+static const int HASH_SIZE = 20;  // SHA-1
+
+namespace {
+
+class CacheOutput
+{
+public:
+    void put32(quint32 value)
+    {
+        uchar buf[4];
+        qToLittleEndian<quint32>(value, buf);
+        data.append(reinterpret_cast<const char*>(buf), 4);
+    }
+
+    void put64(quint64 value)
+    {
+        uchar buf[8];
+        qToLittleEndian<quint64>(value, buf);
+        data.append(reinterpret_cast<const char*>(buf), 8);
+    }
+
+    void putBytes(const QByteArray & bytes)
+    {
+        put32(bytes.size());
+        data.append(bytes);
+        align(4);
+    }
+
+    void putString(const QString & s)
+    {
+        putBytes(s.toUtf8());
+    }
+
+    void align(int n)
+    {
+        while (0 != data.size() % n) {
+            data.append('\0');
+        }
+    }
+
+    void patch32(int pos, quint32 value)
+    {
+        qToLittleEndian<quint32>(value, reinterpret_cast<uchar*>(data.data() + pos));
+    }
+
+    QByteArray data;
+};
+
+class CacheInput
+{
+public:
+    CacheInput(const uchar * data, qint64 size)
+        : _data(data), _size(size)
+    {
+    }
+
+    quint32 get32()
+    {
+        if (!require(4)) {
+            return 0;
+        }
+        const quint32 value = qFromLittleEndian<quint32>(_data + _pos);
+        _pos += 4;
+        return value;
+    }
+
+    quint64 get64()
+    {
+        if (!require(8)) {
+            return 0;
+        }
+        const quint64 value = qFromLittleEndian<quint64>(_data + _pos);
+        _pos += 8;
+        return value;
+    }
+
+    QByteArray getBytes()
+    {
+        const quint32 length = get32();
+        if (!require(length)) {
+            return QByteArray();
+        }
+        const QByteArray value(reinterpret_cast<const char*>(_data + _pos), length);
+        _pos += length;
+        align(4);
+        return value;
+    }
+
+    QString getString()
+    {
+        return QString::fromUtf8(getBytes());
+    }
+
+    void align(int n)
+    {
+        _pos += (n - _pos % n) % n;
+    }
+
+    qint64 pos() const
+    {
+        return _pos;
+    }
+
+    bool ok() const
+    {
+        return _ok;
+    }
+
+private:
+    bool require(qint64 bytes)
+    {
+        _ok = _ok && _pos + bytes <= _size;
+        return _ok;
+    }
+
+    const uchar * _data;
+    qint64 _size;
+    qint64 _pos = 0;
+    bool _ok = true;
+};
+
+}
+
+static QByteArray sourceHash(const QString &sourceFileName)
+{
+    QFile source(sourceFileName);
+    if (!source.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QByteArray chunk;
+    do {
+        chunk = source.read(HASH_CHUNK_SIZE);
+        hash.addData(chunk);
+    } while (chunk.size() == HASH_CHUNK_SIZE);
+    return hash.result();
+}
+
+static QByteArray optionsHash(const QString &options)
+{
+    return QCryptographicHash::hash(options.toUtf8(), QCryptographicHash::Sha1);
+}
+
+QString SequenceCache::fileNameFor(const QString &cacheDir,
+                                   const QString &sourceFileName)
+{
+    // Source path hash prevents collisions of same named files
+    const QFileInfo sourceInfo(sourceFileName);
+    const QByteArray pathHash = QCryptographicHash::hash(
+                sourceInfo.absoluteFilePath().toUtf8(),
+                QCryptographicHash::Sha1).toHex().left(8);
+    return QDir(cacheDir).absoluteFilePath(
+                sourceInfo.fileName() + "." + QString::fromLatin1(pathHash) + ".cache");
+}
+
+bool SequenceCacheWriter::create(const QString &cacheFileName,
+                                 const QString &sourceFileName,
+                                 const QString &options)
+{
+    const QFileInfo sourceInfo(sourceFileName);
+    QDir::root().mkpath(QFileInfo(cacheFileName).absolutePath());
+    _cacheFileName = cacheFileName;
+    _file.setFileName(cacheFileName + ".tmp");
+    if (!_file.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+        qWarning() << "Can't open '" << _file.fileName() <<
+                      "'. Cache for '" << sourceFileName << "' will not be stored!";
+        return false;
+    }
+
+    CacheOutput out;
+    out.data.append(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    out.put32(SequenceCache::Version);
+    out.put32(0);
+    out.put64(sourceInfo.size());
+    out.put64(sourceInfo.lastModified().toMSecsSinceEpoch());
+    // Contents hash is not known yet, it is patched on commit
+    out.put32(HASH_SIZE);
+    _sourceHashPos = out.data.size();
+    out.data.append(QByteArray(HASH_SIZE, '\0'));
+    out.putBytes(optionsHash(options));
+    out.align(8);
+    _failed = _file.write(out.data) != out.data.size();
+
+    _sourceHash.reset();
+    _source.setFileName(sourceFileName);
+    if (!_source.open(QIODevice::ReadOnly)) {
+        qWarning() << "Can't open '" << sourceFileName <<
+                      "' to hash it. Cache will not be stored!";
+        _failed = true;
+    }
+    return !_failed;
+}
+
+void SequenceCacheWriter::hashSource(bool wholeRest)
+{
+    // Source is hashed a chunk per record, so it is read again right
+    // after parser, while it is still in page cache
+    while (!_failed && _source.isOpen() && !_source.atEnd()) {
+        const QByteArray chunk = _source.read(HASH_CHUNK_SIZE);
+        if (chunk.isEmpty()) {
+            qWarning() << "Can't read '" << _source.fileName() <<
+                          "' to hash it. Cache will not be stored!";
+            _failed = true;
+            break;
+        }
+        _sourceHash.addData(chunk);
+        if (!wholeRest) {
+            break;
+        }
+    }
+}
+
+bool SequenceCacheWriter::isOpen() const
+{
+    return _file.isOpen();
+}
+
+void SequenceCacheWriter::write(SequencePtr seq)
+{
+    if (!_file.isOpen() || _failed) {
+        return;
+    }
+
+    OrganismPtr organism = seq->organism.toStrongRef();
+    ChromosomePtr chromosome = seq->chromosome.toStrongRef();
+    QString organismName;
+    QString chromosomeName;
+    if (organism) {
+        organism->mutex.lock();
+        organismName = organism->name;
+        organism->mutex.unlock();
+    }
+    if (chromosome) {
+        chromosome->mutex.lock();
+        chromosomeName = chromosome->name;
+        chromosome->mutex.unlock();
+    }
+
+    CacheOutput out;
+    out.put32(0);  // record size, patched below
+    out.put32(0);
+    out.putString(seq->sourceFileName);
+    out.putString(seq->refSeqId);
+    out.putString(seq->version);
+    out.putString(seq->description);
+    out.putString(organismName);
+    out.putString(chromosomeName);
+    out.putString(seq->taxonomyList.join("\n"));
+    out.putString(seq->taxonomyXref);
+    out.putString(seq->organelle);
+    out.put32(seq->length);
+    out.put32(seq->coordinatesOnly ? 1 : 0);
+    out.put32(seq->cdsCount);
+    out.put32(seq->rnaCount);
+    out.put32(seq->unknownProtGenesCount);
+    out.put32(seq->unknownProtCdsCount);
+
+    out.put32(seq->orphanedCdses.size());
+    Q_FOREACH(const OrphanedCds & cds, seq->orphanedCdses) {
+        out.put32(cds.lineStart);
+        out.put32(cds.lineEnd);
+        out.putString(cds.dbXref);
+        out.putString(cds.product);
+    }
+
+    out.putBytes(seq->origin);
+
+    out.put32(seq->genes.size());
+    Q_FOREACH(GenePtr gene, seq->genes) {
+        out.putString(gene->name);
+        out.putString(gene->note);
+        out.put32(gene->start);
+        out.put32(gene->end);
+        out.put32(gene->startCode);
+        out.put32(gene->endCode);
+        out.put32(gene->maxIntronsCount);
+        out.put32((gene->backwardChain ? 0x01 : 0) |
+                  (gene->isProteinButNotRna ? 0x02 : 0) |
+                  (gene->isPseudoGene ? 0x04 : 0) |
+                  (gene->hasCDS ? 0x08 : 0) |
+                  (gene->hasRNA ? 0x10 : 0));
+
+        out.put32(gene->isoforms.size());
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            out.put32(quint32(isoform->type));
+            out.putString(isoform->proteinXref);
+            out.putString(isoform->proteinId);
+            out.putString(isoform->product);
+            out.putString(isoform->note);
+            out.putString(isoform->translation);
+            out.put32(isoform->cdsStart);
+            out.put32(isoform->cdsEnd);
+            out.put32(isoform->mrnaStart);
+            out.put32(isoform->mrnaEnd);
+            out.put32(isoform->exonsCdsCount);
+            out.put32(isoform->exonsMrnaCount);
+            out.put32(isoform->translTable);
+            out.put32(isoform->codonStart);
+            out.put32((isoform->isMaximumByIntrons ? 0x01 : 0) |
+                      (isoform->hasCDS ? 0x02 : 0) |
+                      (isoform->partialStart ? 0x04 : 0) |
+                      (isoform->partialEnd ? 0x08 : 0));
+
+            out.put32(isoform->exons.size());
+            Q_FOREACH(ExonPtr exon, isoform->exons) {
+                out.put32(exon->start);
+                out.put32(exon->end);
+                out.put32(exon->index);
+                out.put32(exon->revIndex);
+                out.put32(quint32(exon->type) |
+                          quint32(exon->startPhase) << 8 |
+                          quint32(exon->endPhase) << 16 |
+                          quint32(exon->lengthPhase) << 24);
+            }
+
+            out.put32(isoform->introns.size());
+            Q_FOREACH(IntronPtr intron, isoform->introns) {
+                out.put32(intron->start);
+                out.put32(intron->end);
+                out.put32(intron->index);
+                out.put32(intron->revIndex);
+                out.put32(intron->intronTypeId);
+                out.put32(isoform->exons.indexOf(intron->prevExon.toStrongRef()));
+                out.put32(isoform->exons.indexOf(intron->nextExon.toStrongRef()));
+                out.put32(quint32(intron->phase) |
+                          quint32(intron->lengthPhase) << 8);
+            }
+        }
+    }
+
+    out.align(8);
+    out.patch32(0, out.data.size());
+    _failed = _file.write(out.data) != out.data.size();
+    if (_failed) {
+        qWarning() << "Can't write '" << _file.fileName() <<
+                      "' (possible out of space). Cache will not be stored!";
+    }
+    hashSource(false);
+}
+
+bool SequenceCacheWriter::commit()
+{
+    if (!_file.isOpen()) {
+        return false;
+    }
+    hashSource(true);
+    _source.close();
+    if (!_failed) {
+        const QByteArray hash = _sourceHash.result();
+        _failed = !_file.seek(_sourceHashPos) ||
+                _file.write(hash) != hash.size();
+    }
+    _file.close();
+    if (_failed) {
+        _file.remove();
+        return false;
+    }
+    QFile::remove(_cacheFileName);
+    return _file.rename(_cacheFileName);
+}
+
+SequenceCacheWriter::~SequenceCacheWriter()
+{
+    if (_file.isOpen()) {
+        // Not committed, so might be incomplete
+        _file.close();
+        _file.remove();
+    }
+}
+
+bool SequenceCacheReader::open(const QString &cacheFileName,
+                               const QString &sourceFileName,
+                               const QString &options)
+{
+    _file.setFileName(cacheFileName);
+    if (!_file.exists() || !_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    _size = _file.size();
+    _data = _file.map(0, _size);
+    if (!_data) {
+        qWarning() << "Can't map cache file '" << cacheFileName << "'. Ignored!";
+        _file.close();
+        return false;
+    }
+
+    CacheInput in(_data, _size);
+    const bool magicMatch = _size > qint64(sizeof(CACHE_MAGIC)) &&
+            0 == memcmp(_data, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    in.get64();  // magic
+    const quint32 version = in.get32();
+    in.get32();
+    const quint64 sourceSize = in.get64();
+    const qint64 sourceModified = in.get64();
+    const QByteArray storedSourceHash = in.getBytes();
+    const QByteArray storedOptionsHash = in.getBytes();
+    in.align(8);
+
+    // Cheap checks go first, source contents are hashed only if they pass
+    const QFileInfo sourceInfo(sourceFileName);
+    bool valid = in.ok() && magicMatch && SequenceCache::Version == version &&
+            quint64(sourceInfo.size()) == sourceSize &&
+            sourceInfo.lastModified().toMSecsSinceEpoch() == sourceModified &&
+            optionsHash(options) == storedOptionsHash;
+    valid = valid && sourceHash(sourceFileName) == storedSourceHash;
+
+    if (!valid) {
+        _file.unmap(_data);
+        _data = nullptr;
+        _file.close();
+        return false;
+    }
+    _pos = in.pos();
+    return true;
+}
+
+void SequenceCacheReader::setDatabase(QSharedPointer<Database> db)
+{
+    _db = db;
+}
+
+bool SequenceCacheReader::atEnd() const
+{
+    return !_data || _pos >= _size;
+}
+
+SequencePtr SequenceCacheReader::readSequence()
+{
+    if (atEnd()) {
+        return SequencePtr();
+    }
+    CacheInput in(_data + _pos, _size - _pos);
+    const quint32 recordSize = in.get32();
+    in.get32();
+    if (recordSize < 8 || qint64(recordSize) > _size - _pos) {
+        qWarning() << "Cache file '" << _file.fileName() << "' is damaged. Rest of it ignored!";
+        _pos = _size;
+        return SequencePtr();
+    }
+    _pos += recordSize;
+
+    SequencePtr seq(new Sequence);
+    seq->sourceFileName = in.getString();
+    seq->refSeqId = in.getString();
+    seq->version = in.getString();
+    seq->description = in.getString();
+    const QString organismName = in.getString();
+    const QString chromosomeName = in.getString();
+    seq->taxonomyList = in.getString().split('\n', QString::SkipEmptyParts);
+    seq->taxonomyXref = in.getString();
+    seq->organelle = in.getString();
+    seq->length = in.get32();
+    seq->coordinatesOnly = 0 != in.get32();
+    seq->cdsCount = in.get32();
+    seq->rnaCount = in.get32();
+    seq->unknownProtGenesCount = in.get32();
+    seq->unknownProtCdsCount = in.get32();
+
+    const quint32 orphanedCount = in.get32();
+    for (quint32 i=0; i<orphanedCount && in.ok(); ++i) {
+        OrphanedCds cds;
+        cds.lineStart = in.get32();
+        cds.lineEnd = in.get32();
+        cds.dbXref = in.getString();
+        cds.product = in.getString();
+        seq->orphanedCdses.append(cds);
+    }
+
+    seq->origin = in.getBytes();
+
+    const quint32 genesCount = in.get32();
+    for (quint32 g=0; g<genesCount && in.ok(); ++g) {
+        GenePtr gene(new Gene);
+        gene->sequence = seq.toWeakRef();
+        gene->name = in.getString();
+        gene->note = in.getString();
+        gene->start = in.get32();
+        gene->end = in.get32();
+        gene->startCode = in.get32();
+        gene->endCode = in.get32();
+        gene->maxIntronsCount = in.get32();
+        const quint32 geneFlags = in.get32();
+        gene->backwardChain = geneFlags & 0x01;
+        gene->isProteinButNotRna = geneFlags & 0x02;
+        gene->isPseudoGene = geneFlags & 0x04;
+        gene->hasCDS = geneFlags & 0x08;
+        gene->hasRNA = geneFlags & 0x10;
+        seq->genes.append(gene);
+
+        const quint32 isoformsCount = in.get32();
+        for (quint32 i=0; i<isoformsCount && in.ok(); ++i) {
+            IsoformPtr isoform(new Isoform);
+            isoform->gene = gene.toWeakRef();
+            isoform->sequence = seq.toWeakRef();
+            isoform->type = Isoform::Type(in.get32());
+            isoform->proteinXref = in.getString();
+            isoform->proteinId = in.getString();
+            isoform->product = in.getString();
+            isoform->note = in.getString();
+            isoform->translation = in.getString();
+            isoform->cdsStart = in.get32();
+            isoform->cdsEnd = in.get32();
+            isoform->mrnaStart = in.get32();
+            isoform->mrnaEnd = in.get32();
+            isoform->exonsCdsCount = in.get32();
+            isoform->exonsMrnaCount = in.get32();
+            isoform->translTable = in.get32();
+            isoform->codonStart = in.get32();
+            const quint32 isoformFlags = in.get32();
+            isoform->isMaximumByIntrons = isoformFlags & 0x01;
+            isoform->hasCDS = isoformFlags & 0x02;
+            isoform->partialStart = isoformFlags & 0x04;
+            isoform->partialEnd = isoformFlags & 0x08;
+            gene->isoforms.append(isoform);
+
+            const quint32 exonsCount = in.get32();
+            for (quint32 e=0; e<exonsCount && in.ok(); ++e) {
+                ExonPtr exon(new Exon);
+                exon->isoform = isoform.toWeakRef();
+                exon->gene = gene.toWeakRef();
+                exon->sequence = seq.toWeakRef();
+                exon->start = in.get32();
+                exon->end = in.get32();
+                exon->index = in.get32();
+                exon->revIndex = in.get32();
+                const quint32 packed = in.get32();
+                exon->type = Exon::Type(packed & 0xFF);
+                exon->startPhase = (packed >> 8) & 0xFF;
+                exon->endPhase = (packed >> 16) & 0xFF;
+                exon->lengthPhase = (packed >> 24) & 0xFF;
+                isoform->exons.append(exon);
+            }
+
+            const quint32 intronsCount = in.get32();
+            for (quint32 n=0; n<intronsCount && in.ok(); ++n) {
+                IntronPtr intron(new Intron);
+                intron->isoform = isoform.toWeakRef();
+                intron->gene = gene.toWeakRef();
+                intron->sequence = seq.toWeakRef();
+                intron->start = in.get32();
+                intron->end = in.get32();
+                intron->index = in.get32();
+                intron->revIndex = in.get32();
+                intron->intronTypeId = in.get32();
+                const int prevIndex = qint32(in.get32());
+                const int nextIndex = qint32(in.get32());
+                const quint32 packed = in.get32();
+                intron->phase = packed & 0xFF;
+                intron->lengthPhase = (packed >> 8) & 0xFF;
+                if (0 <= prevIndex && prevIndex < isoform->exons.size()) {
+                    ExonPtr prevExon = isoform->exons.at(prevIndex);
+                    intron->prevExon = prevExon.toWeakRef();
+                    prevExon->nextIntron = intron.toWeakRef();
+                }
+                if (0 <= nextIndex && nextIndex < isoform->exons.size()) {
+                    ExonPtr nextExon = isoform->exons.at(nextIndex);
+                    intron->nextExon = nextExon.toWeakRef();
+                    nextExon->prevIntron = intron.toWeakRef();
+                }
+                isoform->introns.append(intron);
+            }
+        }
+    }
+
+    if (!in.ok()) {
+        qWarning() << "Cache file '" << _file.fileName() << "' is damaged. Rest of it ignored!";
+        _pos = _size;
+        return SequencePtr();
+    }
+
+    // Replay organism and chromosome lookups done by parser. Record
+    // without organism had none of them.
+    if (organismName.isEmpty()) {
+        return seq;
+    }
+    OrganismPtr organism = _db->findOrCreateOrganism(organismName);
+    seq->organism = organism.toWeakRef();
+    organism->mutex.lock();
+    if (organism->taxonomyList.isEmpty()) {
+        organism->taxonomyList = seq->taxonomyList;
+    }
+    if (!seq->organelle.isEmpty()) {
+        organism->dbMitochondria = "mitochondrion" == seq->organelle;
+    }
+    if (!seq->taxonomyXref.isEmpty()) {
+        organism->taxonomyXref = seq->taxonomyXref;
+    }
+    organism->mutex.unlock();
+    if (!chromosomeName.isEmpty()) {
+        seq->chromosome = _db->findOrCreateChromosome(chromosomeName, organism);
+    }
+
+    return seq;
+}
+
+SequenceCacheReader::~SequenceCacheReader()
+{
+    if (_data) {
+        _file.unmap(_data);
+    }
+    _file.close();
+}
@@ -0,0 +1,74 @@
+#ifndef SEQUENCECACHE_H
+#define SEQUENCECACHE_H
+
+#include "structures.h"
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QSharedPointer>
+#include <QString>
+
+class Database;
+
+// Binary cache of parsed sequences, one cache file per source file.
+// Cache file is a header followed by 8-byte aligned records of fixed width
+// little-endian fields and length-prefixed strings, so it is read through
+// a memory map without any text processing. Data derived from origin
+// (codons, dinucleotides, feature origins, error flags) is not stored but
+// computed again after loading.
+//
+// Cache is valid only for the same source size, modification time and
+// contents hash, and the same parser options. Contents hash is computed
+// while cache is written, and checked only when size and time match.
+class SequenceCache
+{
+public:
+    static const quint32 Version = 6;
+
+    static QString fileNameFor(const QString & cacheDir,
+                               const QString & sourceFileName);
+};
+
+class SequenceCacheWriter
+{
+public:
+    bool create(const QString & cacheFileName,
+                const QString & sourceFileName,
+                const QString & options);
+    bool isOpen() const;
+    void write(SequencePtr seq);
+    bool commit();
+    ~SequenceCacheWriter();
+
+private:
+    void hashSource(bool wholeRest);
+
+    QFile _file;  // temporary file, renamed to cache file on commit
+    QString _cacheFileName;
+    QFile _source;
+    QCryptographicHash _sourceHash { QCryptographicHash::Sha1 };
+    qint64 _sourceHashPos = 0;  // header offset of contents hash
+    bool _failed = false;
+};
+
+class SequenceCacheReader
+{
+public:
+    bool open(const QString & cacheFileName,
+              const QString & sourceFileName,
+              const QString & options);
+    void setDatabase(QSharedPointer<Database> db);
+    bool atEnd() const;
+    SequencePtr readSequence();
+    ~SequenceCacheReader();
+
+private:
+    QFile _file;
+    uchar * _data = nullptr;
+    qint64 _size = 0;
+    qint64 _pos = 0;
+    QSharedPointer<Database> _db;
+};
+
+#endif // SEQUENCECACHE_H
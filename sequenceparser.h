@@ -0,0 +1,26 @@
+#ifndef SEQUENCEPARSER_H
+#define SEQUENCEPARSER_H
+
+#include "sequencebuilder.h"
+#include "structures.h"
+
+#include <QIODevice>
+#include <QString>
+
+// Common interface of input format parsers. Parser reads records from
+// source and passes their parts to builder, which holds common options.
+class SequenceParser
+{
+public:
+    virtual ~SequenceParser() {}
+    virtual bool setSource(QIODevice * sourceStream, const QString & fileName) = 0;
+    virtual bool atEnd() const = 0;
+    virtual SequencePtr readSequence() = 0;
+
+    inline SequenceBuilder & builder() { return _builder; }
+
+protected:
+    SequenceBuilder _builder;
+};
+
+#endif // SEQUENCEPARSER_H
@@ -0,0 +1,108 @@
+#include "sequencequeue.h"
+
+SequenceQueue::SequenceQueue(int writersCount, qint64 maxBytes)
+    : _writersCount(writersCount)
+    , _maxBytes(maxBytes)
+{
+}
+
+void SequenceQueue::push(SequencePtr seq)
+{
+    Item item;
+    item.sequence = seq;
+    item.bytes = estimateBytes(seq);
+    QMutexLocker lock(&_mutex);
+    while (!_items.isEmpty() && _bytes + item.bytes > _maxBytes) {
+        _notFull.wait(&_mutex);
+    }
+    _items.enqueue(item);
+    _bytes += item.bytes;
+    _notEmpty.wakeOne();
+}
+
+void SequenceQueue::pushInputEnd(const QStringList &organisms)
+{
+    Item item;
+    item.organisms = organisms;
+    QMutexLocker lock(&_mutex);
+    _items.enqueue(item);
+    _notEmpty.wakeAll();
+}
+
+SequencePtr SequenceQueue::pop(unsigned long timeoutMs, bool *atInputEnd)
+{
+    *atInputEnd = false;
+    const Qt::HANDLE writer = QThread::currentThreadId();
+    QMutexLocker lock(&_mutex);
+    if (!hasItemFor(writer) && !(_closed && _items.isEmpty())) {
+        _notEmpty.wait(&_mutex, timeoutMs);
+    }
+    if (!hasItemFor(writer)) {
+        return SequencePtr();
+    }
+    if (!_items.head().sequence) {
+        *atInputEnd = true;
+        return SequencePtr();
+    }
+    const Item item = _items.dequeue();
+    _bytes -= item.bytes;
+    _notFull.wakeAll();
+    return item.sequence;
+}
+
+bool SequenceQueue::passInputEnd(QStringList *organisms)
+{
+    QMutexLocker lock(&_mutex);
+    if (_items.isEmpty() || _items.head().sequence) {
+        return false;
+    }
+    _passedWriters.insert(QThread::currentThreadId());
+    if (_passedWriters.size() < _writersCount) {
+        return false;
+    }
+    *organisms = _items.dequeue().organisms;
+    _passedWriters.clear();
+    _notEmpty.wakeAll();
+    return true;
+}
+
+bool SequenceQueue::hasItemFor(Qt::HANDLE writer) const
+{
+    // Writer which has passed marker waits for the others
+    return !_items.isEmpty() &&
+            (_items.head().sequence || !_passedWriters.contains(writer));
+}
+
+void SequenceQueue::close()
+{
+    QMutexLocker lock(&_mutex);
+    _closed = true;
+    _notEmpty.wakeAll();
+}
+
+bool SequenceQueue::isFinished()
+{
+    QMutexLocker lock(&_mutex);
+    return _closed && _items.isEmpty();
+}
+
+qint64 SequenceQueue::estimateBytes(SequencePtr seq)
+{
+    // Origins dominate, and the rest is roughly a few hundred bytes per
+    // feature object with its strings and pointers
+    static const qint64 FEATURE_BYTES = 512;
+    qint64 result = sizeof(Sequence) + seq->origin.size();
+    Q_FOREACH(GenePtr gene, seq->genes) {
+        result += FEATURE_BYTES;
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            result += FEATURE_BYTES + 2 * isoform->translation.size();
+            Q_FOREACH(ExonPtr exon, isoform->exons) {
+                result += FEATURE_BYTES + exon->origin.size();
+            }
+            Q_FOREACH(IntronPtr intron, isoform->introns) {
+                result += FEATURE_BYTES + intron->origin.size();
+            }
+        }
+    }
+    return result;
+}
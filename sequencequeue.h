@@ -0,0 +1,71 @@
+#ifndef SEQUENCEQUEUE_H
+#define SEQUENCEQUEUE_H
+
+#include "structures.h"
+
+#include <QMutex>
+#include <QQueue>
+#include <QSet>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+
+// Hands finished sequences from parsing workers to database writers.
+// Queue is bounded by estimated memory of queued sequences, so parsers
+// wait while writers are behind. Sequence larger than the whole bound is
+// accepted when queue is empty.
+//
+// End of input marker follows sequences of each input. Every writer
+// passes it after storing sequences it has taken before, and sequences
+// behind it wait, so the last writer passing it knows that the whole
+// input is stored.
+class SequenceQueue
+{
+public:
+    static const qint64 DefaultMaxBytes = 256 * 1024 * 1024;
+
+    explicit SequenceQueue(int writersCount,
+                           qint64 maxBytes = DefaultMaxBytes);
+
+    // Blocks while queue is full
+    void push(SequencePtr seq);
+
+    // Marks end of input of 'organisms', never blocks
+    void pushInputEnd(const QStringList & organisms);
+
+    // Blocks up to timeoutMs while queue has nothing for calling writer.
+    // Returns null on timeout, when queue is closed and empty, or when end
+    // of input is reached, which sets 'atInputEnd'.
+    SequencePtr pop(unsigned long timeoutMs, bool * atInputEnd);
+
+    // Calling writer has stored its sequences of input ended by marker.
+    // Returns true for the last writer, which gets organisms of input.
+    bool passInputEnd(QStringList * organisms);
+
+    // No more sequences will be pushed
+    void close();
+    bool isFinished();
+
+    static qint64 estimateBytes(SequencePtr seq);
+
+private:
+    struct Item {
+        SequencePtr sequence;  // null for end of input marker
+        qint64 bytes = 0;
+        QStringList organisms;  // of ended input
+    };
+
+    bool hasItemFor(Qt::HANDLE writer) const;
+
+    QMutex _mutex;
+    QWaitCondition _notEmpty;
+    QWaitCondition _notFull;
+    QQueue<Item> _items;
+    qint64 _bytes = 0;
+    const int _writersCount;
+    const qint64 _maxBytes;
+    QSet<Qt::HANDLE> _passedWriters;  // of marker at head
+    bool _closed = false;
+};
+
+#endif // SEQUENCEQUEUE_H
@@ -0,0 +1,292 @@
+#include "splicesites.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QSettings>
+#include <QStringList>
+
+#include <cmath>
+
+static const float PSEUDO_COUNT = 0.01f;
+static const float BACKGROUND = 0.25f;
+static const float CONSENSUS_SHARE = 0.85f;
+
+static const char * LETTERS[] = { "A", "C", "G", "T" };
+
+float PositionWeightMatrix::maxScore() const
+{
+    float result = 0.0f;
+    for (int p = 0; p < length(); ++p) {
+        float best = weights[4 * p];
+        for (int letter = 1; letter < 4; ++letter) {
+            best = qMax(best, weights[4 * p + letter]);
+        }
+        result += best;
+    }
+    return result;
+}
+
+PositionWeightMatrix PositionWeightMatrix::fromFrequencies(
+        int before, const QList< QVector<float> > &rows)
+{
+    PositionWeightMatrix result;
+    result.before = before;
+    if (rows.size() != 4) {
+        return result;
+    }
+    const int length = rows[0].size();
+    result.weights.resize(4 * length);
+    for (int p = 0; p < length; ++p) {
+        float sum = 0.0f;
+        for (int letter = 0; letter < 4; ++letter) {
+            sum += rows[letter].value(p, 0.0f);
+        }
+        for (int letter = 0; letter < 4; ++letter) {
+            const float frequency =
+                    (rows[letter].value(p, 0.0f) + PSEUDO_COUNT) /
+                    (sum + 4 * PSEUDO_COUNT);
+            result.weights[4 * p + letter] = std::log2(frequency / BACKGROUND);
+        }
+    }
+    return result;
+}
+
+static QString iupacLetters(char code)
+{
+    switch (code) {
+    case 'A': return "A";
+    case 'C': return "C";
+    case 'G': return "G";
+    case 'T': return "T";
+    case 'R': return "AG";
+    case 'Y': return "CT";
+    case 'M': return "AC";
+    case 'K': return "GT";
+    case 'S': return "CG";
+    case 'W': return "AT";
+    default: return "ACGT";
+    }
+}
+
+PositionWeightMatrix PositionWeightMatrix::fromConsensus(int before,
+                                                         const char *consensus)
+{
+    QList< QVector<float> > rows;
+    const int length = qstrlen(consensus);
+    for (int letter = 0; letter < 4; ++letter) {
+        rows.append(QVector<float>(length, 0.0f));
+    }
+    for (int p = 0; p < length; ++p) {
+        const QString matching = iupacLetters(consensus[p]);
+        const int matchingCount = matching.length();
+        for (int letter = 0; letter < 4; ++letter) {
+            const bool matches = matching.contains(LETTERS[letter]);
+            rows[letter][p] = 4 == matchingCount
+                    ? BACKGROUND
+                    : matches
+                      ? CONSENSUS_SHARE / matchingCount
+                      : (1.0f - CONSENSUS_SHARE) / (4 - matchingCount);
+        }
+    }
+    return fromFrequencies(before, rows);
+}
+
+SpliceSiteModel::SpliceSiteModel()
+{
+    // exon |GT intron : last exon bases, then intron start
+    _donor = PositionWeightMatrix::fromConsensus(3, "MAGGTRAGT");
+    // intron AG| exon : polypyrimidine tract, then intron end and exon start
+    _acceptor = PositionWeightMatrix::fromConsensus(20, "NNNNNNYYYYYYYYYYNYAGGNN");
+    // U12 donor is longer and more conserved than U2 one
+    _u12Donor = PositionWeightMatrix::fromConsensus(0, "RTATCCTTT");
+    _u12Threshold = 0.8f * _u12Donor.maxScore();
+}
+
+static bool loadMatrix(QSettings & settings, const QString & section,
+                       PositionWeightMatrix * pwm)
+{
+    if (!settings.childGroups().contains(section)) {
+        return true;
+    }
+    settings.beginGroup(section);
+    const int before = settings.value("before", pwm->before).toInt();
+    QList< QVector<float> > rows;
+    int length = -1;
+    bool ok = true;
+    for (int letter = 0; letter < 4; ++letter) {
+        const QStringList values = settings.value(LETTERS[letter]).toStringList();
+        QVector<float> row;
+        Q_FOREACH(const QString & value, values) {
+            bool numberOk = false;
+            row.append(value.trimmed().toFloat(&numberOk));
+            ok = ok && numberOk;
+        }
+        ok = ok && !row.isEmpty() && (-1 == length || row.size() == length);
+        length = row.size();
+        rows.append(row);
+    }
+    settings.endGroup();
+    if (!ok) {
+        return false;
+    }
+    *pwm = PositionWeightMatrix::fromFrequencies(before, rows);
+    return true;
+}
+
+bool SpliceSiteModel::load(const QString &fileName)
+{
+    if (!QFile(fileName).exists()) {
+        qWarning() << "Splice sites model " << fileName << " not found. Defaults will be used!";
+        return false;
+    }
+    QSettings settings(fileName, QSettings::IniFormat);
+    bool ok = loadMatrix(settings, "donor", &_donor);
+    ok = loadMatrix(settings, "acceptor", &_acceptor) && ok;
+    const bool u12Given = settings.childGroups().contains("u12_donor");
+    ok = loadMatrix(settings, "u12_donor", &_u12Donor) && ok;
+    _u12Threshold = settings.value("classification/u12_threshold",
+                                   u12Given
+                                   ? 0.8f * _u12Donor.maxScore()
+                                   : _u12Threshold).toFloat();
+    if (!ok) {
+        qWarning() << "Malformed matrix in splice sites model " << fileName
+                   << ". Defaults are used for it!";
+    }
+    return ok;
+}
+
+const PositionWeightMatrix &SpliceSiteModel::donor() const
+{
+    return _donor;
+}
+
+const PositionWeightMatrix &SpliceSiteModel::acceptor() const
+{
+    return _acceptor;
+}
+
+const PositionWeightMatrix &SpliceSiteModel::u12Donor() const
+{
+    return _u12Donor;
+}
+
+float SpliceSiteModel::u12Threshold() const
+{
+    return _u12Threshold;
+}
+
+SpliceSiteScorer::SpliceSiteScorer(const SpliceSiteModel &model)
+    : _model(model)
+{
+}
+
+void SpliceSiteScorer::score(const QList<IntronPtr> &introns,
+                             const QByteArray &origin, qint32 offset) const
+{
+    const int count = introns.size();
+    if (0 == count) {
+        return;
+    }
+    QVector<float> donorScores(count, 0.0f);
+    QVector<float> acceptorScores(count, 0.0f);
+    QVector<float> u12Scores(count, 0.0f);
+    QByteArray codes;
+
+    extractWindows(introns, origin, offset, _model.donor(), true, &codes);
+    scoreWindows(_model.donor(), codes, count, donorScores.data());
+    extractWindows(introns, origin, offset, _model.acceptor(), false, &codes);
+    scoreWindows(_model.acceptor(), codes, count, acceptorScores.data());
+    extractWindows(introns, origin, offset, _model.u12Donor(), true, &codes);
+    scoreWindows(_model.u12Donor(), codes, count, u12Scores.data());
+
+    for (int i = 0; i < count; ++i) {
+        IntronPtr intron = introns[i];
+        intron->donorScore = donorScores[i];
+        intron->acceptorScore = acceptorScores[i];
+        intron->u12DonorScore = u12Scores[i];
+        intron->spliceosome = u12Scores[i] >= _model.u12Threshold() ? "U12" : "U2";
+        intron->spliceClass = dinucleotideClass(intron->startDinucleotide,
+                                                intron->endDinucleotide);
+    }
+}
+
+QString SpliceSiteScorer::dinucleotideClass(const QByteArray &startDinucleotide,
+                                            const QByteArray &endDinucleotide)
+{
+    if ("AG" == endDinucleotide && "GT" == startDinucleotide) {
+        return "GT-AG";
+    }
+    else if ("AG" == endDinucleotide && "GC" == startDinucleotide) {
+        return "GC-AG";
+    }
+    else if ("AC" == endDinucleotide && "AT" == startDinucleotide) {
+        return "AT-AC";
+    }
+    return "other";
+}
+
+static inline quint8 baseCode(char base)
+{
+    switch (base) {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return 4;
+    }
+}
+
+void SpliceSiteScorer::extractWindows(const QList<IntronPtr> &introns,
+                                      const QByteArray &origin, qint32 offset,
+                                      const PositionWeightMatrix &pwm, bool donor,
+                                      QByteArray *codes)
+{
+    const int count = introns.size();
+    const int length = pwm.length();
+    codes->fill(4, count * length);
+    char * data = codes->data();
+    for (int w = 0; w < count; ++w) {
+        IntronPtr intron = introns[w];
+        const bool bw = intron->gene.toStrongRef()->backwardChain;
+        // Boundary in genome coordinates, window goes in transcription order
+        qint64 boundary = 0;
+        if (donor) {
+            boundary = bw ? intron->end : intron->start;
+        }
+        else {
+            boundary = bw ? qint64(intron->start) - 1 : qint64(intron->end) + 1;
+        }
+        for (int p = 0; p < length; ++p) {
+            const qint64 position = bw
+                    ? boundary + pwm.before - p
+                    : boundary - pwm.before + p;
+            const qint64 index = position - offset - 1;
+            if (index < 0 || index >= origin.size()) {
+                continue;
+            }
+            const quint8 code = baseCode(origin[int(index)]);
+            data[p * count + w] = bw && code < 4 ? 3 - code : code;
+        }
+    }
+}
+
+void SpliceSiteScorer::scoreWindows(const PositionWeightMatrix &pwm,
+                                    const QByteArray &codes, int count,
+                                    float *scores)
+{
+    const uchar * data = reinterpret_cast<const uchar*>(codes.constData());
+    for (int p = 0; p < pwm.length(); ++p) {
+        const float a = pwm.weights[4 * p];
+        const float c = pwm.weights[4 * p + 1];
+        const float g = pwm.weights[4 * p + 2];
+        const float t = pwm.weights[4 * p + 3];
+        const uchar * column = data + p * count;
+        // Selects instead of branches or gathers, so compiler turns this
+        // loop into SIMD compares and blends. Unknown bases score zero.
+        for (int w = 0; w < count; ++w) {
+            const uchar code = column[w];
+            scores[w] += float(0 == code) * a + float(1 == code) * c +
+                    float(2 == code) * g + float(3 == code) * t;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef SPLICESITES_H
+#define SPLICESITES_H
+
+#include "structures.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+// Log-odds position weight matrix over a window around splice site
+// boundary. Boundary is the first intron base for donor sites and the
+// first exon base after intron for acceptor sites.
+struct PositionWeightMatrix {
+    int             before = 0;  // window bases before boundary
+    QVector<float>  weights;  // A, C, G, T weights of each position
+
+    int length() const { return weights.size() / 4; }
+    float maxScore() const;
+
+    // Matrix from letters frequencies of each position, given as rows
+    static PositionWeightMatrix fromFrequencies(int before,
+                                                const QList< QVector<float> > & rows);
+    // Matrix from IUPAC consensus, where matching bases share most of
+    // frequency at each position
+    static PositionWeightMatrix fromConsensus(int before, const char * consensus);
+};
+
+// Matrices used to score introns. Defaults are derived from canonical
+// U2 and U12 consensus sequences, and might be replaced by model file:
+//
+//   [donor]
+//   before=3
+//   A=0.33,0.60,0.08,0.00,0.00,0.49,0.71,0.06,0.15
+//   C=...
+//   G=...
+//   T=...
+//   [acceptor]
+//   ...
+//   [u12_donor]
+//   ...
+//   [classification]
+//   u12_threshold=10.5
+//
+// Sections which are absent keep their defaults.
+class SpliceSiteModel
+{
+public:
+    SpliceSiteModel();
+    bool load(const QString & fileName);
+
+    const PositionWeightMatrix & donor() const;
+    const PositionWeightMatrix & acceptor() const;
+    const PositionWeightMatrix & u12Donor() const;
+    float u12Threshold() const;
+
+private:
+    PositionWeightMatrix _donor;
+    PositionWeightMatrix _acceptor;
+    PositionWeightMatrix _u12Donor;
+    float _u12Threshold;
+};
+
+// Scores introns in batches: windows of all introns are extracted into
+// position-major buffer of base codes, so each matrix position is applied
+// to all windows by one branch-free loop.
+class SpliceSiteScorer
+{
+public:
+    explicit SpliceSiteScorer(const SpliceSiteModel & model);
+
+    // Origin might be a window which starts right after 'offset' bases
+    void score(const QList<IntronPtr> & introns,
+               const QByteArray & origin, qint32 offset) const;
+
+    static QString dinucleotideClass(const QByteArray & startDinucleotide,
+                                     const QByteArray & endDinucleotide);
+
+private:
+    static void extractWindows(const QList<IntronPtr> & introns,
+                               const QByteArray & origin, qint32 offset,
+                               const PositionWeightMatrix & pwm, bool donor,
+                               QByteArray * codes);
+    static void scoreWindows(const PositionWeightMatrix & pwm,
+                             const QByteArray & codes, int count,
+                             float * scores);
+
+    const SpliceSiteModel & _model;
+};
+
+#endif // SPLICESITES_H
@@ -9,6 +9,7 @@
 #include <QString>
 #include <QStringList>
 #include <QMutex>
+#include <QVector>
 #include <QWeakPointer>
 
 struct IntronType;
@@ -48,6 +49,33 @@ struct Range {
     }
 };
 
+// Parsed feature location: overall bounds and joined ranges, if any
+struct FeatureLocation {
+    quint32 start = UINT32_MAX;
+    quint32 end = 0;
+    bool backwardChain = false;
+    QList<quint32> starts;
+    QList<quint32> ends;
+    // Feature continues beyond its lowest or highest position, marked by
+    // '<' and '>' in GBK and by start_range and end_range in GFF3
+    bool partialLow = false;
+    bool partialHigh = false;
+};
+
+struct Composition {
+    quint32 gcCount = 0;
+    quint32 cpgCount = 0;
+    quint32 nCount = 0;
+    quint32 homopolymerRuns = 0;
+    quint32 longestHomopolymer = 0;
+
+    // G+C share of known bases
+    inline float gcContent(quint32 length) const {
+        const quint32 known = length - nCount;
+        return 0 == known ? 0.0f : float(gcCount) / float(known);
+    }
+};
+
 typedef QSharedPointer<IntronType> IntronTypePtr;
 typedef QSharedPointer<TaxKingdom> TaxKingdomPtr;
 typedef QSharedPointer<TaxGroup1> TaxGroup1Ptr;
@@ -154,6 +182,15 @@ struct Chromosome {
 
 
 
+struct OrphanedCds {
+    quint32         lineStart = 0;
+    quint32         lineEnd = 0;
+    QString         dbXref;
+    QString         product;
+};
+
+
+
 struct Sequence {
     qint32          id = 0;
     QString         sourceFileName;
@@ -163,9 +200,20 @@ struct Sequence {
     quint32         length = 0;
     OrganismWPtr    organism;
     ChromosomeWPtr  chromosome;
+    QStringList     taxonomyList;
+    QString         taxonomyXref;
+    QString         organelle;
     QString         originFileName;
     QByteArray      origin;
+    bool            coordinatesOnly = false;  // origin was not decoded
+
+    // Contribution to organism counters, added while storing sequence
+    quint32         cdsCount = 0;
+    quint32         rnaCount = 0;
+    quint32         unknownProtGenesCount = 0;
+    quint32         unknownProtCdsCount = 0;
 
+    QList<OrphanedCds> orphanedCdses;
     QList<GenePtr>  genes;
 };
 
@@ -226,6 +274,11 @@ struct Isoform {
     QList<IntronPtr>  introns;
     bool              hasCDS = false;
     QString         translation;
+    quint32         translTable = 1;  // NCBI genetic code id
+    quint32         codonStart = 1;  // first base of first complete codon
+    bool            partialStart = false;  // CDS has no 5' end
+    bool            partialEnd = false;  // CDS has no 3' end
+    QVector<quint32> codonCounts;  // of CDS, 64 codons in TCAG order
 
     // Fields required to match CDS/mRNA
     QList<Range>    mRnaRanges;
@@ -254,6 +307,7 @@ struct Exon {
     IntronWPtr      prevIntron;
     IntronWPtr      nextIntron;
     QByteArray      origin;
+    Composition     composition;
 
     bool            errorInPseudoFlag = false;
     bool            errorNInSequence = false;
@@ -280,7 +334,13 @@ struct Intron {
     bool            errorMain = false;
     bool            warningNInSequence = false;
     qint32          intronTypeId = 0;
+    float           donorScore = 0.0f;  // log-odds by splice sites model
+    float           acceptorScore = 0.0f;
+    float           u12DonorScore = 0.0f;
+    QString         spliceosome;  // U2 or U12
+    QString         spliceClass;  // GT-AG, GC-AG, AT-AC or other
     QByteArray      origin;
+    Composition     composition;
 };
 
 